@@ -5,6 +5,7 @@
  */
 
 #include <kernel/kassert.h>
+#include <kernel/arch/arch_smp.h>
 #include "arm_gicv2_dist_if.h"
 #include "arm_gicv2_cpu_if.h"
 #include "arm_gicv2.h"
@@ -17,13 +18,15 @@
 
 irq_controller_dev_ops_t arm_gicv2_ops = {
     .init = arm_gicv2_init,
+    .init_cpu = arm_gicv2_init_cpu,
     .enable = arm_gicv2_enable_irq,
     .disable = arm_gicv2_disable_irq,
     .get_pending = arm_gicv2_get_pending_irq,
     .ack = arm_gicv2_ack_irq,
     .end = arm_gicv2_end_irq,
     .done = arm_gicv2_done_irq,
-    .clr = arm_gicv2_clr_irq
+    .clr = arm_gicv2_clr_irq,
+    .send_ipi = arm_gicv2_send_ipi
 };
 
 static inline uint64_t mpidr_el1_r(void) {
@@ -38,6 +41,13 @@ void arm_gicv2_init(void *data) {
     // Initialize the distributor and enable non-secure group 1 interrupts
     gicd_ctrl_write(gicv2->gicd_base, S_GICD_CTRL_ENABLE);
 
+    arm_gicv2_init_cpu(data);
+}
+
+void arm_gicv2_init_cpu(void *data) {
+    arm_gicv2_t *gicv2 = (arm_gicv2_t*)data;
+
+    // The CPU interface registers are banked per CPU
     // Set the priority mask and binary point registers. Allow any priority to preempt.
     gicc_pmr_write(gicv2->gicc_base, 0xff);
     gicc_bpr_write(gicv2->gicc_base, 0x0);
@@ -86,19 +96,27 @@ irq_id_t arm_gicv2_get_pending_irq(void *data) {
 irq_id_t arm_gicv2_ack_irq(void *data) {
     arm_gicv2_t *gicv2 = (arm_gicv2_t*)data;
 
-    return G_GICC_IAR_INTID(gicc_iar_read(gicv2->gicc_base));
+    uint32_t iar = gicc_iar_read(gicv2->gicc_base);
+    irq_id_t id = G_GICC_IAR_INTID(iar) & 0x3ff;
+
+    // The IAR of an SGI also holds the CPU that raised it which has to be written back to the EOIR and DIR
+    if (IS_SGI(id)) gicv2->sgi_cpuid[arch_cpu_get_id()] = G_GICC_IAR_CPUID(iar);
+
+    return id;
 }
 
 void arm_gicv2_end_irq(void *data, irq_id_t id) {
     arm_gicv2_t *gicv2 = (arm_gicv2_t*)data;
+    unsigned int cpuid = IS_SGI(id) ? gicv2->sgi_cpuid[arch_cpu_get_id()] : 0;
 
-    gicc_eoir_write(gicv2->gicc_base, id);
+    gicc_eoir_write(gicv2->gicc_base, F_GICC_EOIR_CPUID(cpuid) | F_GICC_EOIR_INTID(id));
 }
 
 void arm_gicv2_done_irq(void *data, irq_id_t id) {
     arm_gicv2_t *gicv2 = (arm_gicv2_t*)data;
+    unsigned int cpuid = IS_SGI(id) ? gicv2->sgi_cpuid[arch_cpu_get_id()] : 0;
 
-    gicc_dir_write(gicv2->gicc_base, id);
+    gicc_dir_write(gicv2->gicc_base, F_GICC_EOIR_CPUID(cpuid) | F_GICC_DIR_INTID(id));
 }
 
 void arm_gicv2_clr_irq(void *data, irq_id_t id) {
@@ -106,3 +124,16 @@ void arm_gicv2_clr_irq(void *data, irq_id_t id) {
 
     gicd_icpendr_set(gicv2->gicd_base, id);
 }
+
+void arm_gicv2_send_ipi(void *data, irq_id_t id, unsigned int cpu) {
+    arm_gicv2_t *gicv2 = (arm_gicv2_t*)data;
+
+    // GICv2 only supports 8 CPU interfaces in one cluster, numbered by the Aff0 of their CPU
+    unsigned long mpidr = arch_smp_get_mpidr(cpu);
+    kassert(IS_SGI(id) && mpidr < 8);
+
+    // Make sure anything written for the target CPU is visible before it takes the interrupt
+    asm volatile ("dsb ishst");
+    gicd_sgir_write(gicv2->gicd_base, F_GICD_SGIR_CPUTARGETLIST(1 << mpidr) | S_GICD_SGIR_NSATT |
+        F_GICD_SGIR_INTID(id));
+}
@@ -9,10 +9,12 @@
 
 #include <sys/types.h>
 #include <kernel/irq_types.h>
+#include <kernel/arch/arch_cpu.h>
 
 typedef struct {
     uintptr_t gicd_base;
     uintptr_t gicc_base;
+    unsigned int sgi_cpuid[MAX_NUM_CPUS];  // Source CPU interface of the SGI being handled on each CPU, by CPU ID
 } arm_gicv2_t;
 
 extern irq_controller_dev_ops_t arm_gicv2_ops;
@@ -20,6 +22,7 @@ extern irq_controller_dev_ops_t arm_gicv2_ops;
 #define ARM_GICV2_SPURIOUS_IRQ_ID (1023)
 
 void arm_gicv2_init(void *data);
+void arm_gicv2_init_cpu(void *data);
 void arm_gicv2_enable_irq(void *data, irq_id_t id, irq_priority_t priority, irq_type_t type);
 void arm_gicv2_disable_irq(void  *data, irq_id_t id);
 irq_id_t arm_gicv2_get_pending_irq(void *data);
@@ -27,5 +30,6 @@ irq_id_t arm_gicv2_ack_irq(void *data);
 void arm_gicv2_end_irq(void *data, irq_id_t id);
 void arm_gicv2_done_irq(void *data, irq_id_t id);
 void arm_gicv2_clr_irq(void *data, irq_id_t id);
+void arm_gicv2_send_ipi(void *data, irq_id_t id, unsigned int cpu);
 
 #endif // _ARM_GICV2_H_
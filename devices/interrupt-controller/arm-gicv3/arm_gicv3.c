@@ -5,6 +5,7 @@
  */
 
 #include <kernel/kassert.h>
+#include <kernel/arch/arch_smp.h>
 #include "arm_gicv3_dist_if.h"
 #include "arm_gicv3_rdist_if.h"
 #include "arm_gicv3_cpu_if.h"
@@ -19,13 +20,15 @@
 
 irq_controller_dev_ops_t arm_gicv3_ops = {
     .init = arm_gicv3_init,
+    .init_cpu = arm_gicv3_init_cpu,
     .enable = arm_gicv3_enable_irq,
     .disable = arm_gicv3_disable_irq,
     .get_pending = arm_gicv3_get_pending_irq,
     .ack = arm_gicv3_ack_irq,
     .end = arm_gicv3_end_irq,
     .done = arm_gicv3_done_irq,
-    .clr = arm_gicv3_clr_irq
+    .clr = arm_gicv3_clr_irq,
+    .send_ipi = arm_gicv3_send_ipi
 };
 
 static inline uint64_t mpidr_el1_r(void) {
@@ -37,11 +40,18 @@ static inline uint64_t mpidr_el1_r(void) {
 void arm_gicv3_init(void *data) {
     arm_gicv3_t *gicv3 = (arm_gicv3_t*)data;
 
-    uintptr_t gicr_base = GICR_PE_OFFSET(gicv3, THIS_PE_NUM);
-
     // Initialize the distributor and enable non-secure group 1 interrupts
     gicd_ctrl_write(gicv3->gicd_base, S_GICD_CTRL_ARE | S_GICD_CTRL_ENABLEGRP1);
 
+    arm_gicv3_init_cpu(data);
+}
+
+void arm_gicv3_init_cpu(void *data) {
+    arm_gicv3_t *gicv3 = (arm_gicv3_t*)data;
+
+    // Each CPU has its own redistributor
+    uintptr_t gicr_base = GICR_PE_OFFSET(gicv3, THIS_PE_NUM);
+
     // Mark this processor as awake in the redistributor
     uint32_t waker = gicr_waker_read(gicr_base);
     kassert(G_GICR_WAKER_CHILDRENASLEEP(waker));
@@ -148,3 +158,18 @@ void arm_gicv3_clr_irq(void *data, irq_id_t id) {
         gicd_icpendr_set(gicr_base, id);
     }
 }
+
+void arm_gicv3_send_ipi(void *data, irq_id_t id, unsigned int cpu) {
+    kassert(IS_SGI(id));
+
+    // The target is named by its Aff3-Aff1 and a bit for its Aff0. The target list only covers 16 Aff0 values at a
+    // time, the range selector picks which 16
+    uint64_t mpidr = arch_smp_get_mpidr(cpu), aff0 = mpidr & 0xff;
+    uint64_t sgi1r = F_ICC_SGI1R_AFF3(mpidr >> 32) | F_ICC_SGI1R_AFF2(mpidr >> 16) | F_ICC_SGI1R_AFF1(mpidr >> 8) |
+        F_ICC_SGI1R_RS(aff0 >> 4) | F_ICC_SGI1R_INTID(id) | F_ICC_SGI1R_TARGETLIST(1 << (aff0 & 0xf));
+
+    // Make sure anything written for the target CPU is visible before it takes the interrupt
+    asm volatile ("dsb ishst");
+    icc_sgi1r_el1_w(sgi1r);
+    asm volatile ("isb");
+}
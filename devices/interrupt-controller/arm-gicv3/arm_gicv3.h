@@ -20,6 +20,7 @@ extern irq_controller_dev_ops_t arm_gicv3_ops;
 #define ARM_GICV3_SPURIOUS_IRQ_ID (1023)
 
 void arm_gicv3_init(void *data);
+void arm_gicv3_init_cpu(void *data);
 void arm_gicv3_enable_irq(void *data, irq_id_t id, irq_priority_t priority, irq_type_t type);
 void arm_gicv3_disable_irq(void  *data, irq_id_t id);
 irq_id_t arm_gicv3_get_pending_irq(void *data);
@@ -27,5 +28,6 @@ irq_id_t arm_gicv3_ack_irq(void *data);
 void arm_gicv3_end_irq(void *data, irq_id_t id);
 void arm_gicv3_done_irq(void *data, irq_id_t id);
 void arm_gicv3_clr_irq(void *data, irq_id_t id);
+void arm_gicv3_send_ipi(void *data, irq_id_t id, unsigned int cpu);
 
 #endif // _ARM_GICV3_H_
@@ -211,6 +211,13 @@
 #define icc_dir_el1_w(v)                              asm volatile ("msr S3_0_C12_C11_1, %0" :: "r" (v));
 
 #define icc_sgi0r_el1_w(v)                            asm volatile ("msr S3_0_C12_C11_7, %0" :: "r" (v));
+#define F_ICC_SGI1R_AFF3(f)                           (((f) & 0xffUL) << 48)
+#define F_ICC_SGI1R_RS(f)                             (((f) & 0xfUL) << 44)
+#define S_ICC_SGI1R_IRM                               (1UL << 40)
+#define F_ICC_SGI1R_AFF2(f)                           (((f) & 0xffUL) << 32)
+#define F_ICC_SGI1R_INTID(f)                          (((f) & 0xfUL) << 24)
+#define F_ICC_SGI1R_AFF1(f)                           (((f) & 0xffUL) << 16)
+#define F_ICC_SGI1R_TARGETLIST(f)                     ((f) & 0xffffUL)
 #define icc_sgi1r_el1_w(v)                            asm volatile ("msr S3_0_C12_C11_5, %0" :: "r" (v));
 #define icc_asgi1r_el1_w(v)                           asm volatile ("msr S3_0_C12_C11_6, %0" :: "r" (v));
 
@@ -118,7 +118,7 @@
 #define F_GICD_SGIR_CPUTARGETLIST(f)                  (((f) & 0xff) << 16)
 #define S_GICD_SGIR_NSATT                             (1 << 15)
 #define F_GICD_SGIR_INTID(f)                          ((f) & 0xf)
-#define gicd_sgir_write(b, r)                         (MMIO_WRITE_32(b, GICD_SGIR))
+#define gicd_sgir_write(b, r)                         (MMIO_WRITE_32(b, GICD_SGIR, r))
 
 #define GICD_CPENDSGIR(n)                             (0x0F10 + (4 * (n)))
 #define gicd_cpendsgir_set(b, id)                     GIC_SET_BIT_32(b, GICD_CPENDSGIR, id)
@@ -6,20 +6,28 @@
 
 #include <kernel/kassert.h>
 #include <kernel/arch/arch_asm.h>
+#include <kernel/arch/arch_smp.h>
 #include "bcm2836_l1_intc_if.h"
 #include "bcm2836_l1_intc.h"
 
 irq_controller_dev_ops_t bcm2836_l1_intc_ops = {
     .init = bcm2836_l1_intc_init,
+    .init_cpu = bcm2836_l1_intc_init_cpu,
     .enable = bcm2836_l1_intc_enable_irq,
     .disable = bcm2836_l1_intc_disable_irq,
     .get_pending = bcm2836_l1_intc_get_pending_irq,
     .ack = bcm2836_l1_intc_ack_irq,
     .end = bcm2836_l1_intc_end_irq,
     .done = bcm2836_l1_intc_done_irq,
-    .clr = bcm2836_l1_intc_clr_irq
+    .clr = bcm2836_l1_intc_clr_irq,
+    .send_ipi = bcm2836_l1_intc_send_ipi
 };
 
+// IRQ IDs follow the bits in the core interrupt source registers: 0-3 are the core timers, 4-7 are the mailboxes
+#define IS_TIMER(id)   ((id) < 4)
+#define IS_MAILBOX(id) ((id) >= 4 && (id) < 8)
+#define MAILBOX(id)    ((id) - 4)
+
 static inline uint64_t mpidr_el1_r(void) {
     uint64_t v;
     asm ("mrs %0, MPIDR_EL1" : "=r" (v));
@@ -28,13 +36,24 @@ static inline uint64_t mpidr_el1_r(void) {
 
 void bcm2836_l1_intc_init(void *data) {
     bcm2836_l1_intc_t *intc = (bcm2836_l1_intc_t*)data;
-    unsigned int core = mpidr_el1_r() & 0xff;
 
     // Clear interrupt sources; route GPU interrupts to core0
     intc_control_write(intc->intc_base, 0);
     intc_gpu_int_routing_write(intc->intc_base, 0);
     intc_pmu_int_routing_clr_write(intc->intc_base, 0xffffffff);
     intc_axi_interrupts_write(intc->intc_base, 0);
+
+    bcm2836_l1_intc_init_cpu(data);
+}
+
+void bcm2836_l1_intc_init_cpu(void *data) {
+    bcm2836_l1_intc_t *intc = (bcm2836_l1_intc_t*)data;
+    unsigned int core = mpidr_el1_r() & 0xff;
+
+    // Throw away any messages left in this core's mailboxes by the firmware
+    for (unsigned int m = 0; m < 4; m++) {
+        intc_core_mailbox_clr_write(intc->intc_base, core, m, 0xffffffff);
+    }
 }
 
 void bcm2836_l1_intc_enable_irq(void *data, irq_id_t id, irq_priority_t priority, irq_type_t type) {
@@ -44,14 +63,14 @@ void bcm2836_l1_intc_enable_irq(void *data, irq_id_t id, irq_priority_t priority
     // FIXME no support for GPU and PMU interrupts
     if (id >= 8) return;
 
-    if (id < 4) {
+    if (IS_TIMER(id)) {
         // Timer ID
         uint32_t timer_ctrl = intc_core_timer_ctrl_read(intc->intc_base, core);
         intc_core_timer_ctrl_write(intc->intc_base, core, timer_ctrl | (1 << id));
     } else {
-        // Mailbox ID
+        // Mailbox ID. The low 4 bits of the mailbox control register are the IRQ enables, the upper 4 are for FIQs
         uint32_t mailbox_ctrl = intc_core_mailbox_ctrl_read(intc->intc_base, core);
-        intc_core_mailbox_ctrl_write(intc->intc_base, core, mailbox_ctrl | (1 << id));
+        intc_core_mailbox_ctrl_write(intc->intc_base, core, mailbox_ctrl | (1 << MAILBOX(id)));
     }
 }
 
@@ -62,14 +81,14 @@ void bcm2836_l1_intc_disable_irq(void *data, irq_id_t id) {
     // FIXME no support for GPU and PMU interrupts
     if (id >= 8) return;
 
-    if (id < 4) {
+    if (IS_TIMER(id)) {
         // Timer ID
         uint32_t timer_ctrl = intc_core_timer_ctrl_read(intc->intc_base, core);
         intc_core_timer_ctrl_write(intc->intc_base, core, timer_ctrl & ~(1 << id));
     } else {
         // Mailbox ID
         uint32_t mailbox_ctrl = intc_core_mailbox_ctrl_read(intc->intc_base, core);
-        intc_core_mailbox_ctrl_write(intc->intc_base, core, mailbox_ctrl & ~(1 << id));
+        intc_core_mailbox_ctrl_write(intc->intc_base, core, mailbox_ctrl & ~(1 << MAILBOX(id)));
     }
 }
 
@@ -95,6 +114,10 @@ irq_id_t bcm2836_l1_intc_ack_irq(void *data) {
 
 void bcm2836_l1_intc_end_irq(void *data, irq_id_t id) {
     bcm2836_l1_intc_t *intc = (bcm2836_l1_intc_t*)data;
+    unsigned int core = mpidr_el1_r() & 0xff;
+
+    // Mailbox interrupts stay asserted until all the bits in the mailbox are cleared
+    if (IS_MAILBOX(id)) intc_core_mailbox_clr_write(intc->intc_base, core, MAILBOX(id), 0xffffffff);
 }
 
 void bcm2836_l1_intc_done_irq(void *data, irq_id_t id) {
@@ -104,3 +127,14 @@ void bcm2836_l1_intc_done_irq(void *data, irq_id_t id) {
 void bcm2836_l1_intc_clr_irq(void *data, irq_id_t id) {
     bcm2836_l1_intc_t *intc = (bcm2836_l1_intc_t*)data;
 }
+
+void bcm2836_l1_intc_send_ipi(void *data, irq_id_t id, unsigned int cpu) {
+    bcm2836_l1_intc_t *intc = (bcm2836_l1_intc_t*)data;
+
+    kassert(IS_MAILBOX(id));
+
+    // Mailboxes are per core, numbered by the Aff0 of their CPU like everywhere else in this driver. Any bit set in
+    // the target core's mailbox raises the interrupt
+    unsigned int core = arch_smp_get_mpidr(cpu) & 0xff;
+    intc_core_mailbox_set_write(intc->intc_base, core, MAILBOX(id), 1);
+}
@@ -19,7 +19,11 @@ extern irq_controller_dev_ops_t bcm2836_l1_intc_ops;
 
 #define BCM2836_L1_INTC_SPURIOUS_IRQ_ID (255)
 
+// Mailbox 0 interrupt, used for IPIs
+#define BCM2836_L1_INTC_IPI_IRQ_ID      (4)
+
 void bcm2836_l1_intc_init(void *data);
+void bcm2836_l1_intc_init_cpu(void *data);
 void bcm2836_l1_intc_enable_irq(void *data, irq_id_t id, irq_priority_t priority, irq_type_t type);
 void bcm2836_l1_intc_disable_irq(void  *data, irq_id_t id);
 irq_id_t bcm2836_l1_intc_get_pending_irq(void *data);
@@ -27,5 +31,6 @@ irq_id_t bcm2836_l1_intc_ack_irq(void *data);
 void bcm2836_l1_intc_end_irq(void *data, irq_id_t id);
 void bcm2836_l1_intc_done_irq(void *data, irq_id_t id);
 void bcm2836_l1_intc_clr_irq(void *data, irq_id_t id);
+void bcm2836_l1_intc_send_ipi(void *data, irq_id_t id, unsigned int cpu);
 
 #endif // _BCM2836_L1_INTC_H_
@@ -200,31 +200,39 @@
 #define intc_core_fast_interrupt_source_read(b, n)         (MMIO_READ_32(b, INTC_CORE_FAST_INTERRUPT_SOURCE(n)))
 
 #define INTC_CORE_MAILBOX0_SET(n)                          (0x80 + ((n) * 0x10))
-#define intc_core_mailbox0_set_write(b, n, r)              (MMIO_WRITE_32(b, INTC_CORE_MAILBOX0_SET(n), r)
+#define intc_core_mailbox0_set_write(b, n, r)              (MMIO_WRITE_32(b, INTC_CORE_MAILBOX0_SET(n), r))
 
 #define INTC_CORE_MAILBOX1_SET(n)                          (0x84 + ((n) * 0x10))
-#define intc_core_mailbox1_set_write(b, n, r)              (MMIO_WRITE_32(b, INTC_CORE_MAILBOX1_SET(n), r)
+#define intc_core_mailbox1_set_write(b, n, r)              (MMIO_WRITE_32(b, INTC_CORE_MAILBOX1_SET(n), r))
 
 #define INTC_CORE_MAILBOX2_SET(n)                          (0x88 + ((n) * 0x10))
-#define intc_core_mailbox2_set_write(b, n, r)              (MMIO_WRITE_32(b, INTC_CORE_MAILBOX2_SET(n), r)
+#define intc_core_mailbox2_set_write(b, n, r)              (MMIO_WRITE_32(b, INTC_CORE_MAILBOX2_SET(n), r))
 
 #define INTC_CORE_MAILBOX3_SET(n)                          (0x8C + ((n) * 0x10))
-#define intc_core_mailbox3_set_write(b, n, r)              (MMIO_WRITE_32(b, INTC_CORE_MAILBOX3_SET(n), r)
+#define intc_core_mailbox3_set_write(b, n, r)              (MMIO_WRITE_32(b, INTC_CORE_MAILBOX3_SET(n), r))
 
 #define INTC_CORE_MAILBOX0_CLR(n)                          (0xC0 + ((n) * 0x10))
 #define intc_core_mailbox0_clr_read(b, n)                  (MMIO_READ_32(b, INTC_CORE_MAILBOX0_CLR(n)))
-#define intc_core_mailbox0_clr_write(b, n, r)              (MMIO_WRITE_32(b, INTC_CORE_MAILBOX0_CLR(n), r)
+#define intc_core_mailbox0_clr_write(b, n, r)              (MMIO_WRITE_32(b, INTC_CORE_MAILBOX0_CLR(n), r))
 
 #define INTC_CORE_MAILBOX1_CLR(n)                          (0xC4 + ((n) * 0x10))
 #define intc_core_mailbox1_clr_read(b, n)                  (MMIO_READ_32(b, INTC_CORE_MAILBOX1_CLR(n)))
-#define intc_core_mailbox1_clr_write(b, n, r)              (MMIO_WRITE_32(b, INTC_CORE_MAILBOX1_CLR(n), r)
+#define intc_core_mailbox1_clr_write(b, n, r)              (MMIO_WRITE_32(b, INTC_CORE_MAILBOX1_CLR(n), r))
 
 #define INTC_CORE_MAILBOX2_CLR(n)                          (0xC8 + ((n) * 0x10))
 #define intc_core_mailbox2_clr_read(b, n)                  (MMIO_READ_32(b, INTC_CORE_MAILBOX2_CLR(n)))
-#define intc_core_mailbox2_clr_write(b, n, r)              (MMIO_WRITE_32(b, INTC_CORE_MAILBOX2_CLR(n), r)
+#define intc_core_mailbox2_clr_write(b, n, r)              (MMIO_WRITE_32(b, INTC_CORE_MAILBOX2_CLR(n), r))
 
 #define INTC_CORE_MAILBOX3_CLR(n)                          (0xCC + ((n) * 0x10))
 #define intc_core_mailbox3_clr_read(b, n)                  (MMIO_READ_32(b, INTC_CORE_MAILBOX3_CLR(n)))
-#define intc_core_mailbox3_clr_write(b, n, r)              (MMIO_WRITE_32(b, INTC_CORE_MAILBOX3_CLR(n), r)
+#define intc_core_mailbox3_clr_write(b, n, r)              (MMIO_WRITE_32(b, INTC_CORE_MAILBOX3_CLR(n), r))
+
+// Mailbox m of core n
+#define INTC_CORE_MAILBOX_SET(n, m)                        (0x80 + ((n) * 0x10) + ((m) * 4))
+#define intc_core_mailbox_set_write(b, n, m, r)            (MMIO_WRITE_32(b, INTC_CORE_MAILBOX_SET(n, m), r))
+
+#define INTC_CORE_MAILBOX_CLR(n, m)                        (0xC0 + ((n) * 0x10) + ((m) * 4))
+#define intc_core_mailbox_clr_read(b, n, m)                (MMIO_READ_32(b, INTC_CORE_MAILBOX_CLR(n, m)))
+#define intc_core_mailbox_clr_write(b, n, m, r)            (MMIO_WRITE_32(b, INTC_CORE_MAILBOX_CLR(n, m), r))
 
 #endif // _BCM2836_L1_INTC_IF_H_
@@ -0,0 +1,31 @@
+/* 
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDS-License-Identifier: MIT
+ */
+
+.text
+
+# Calls into the hypervisor's PSCI implementation
+# x0 [in]  - PSCI function ID
+# x1 [in]  - Argument 1
+# x2 [in]  - Argument 2
+# x3 [in]  - Argument 3
+# x0 [out] - PSCI return value
+.global _arch_psci_hvc
+.align 2
+_arch_psci_hvc:
+    hvc #0
+    ret lr
+
+# Calls into the secure monitor's PSCI implementation
+# x0 [in]  - PSCI function ID
+# x1 [in]  - Argument 1
+# x2 [in]  - Argument 2
+# x3 [in]  - Argument 3
+# x0 [out] - PSCI return value
+.global _arch_psci_smc
+.align 2
+_arch_psci_smc:
+    smc #0
+    ret lr
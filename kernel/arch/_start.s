@@ -19,6 +19,12 @@ _start:
     # Save the pointer to the device tree
     mov x13, x0
 
+    # There is no per-CPU data until the MMU is on
+    msr TPIDR_EL1, xzr
+
+    # The boot CPU's ID is always 0
+    msr TPIDRRO_EL0, xzr
+
     # Check if we are running in EL2 and switch to EL1
     mrs x0, CurrentEL
     cmp x0, #4
@@ -119,6 +125,111 @@ _wfe_loop:
     wfe
     b _wfe_loop
 
+# Entry point for secondary CPUs powered on by the boot CPU. The MMU is off so everything here uses physical addresses
+# x0 - Physical address of this CPU's arch_smp_boot_t
+.global _start_secondary
+.align 2
+_start_secondary:
+    # Mask exceptions and interrupts for now
+    msr DAIFSet, #0xf
+
+    # Save the pointer to the boot parameters
+    mov x19, x0
+
+    # There is no per-CPU data until the MMU is on
+    msr TPIDR_EL1, xzr
+
+    # Check if we are running in EL2 and switch to EL1
+    mrs x0, CurrentEL
+    cmp x0, #4
+    beq _secondary_not_el2
+
+    # Enable AARCH64 mode in EL1; Disable general exceptions trap
+    mov x0, #1
+    mov x1, xzr
+    bfi x1, x0, #31, #1
+    msr HCR_EL2, x1
+    # Switch to EL1
+    mov x0, #0x3c5
+    msr SPSR_EL2, x0
+    adr x2, _secondary_not_el2
+    msr ELR_EL2, x2
+    eret
+
+_secondary_not_el2:
+    # Disable the MMU
+    mrs x0, SCTLR_EL1
+    mov x1, #1
+    bic x0, x0, x1
+    msr SCTLR_EL1, x0
+
+    # Enable floating point & SIMD
+    mrs x0, CPACR_EL1
+    mov x1, #0x3
+    bfi x0, x1, #20, #2
+    msr CPACR_EL1, x0
+
+    # Use the boot stack until we are running on the kernel stack
+    ldr x0, [x19, #0x20]
+    mov sp, x0
+
+    # Create a the first frame record, this should be 0
+    mov fp, xzr
+    mov lr, xzr
+    stp fp, lr, [sp, #-16]!
+    mov fp, sp
+
+    # Invalidate the icache and TLB. The boot CPU cleaned everything this CPU reads to memory
+    ic iallu
+    dsb sy
+    isb sy
+    tlbi vmalle1
+    dsb sy
+    isb sy
+
+    # Enable the MMU with the same translation tables as the boot CPU. TTBR0 identity maps the kernel image so we keep
+    # executing here after the MMU is on
+    ldp x0, x1, [x19, #0x0]
+    ldp x2, x3, [x19, #0x10]
+    bl arch_mmu_enable
+
+    # Switch to the kernel stack and jump to the entry point in the kernel's virtual address space
+    ldp x1, x2, [x19, #0x28]
+    ldr x0, [x19, #0x38]
+    mov sp, x1
+    mov fp, xzr
+    mov lr, xzr
+    br x2
+
+# Entry point for secondary CPUs released from a spin-table
+.global _start_secondary_spin_table
+.align 2
+_start_secondary_spin_table:
+    # The spin-table doesn't pass a context, find this CPU's ID by looking up the affinity fields of its MPIDR in
+    # arch_smp_cpu_mpidr and use that to index its boot parameters instead. The table has MAX_NUM_CPUS (8) entries and
+    # each arch_smp_boot_t is 64 bytes. Wait for the next event and look again if this CPU isn't in the table yet
+    mrs x2, MPIDR_EL1
+    mov x3, #0xffffff
+    movk x3, #0xff, lsl #32
+    and x2, x2, x3
+    adrp x3, arch_smp_cpu_mpidr
+    add x3, x3, :lo12:arch_smp_cpu_mpidr
+    mov x1, xzr
+_spin_table_lookup:
+    ldr x4, [x3, x1, lsl #3]
+    cmp x4, x2
+    beq _spin_table_found
+    add x1, x1, #1
+    cmp x1, #8
+    bne _spin_table_lookup
+    wfe
+    b _start_secondary_spin_table
+_spin_table_found:
+    adrp x0, arch_smp_boot
+    add x0, x0, :lo12:arch_smp_boot
+    add x0, x0, x1, lsl #6
+    b _start_secondary
+
 # x0 - destination
 # x1 - fdt_header pointer
 .align 2
@@ -8,6 +8,7 @@
 #define _ARCH_CACHE_H_
 
 #include <sys/types.h>
+#include <kernel/arch/arch_cpu.h>
 
 // Invalidates the icache completely to the polong of unification
 #define arch_icache_invalidate_all()\
@@ -20,4 +21,16 @@
 // Flushes every level of dcache completely by set/way
 void arch_dcache_flush_all(void);
 
+// Cleans and invalidates the dcache lines covering the given virtual address range to the point of coherency. Used to
+// make memory visible to observers that don't snoop the caches, like a CPU running with its MMU off
+#define arch_dcache_flush_range(addr, size)\
+({\
+    uintptr_t __end = (uintptr_t)(addr) + (size);\
+    for (uintptr_t __va = (uintptr_t)(addr) & ~((uintptr_t)CACHE_LINE_SIZE - 1); __va < __end;\
+        __va += CACHE_LINE_SIZE) {\
+        asm volatile ("dc civac, %0\n" :: "r" (__va) : "memory");\
+    }\
+    asm volatile ("dsb sy\n" ::: "memory");\
+})
+
 #endif // _ARCH_CACHE_H_
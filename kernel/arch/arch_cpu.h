@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _ARCH_CPU_H_
+#define _ARCH_CPU_H_
+
+#include <sys/types.h>
+
+// Maximum # of CPUs supported by the kernel
+#define MAX_NUM_CPUS    (8)
+
+// Size of a cache line in bytes. Per-CPU data is aligned to this to prevent false sharing
+#define CACHE_LINE_SIZE (64)
+
+// Affinity fields (Aff3-Aff0) of MPIDR_EL1. These are what the devicetree and PSCI use to identify a CPU
+#define ARCH_CPU_MPIDR_AFFINITY_MASK (0xff00ffffffUL)
+
+// Returns the affinity fields of the MPIDR_EL1 of the CPU this is running on
+#define arch_cpu_get_mpidr()\
+({\
+    unsigned long result;\
+    asm volatile ("mrs %0, MPIDR_EL1\n"\
+                  : "=r" (result) :);\
+    result & ARCH_CPU_MPIDR_AFFINITY_MASK;\
+})
+
+// Returns the ID of the CPU this is running on. IDs are dense: the boot CPU is 0 and the other CPUs are numbered in the
+// order they are started. The ID is kept in TPIDRRO_EL0 which the kernel doesn't otherwise use
+#define arch_cpu_get_id()\
+({\
+    unsigned long result;\
+    asm volatile ("mrs %0, TPIDRRO_EL0\n"\
+                  : "=r" (result) :);\
+    result;\
+})
+
+// Sets the ID of the CPU this is running on. Must be done before anything calls arch_cpu_get_id on the CPU
+#define arch_cpu_set_id(id) asm volatile ("msr TPIDRRO_EL0, %0\n" :: "r" ((unsigned long)(id)) : "memory")
+
+// Sets the pointer to this CPU's local data. It is kept in TPIDR_EL1 which is zeroed at boot until it is set
+#define arch_cpu_set_local(ptr) asm volatile ("msr TPIDR_EL1, %0\n" :: "r" (ptr) : "memory")
+
+// Returns the pointer to this CPU's local data
+#define arch_cpu_get_local()\
+({\
+    unsigned long result;\
+    asm volatile ("mrs %0, TPIDR_EL1\n"\
+                  : "=r" (result) :);\
+    (void*)result;\
+})
+
+// Loads the pointer stored at the start of this CPU's local data or returns 0 if the local data isn't set yet. The
+// thread could be moved to another CPU between reading TPIDR_EL1 and the load so interrupts are masked around both and
+// then restored to what they were
+#define arch_cpu_load_local_ptr()\
+({\
+    unsigned long result, local, daif;\
+    asm volatile ("mrs %2, DAIF\n"\
+                  "msr DAIFset, #0x3\n"\
+                  "mrs %1, TPIDR_EL1\n"\
+                  "mov %0, xzr\n"\
+                  "cbz %1, 1f\n"\
+                  "ldr %0, [%1]\n"\
+                  "1: msr DAIF, %2\n"\
+                  : "=&r" (result), "=&r" (local), "=&r" (daif) : : "memory");\
+    (void*)result;\
+})
+
+#endif // _ARCH_CPU_H_
@@ -7,6 +7,9 @@
 #include <kernel/panic.h>
 #include <kernel/kstdio.h>
 #include <kernel/irq.h>
+#include <kernel/vm/vm_fault.h>
+#include <kernel/proc/proc_task.h>
+#include <kernel/proc/proc_thread.h>
 #include <kernel/arch/arch_exceptions.h>
 
 #define STRINGIFY(s) #s
@@ -14,6 +17,11 @@
 #define EXC_CLASS_STR(exc_class) STRINGIFY(exc_class)
 #define GET_EXC_CLASS(esr) (((esr) >> 26) & 0x3f)
 #define GET_EXC_ISS(esr) ((esr) & 0x1ffffff)
+#define GET_EXC_FSC(esr) ((esr) & 0x3f)
+#define IS_EXC_WNR(esr) (((esr) >> 6) & 0x1)
+
+#define IS_FSC_TRANSLATION_FAULT(fsc) ((fsc) >= 0x04 && (fsc) <= 0x07)
+#define IS_FSC_PERMISSION_FAULT(fsc) ((fsc) >= 0x0d && (fsc) <= 0x0f)
 
 typedef enum {
     EXC_CLASS_UNKNOWN_REASON               = 0x0,
@@ -136,6 +144,34 @@ bool _arch_exception_class_decode_error(arch_context_t *exc_context) {
     return fail;
 }
 
+bool _arch_exception_handle_fault(arch_context_t *exc_context) {
+    unsigned int exc_class = GET_EXC_CLASS(exc_context->esr);
+    unsigned int fsc = GET_EXC_FSC(exc_context->esr);
+    vm_prot_t fault_type;
+
+    // Only translation and permission faults can be resolved by the VM system
+    if (!IS_FSC_TRANSLATION_FAULT(fsc) && !IS_FSC_PERMISSION_FAULT(fsc)) return false;
+
+    switch (exc_class) {
+        case EXC_CLASS_DATA_ABORT_LOWER_EL:
+        case EXC_CLASS_DATA_ABORT_CURRENT_EL:
+            fault_type = IS_EXC_WNR(exc_context->esr) ? VM_PROT_WRITE : VM_PROT_READ;
+            break;
+        case EXC_CLASS_INSTRUCTION_ABORT_LOWER_EL:
+        case EXC_CLASS_INSTRUCTION_ABORT_CURRENT_EL:
+            fault_type = VM_PROT_EXECUTE;
+            break;
+        default:
+            return false;
+    }
+
+    // Faults on kernel addresses are handled in the kernel's map, everything else in the current task's map
+    vaddr_t vaddr = exc_context->far;
+    vm_map_t *vmap = (vaddr >= kernel_virtual_start) ? vm_map_kernel() : proc_task_current()->vm_map;
+
+    return vm_fault(vmap, vaddr, fault_type) == KRESULT_OK;
+}
+
 void arch_exceptions_dump_state(arch_context_t *exc_context) {
     // Dump the general purpose registers
     for (unsigned int i0 = 0, i1 = 1, i2 = 2, i3 = 3; i0 < 32; i0 += 4, i1 += 4, i2 += 4, i3 += 4) {
@@ -162,6 +198,7 @@ void arch_exception_handler(arch_exception_type_t exc_type, arch_context_t *exc_
         case EXCEPTION_SYNC_SP_ELX:
         case EXCEPTION_SYNC_LL_AARCH64:
         {
+            if (_arch_exception_handle_fault(exc_context)) return;
             kprintf("Synchronous Exception!\n");
             if (!_arch_exception_class_decode_error(exc_context)) return;
             break;
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+#include <kernel/arch/arch_psci.h>
+
+// PSCI 0.2+ function IDs (SMC64 calling convention)
+#define PSCI_0_2_FN64_CPU_ON (0xc4000003)
+
+typedef long (*arch_psci_call_t)(unsigned long fn, unsigned long arg1, unsigned long arg2, unsigned long arg3);
+
+extern long _arch_psci_hvc(unsigned long fn, unsigned long arg1, unsigned long arg2, unsigned long arg3);
+extern long _arch_psci_smc(unsigned long fn, unsigned long arg1, unsigned long arg2, unsigned long arg3);
+
+typedef struct {
+    arch_psci_call_t call;      // Conduit used to call into the firmware
+    unsigned long cpu_on;       // CPU_ON function ID
+} arch_psci_t;
+
+arch_psci_t arch_psci;
+
+bool _arch_psci_is_compatible(fdt_header_t *fdth, unsigned int node, const char *compatible) {
+    unsigned int prop = fdt_get_prop(fdth, node, "compatible");
+    if (prop == 0) return false;
+
+    fdt_prop_t *p_prop = fdt_get_prop_from_offset(fdth, prop);
+    unsigned int offset = 0;
+
+    do {
+        const char *str = fdt_next_string_from_prop(p_prop, &offset);
+        if (str != NULL && strcmp(compatible, str) == 0) return true;
+    } while (offset != 0);
+
+    return false;
+}
+
+kresult_t arch_psci_init(fdt_header_t *fdth) {
+    arch_psci.call = NULL;
+    arch_psci.cpu_on = 0;
+
+    unsigned int node = fdt_get_node(fdth, "/psci");
+    if (node == 0) return KRESULT_NOT_FOUND;
+
+    unsigned int prop = fdt_get_prop(fdth, node, "method");
+    if (prop == 0) return KRESULT_NOT_FOUND;
+
+    unsigned int offset = 0;
+    const char *method = fdt_next_string_from_prop(fdt_get_prop_from_offset(fdth, prop), &offset);
+    if (method == NULL) return KRESULT_NOT_FOUND;
+
+    arch_psci_call_t call;
+    if (strcmp("hvc", method) == 0) {
+        call = _arch_psci_hvc;
+    } else if (strcmp("smc", method) == 0) {
+        call = _arch_psci_smc;
+    } else {
+        return KRESULT_OPERATION_NOT_SUPPORTED;
+    }
+
+    // PSCI 0.2 and later have standard function IDs. PSCI 0.1 firmware gives the function IDs in the devicetree
+    unsigned long cpu_on;
+    if (_arch_psci_is_compatible(fdth, node, "arm,psci-1.0") || _arch_psci_is_compatible(fdth, node, "arm,psci-0.2")) {
+        cpu_on = PSCI_0_2_FN64_CPU_ON;
+    } else if (_arch_psci_is_compatible(fdth, node, "arm,psci")) {
+        prop = fdt_get_prop(fdth, node, "cpu_on");
+        if (prop == 0) return KRESULT_OPERATION_NOT_SUPPORTED;
+
+        offset = 0;
+        cpu_on = fdt_next_data_from_prop(fdt_get_prop_from_offset(fdth, prop), &offset);
+    } else {
+        return KRESULT_OPERATION_NOT_SUPPORTED;
+    }
+
+    arch_psci.call = call;
+    arch_psci.cpu_on = cpu_on;
+
+    return KRESULT_OK;
+}
+
+bool arch_psci_is_present(void) {
+    return arch_psci.call != NULL;
+}
+
+long arch_psci_cpu_on(unsigned long mpidr, paddr_t entry, unsigned long context) {
+    if (!arch_psci_is_present()) return ARCH_PSCI_NOT_SUPPORTED;
+
+    return arch_psci.call(arch_psci.cpu_on, mpidr, entry, context);
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _ARCH_PSCI_H_
+#define _ARCH_PSCI_H_
+
+#include <sys/types.h>
+#include <kernel/kresult.h>
+#include <kernel/fdt.h>
+#include <kernel/vm/vm_types.h>
+
+/*
+ * arch_psci - Power State Coordination Interface
+ * PSCI is the firmware interface used to power CPUs on and off. Firmware implements it either in the hypervisor or
+ * the secure monitor, the /psci node in the devicetree says which conduit (hvc or smc) to call it with.
+ */
+
+// Return values of PSCI functions
+#define ARCH_PSCI_SUCCESS            (0)
+#define ARCH_PSCI_NOT_SUPPORTED      (-1)
+#define ARCH_PSCI_INVALID_PARAMETERS (-2)
+#define ARCH_PSCI_DENIED             (-3)
+#define ARCH_PSCI_ALREADY_ON         (-4)
+#define ARCH_PSCI_ON_PENDING         (-5)
+#define ARCH_PSCI_INTERNAL_FAILURE   (-6)
+#define ARCH_PSCI_NOT_PRESENT        (-7)
+#define ARCH_PSCI_DISABLED           (-8)
+#define ARCH_PSCI_INVALID_ADDRESS    (-9)
+
+// Finds the conduit and function IDs to use from the /psci node in the devicetree
+kresult_t arch_psci_init(fdt_header_t *fdth);
+
+// Checks if PSCI was found by arch_psci_init
+bool arch_psci_is_present(void);
+
+// Powers on the CPU with the given MPIDR. The CPU starts executing at the physical address entry with the MMU off and
+// context in x0. Returns one of the PSCI return values
+long arch_psci_cpu_on(unsigned long mpidr, paddr_t entry, unsigned long context);
+
+#endif // _ARCH_PSCI_H_
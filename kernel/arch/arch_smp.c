@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+#include <kernel/clocksource.h>
+#include <kernel/kstdio.h>
+#include <kernel/kassert.h>
+#include <kernel/irq.h>
+#include <kernel/percpu.h>
+#include <kernel/arch/arch_atomic.h>
+#include <kernel/arch/arch_cache.h>
+#include <kernel/arch/arch_exceptions.h>
+#include <kernel/arch/arch_mmu.h>
+#include <kernel/arch/arch_psci.h>
+#include <kernel/arch/pmap.h>
+#include <kernel/arch/arch_smp.h>
+#include <kernel/proc/proc_scheduler.h>
+#include <kernel/proc/proc_task.h>
+#include <kernel/proc/proc_thread.h>
+
+// How long to wait for a secondary CPU to come online before moving on to the next one
+#define ARCH_SMP_BOOT_TIMEOUT_MS (100)
+
+// Marks an unused entry in arch_smp_cpu_mpidr. No MPIDR has any bits set outside of its affinity fields
+#define ARCH_SMP_MPIDR_NONE      (~0UL)
+
+extern void _start_secondary(void);
+extern void _start_secondary_spin_table(void);
+
+arch_smp_boot_t arch_smp_boot[MAX_NUM_CPUS];
+unsigned long arch_smp_cpu_mpidr[MAX_NUM_CPUS];
+uint8_t arch_smp_boot_stacks[MAX_NUM_CPUS][ARCH_SMP_BOOT_STACK_SIZE] __attribute__((aligned(CACHE_LINE_SIZE)));
+volatile atomic_t arch_smp_cpus_online;
+
+proc_thread_t* _arch_smp_create_idle(void) {
+    proc_thread_t *idle;
+    if (proc_thread_create(proc_task_kernel(), &idle) != KRESULT_OK) return NULL;
+
+    // Idle threads are never resumed, the scheduler runs them when their CPU has nothing else to do
+    proc_thread_set_entry(idle, proc_scheduler_idle);
+
+    return idle;
+}
+
+// C entry point for secondary CPUs, called from _start_secondary on the idle thread's kernel stack
+void _arch_smp_secondary_main(proc_thread_t *idle) {
+    // The boot CPU assigned this CPU its ID before starting it
+    unsigned long mpidr = arch_cpu_get_mpidr(), cpu;
+    for (cpu = 0; cpu < MAX_NUM_CPUS && arch_smp_cpu_mpidr[cpu] != mpidr; cpu++);
+    kassert(cpu < MAX_NUM_CPUS);
+    arch_cpu_set_id(cpu);
+
+    // The identity mapping was only needed to turn on the MMU
+    arch_mmu_clear_ttbr0();
+    arch_tlb_invalidate_all();
+
+    percpu_init();
+    arch_exceptions_init();
+
+    // This CPU has been running on the idle thread's stack since it entered the kernel so make it the current thread
+    spinlock_acquire_irq(&idle->lock);
+    idle->state = PROC_THREAD_STATE_RUNNING;
+    proc_thread_set_current(idle);
+    spinlock_release_irq(&idle->lock);
+
+    proc_scheduler_set_idle(idle);
+
+    // Setup this CPU's interface to the interrupt controller and its timer. This enables interrupts. The tick stays
+    // stopped until the scheduler queues a thread on this CPU
+    irq_init_cpu();
+    arch_atomic_inc(&arch_smp_cpus_online);
+
+    proc_scheduler_idle();
+}
+
+bool _arch_smp_prop_is(fdt_header_t *fdth, unsigned int node, const char *name, const char *value) {
+    unsigned int prop = fdt_get_prop(fdth, node, name);
+    if (prop == 0) return false;
+
+    unsigned int offset = 0;
+    const char *str = fdt_next_string_from_prop(fdt_get_prop_from_offset(fdth, prop), &offset);
+
+    return str != NULL && strcmp(value, str) == 0;
+}
+
+// Writes the physical entry point to a spin-table release address and wakes up the CPUs waiting on it
+void _arch_smp_spin_table_release(paddr_t release_addr, paddr_t entry) {
+    volatile uint64_t *release;
+
+    // The release address is normally in memory reserved by the firmware which isn't covered by the linear map. The
+    // CPU polls it with its caches off so write it through an uncached mapping
+    if (IS_LINEAR_MAPPED(release_addr, sizeof(uint64_t))) {
+        release = (volatile uint64_t*)PA_TO_KVA(release_addr);
+        *release = entry;
+        arch_dcache_flush_range(release, sizeof(uint64_t));
+    } else {
+        vaddr_t va = max_kernel_virtual_end + ROUND_PAGE_DOWN(release_addr);
+        pmap_kenter_pa(va, ROUND_PAGE_DOWN(release_addr), VM_PROT_DEFAULT,
+            PMAP_FLAGS_READ | PMAP_FLAGS_WRITE | PMAP_FLAGS_NOCACHE);
+        release = (volatile uint64_t*)(va + (release_addr - ROUND_PAGE_DOWN(release_addr)));
+        *release = entry;
+    }
+
+    asm volatile ("dsb sy\n"
+                  "sev\n");
+}
+
+// Starts the CPU with the given MPIDR as the CPU with the given ID. Returns true if the CPU was started, even if it
+// hasn't come online yet, in which case the ID is taken
+bool _arch_smp_boot_cpu(fdt_header_t *fdth, unsigned int node, unsigned long cpu, unsigned long mpidr) {
+    bool spin_table = _arch_smp_prop_is(fdth, node, "enable-method", "spin-table");
+    paddr_t release_addr = 0;
+
+    if (spin_table) {
+        unsigned int prop = fdt_get_prop(fdth, node, "cpu-release-addr");
+        if (prop == 0) {
+            kprintf("arch_smp: cpu %lu has no cpu-release-addr\n", cpu);
+            return false;
+        }
+
+        unsigned int offset = 0;
+        release_addr = fdt_next_data_cells_from_prop(fdt_get_prop_from_offset(fdth, prop), &offset, 2);
+    } else if (!_arch_smp_prop_is(fdth, node, "enable-method", "psci")) {
+        // No other enable methods are supported
+        return false;
+    }
+
+    proc_thread_t *idle = _arch_smp_create_idle();
+    if (idle == NULL) return false;
+
+    arch_smp_boot_t *boot = &arch_smp_boot[cpu];
+    pmap_bootstrap_params(&boot->ttbr0, &boot->ttbr1, &boot->mair);
+    boot->page_size = PAGESIZE;
+    boot->boot_stack = KVA_TO_PA((vaddr_t)arch_smp_boot_stacks[cpu] + ARCH_SMP_BOOT_STACK_SIZE);
+    boot->kernel_stack = (vaddr_t)idle->kernel_stack + kernel_stack_size - sizeof(arch_context_t);
+    boot->entry = (vaddr_t)_arch_smp_secondary_main;
+    boot->arg = (unsigned long)idle;
+
+    // The CPU reads its boot parameters and uses its boot stack with the MMU and caches off. Spin-table CPUs look up
+    // their ID by their MPIDR with the caches off as well
+    arch_smp_cpu_mpidr[cpu] = mpidr;
+    arch_dcache_flush_range(&arch_smp_cpu_mpidr[cpu], sizeof(unsigned long));
+    arch_dcache_flush_range(boot, sizeof(arch_smp_boot_t));
+    arch_dcache_flush_range(arch_smp_boot_stacks[cpu], ARCH_SMP_BOOT_STACK_SIZE);
+
+    atomic_t online = arch_smp_cpus_online;
+
+    if (spin_table) {
+        _arch_smp_spin_table_release(release_addr, KVA_TO_PA((vaddr_t)_start_secondary_spin_table));
+    } else {
+        long err = arch_psci_cpu_on(mpidr, KVA_TO_PA((vaddr_t)_start_secondary), KVA_TO_PA((vaddr_t)boot));
+        if (err != ARCH_PSCI_SUCCESS) {
+            kprintf("arch_smp: CPU_ON failed for cpu %lu: %ld\n", cpu, err);
+            proc_thread_unreference(idle);
+            return false;
+        }
+    }
+
+    unsigned long start = clocksource_get_msecs();
+    while (arch_smp_cpus_online == online && (clocksource_get_msecs() - start) < ARCH_SMP_BOOT_TIMEOUT_MS);
+
+    // The idle thread and the CPU's ID are left alone if the CPU timed out, it may still come online later
+    if (arch_smp_cpus_online == online) kprintf("arch_smp: cpu %lu timed out\n", cpu);
+
+    return true;
+}
+
+kresult_t arch_smp_init(fdt_header_t *fdth) {
+    // The boot CPU needs an idle thread too
+    proc_thread_t *idle = _arch_smp_create_idle();
+    kassert(idle != NULL);
+    proc_scheduler_set_idle(idle);
+
+    arch_smp_cpus_online = 1;
+
+    // CPUs may still be started through spin-tables without PSCI
+    arch_psci_init(fdth);
+
+    unsigned int cpus = fdt_get_node(fdth, "/cpus");
+    if (cpus == 0) return KRESULT_NOT_FOUND;
+
+    // The reg property of each CPU node is its MPIDR
+    unsigned int prop = fdt_get_prop(fdth, cpus, "#address-cells");
+    unsigned int offset = 0;
+    unsigned int address_cells = 1;
+    if (prop != 0) address_cells = fdt_next_data_from_prop(fdt_get_prop_from_offset(fdth, prop), &offset);
+
+    // CPU IDs are handed out in the order the CPUs are started. The boot CPU is always 0
+    for (unsigned long cpu = 0; cpu < MAX_NUM_CPUS; cpu++) arch_smp_cpu_mpidr[cpu] = ARCH_SMP_MPIDR_NONE;
+    arch_smp_cpu_mpidr[0] = arch_cpu_get_mpidr();
+    arch_dcache_flush_range(arch_smp_cpu_mpidr, sizeof(arch_smp_cpu_mpidr));
+    unsigned long next_cpu = 1;
+
+    // fdt_next_node carries on past the last subnode of /cpus so stop at the first node that isn't named cpu*
+    for (unsigned int node = fdt_next_subnode(fdth, cpus); node != 0; node = fdt_next_node(fdth, node)) {
+        if (strncmp("cpu", fdt_get_node_from_offset(fdth, node)->name, 3) != 0) break;
+        if (!_arch_smp_prop_is(fdth, node, "device_type", "cpu")) continue;
+
+        prop = fdt_get_prop(fdth, node, "reg");
+        if (prop == 0) continue;
+
+        offset = 0;
+        unsigned long mpidr = fdt_next_data_cells_from_prop(fdt_get_prop_from_offset(fdth, prop), &offset,
+            address_cells) & ARCH_CPU_MPIDR_AFFINITY_MASK;
+
+        if (mpidr == arch_smp_cpu_mpidr[0]) continue;
+
+        if (next_cpu >= MAX_NUM_CPUS) {
+            kprintf("arch_smp: cpu with MPIDR %#lx is beyond MAX_NUM_CPUS\n", mpidr);
+            continue;
+        }
+
+        if (_arch_smp_boot_cpu(fdth, node, next_cpu, mpidr)) next_cpu++;
+    }
+
+    return KRESULT_OK;
+}
+
+unsigned int arch_smp_num_cpus_online(void) {
+    return arch_smp_cpus_online;
+}
+
+unsigned long arch_smp_get_mpidr(unsigned int cpu) {
+    kassert(cpu < MAX_NUM_CPUS && arch_smp_cpu_mpidr[cpu] != ARCH_SMP_MPIDR_NONE);
+    return arch_smp_cpu_mpidr[cpu];
+}
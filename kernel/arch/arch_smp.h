@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _ARCH_SMP_H_
+#define _ARCH_SMP_H_
+
+#include <sys/types.h>
+#include <kernel/kresult.h>
+#include <kernel/fdt.h>
+#include <kernel/arch/arch_cpu.h>
+#include <kernel/vm/vm_types.h>
+
+/*
+ * arch_smp - Secondary CPU bring-up
+ * The boot CPU enumerates the CPUs in the devicetree's /cpus node and starts each of the other CPUs according to its
+ * enable-method: either through PSCI CPU_ON or by writing the entry point to the CPU's spin-table release address and
+ * waking it up with an event. Each CPU starts in _start_secondary with the MMU off and is handed an arch_smp_boot_t
+ * with everything it needs to turn on its MMU and jump into the kernel on the kernel stack of its own idle thread.
+ * CPUs are given dense IDs in the order they are started, starting with 0 for the boot CPU, and each CPU finds its ID
+ * by looking up its MPIDR in arch_smp_cpu_mpidr. Spin-table CPUs don't get a context argument and find their
+ * arch_smp_boot_t by their ID as well. From there each CPU sets up its exception vectors, interrupt controller
+ * interface and timer and starts scheduling threads.
+ */
+
+// Size of the stack a secondary CPU uses before its MMU is enabled
+#define ARCH_SMP_BOOT_STACK_SIZE (256)
+
+// Boot parameters for a secondary CPU. _start_secondary depends on the offsets of these fields and
+// _start_secondary_spin_table depends on the structure being exactly 64 bytes
+typedef struct {
+    paddr_t ttbr0;                                 // 0x00: Identity mapping of the kernel image
+    paddr_t ttbr1;                                 // 0x08: Kernel translation table
+    unsigned long mair;                            // 0x10: Memory attributes
+    unsigned long page_size;                       // 0x18: Translation granule
+    paddr_t boot_stack;                            // 0x20: Physical address of the top of the boot stack
+    vaddr_t kernel_stack;                          // 0x28: Kernel stack to switch to once the MMU is on
+    vaddr_t entry;                                 // 0x30: Kernel entry point
+    unsigned long arg;                             // 0x38: Argument passed to the entry point
+} __attribute__((aligned(64))) arch_smp_boot_t;
+
+// Creates the boot CPU's idle thread and boots all the other CPUs found in the devicetree. Must be called after the
+// scheduler and interrupts have been initialized. The boot CPU keeps running even if no other CPU could be started
+kresult_t arch_smp_init(fdt_header_t *fdth);
+
+// Returns the number of CPUs that are running the kernel
+unsigned int arch_smp_num_cpus_online(void);
+
+// Returns the MPIDR affinity fields of the CPU with the given ID. Interrupt controllers need these to target a CPU
+unsigned long arch_smp_get_mpidr(unsigned int cpu);
+
+#endif // _ARCH_SMP_H_
@@ -15,7 +15,8 @@ extern void _arch_thread_run_stub(struct proc_thread_s *new_thread, struct proc_
 
 void _arch_thread_run(struct proc_thread_s *new_thread, struct proc_thread_s *old_thread) {
     // For threads running for the first time, we need to set the current thread and release the locks
-    proc_thread_current() = new_thread;
+    proc_thread_set_current(new_thread);
+    if (old_thread != new_thread) proc_scheduler_switched(old_thread);
 
     if (old_thread == new_thread) {
         spinlock_release_irq(&new_thread->lock);
@@ -19,22 +19,17 @@ void arch_timer_init(void);
     result;\
 })
 
-// Get the clock period of the counter in seconds
-#define arch_timer_get_period() (1.0 / (double)arch_timer_get_freq())
-
-// Get the number of ticks since the counter was started
+// Get the number of ticks since the counter was started. The isb keeps the read from being done early, out of order
+// with the code before it
 #define arch_timer_get_ticks()\
 ({\
     unsigned long result;\
-    asm ("mrs %0, CNTPCT_EL0\n"\
-         : "=r" (result) :);\
+    asm volatile ("isb sy\n"\
+                  "mrs %0, CNTPCT_EL0\n"\
+                  : "=r" (result) :);\
     result;\
 })
 
-#define arch_timer_get_secs()  ((double)arch_timer_get_ticks() * arch_timer_get_period())
-#define arch_timer_get_msecs() (arch_timer_get_secs() * 1000.0)
-#define arch_timer_get_usecs() (arch_timer_get_msecs() * 1000.0)
-
 // Enable the generic timer to fire an interrupt after the given time has passed in number of counter ticks
 #define arch_timer_start(ticks)\
 ({\
@@ -46,6 +41,18 @@ void arch_timer_init(void);
                   : "x1");\
 })
 
+// Enable the generic timer to fire an interrupt once the counter reaches the given number of ticks. Fires right away if
+// the counter is already past it
+#define arch_timer_start_at(ticks)\
+({\
+    asm volatile ("msr CNTP_CVAL_EL0, %0\n"\
+                  "mov x1, #1\n"\
+                  "msr CNTP_CTL_EL0, x1\n"\
+                  "isb sy\n"\
+                  :: "r" (ticks)\
+                  : "x1");\
+})
+
 #define arch_timer_stop()\
 ({\
     asm volatile ("msr CNTP_CTL_EL0, xzr\n"\
@@ -53,12 +60,4 @@ void arch_timer_init(void);
                   ::);\
 })
 
-#define ARCH_TIMER_SECS_TO_TICKS(t)  ARCH_TIMER_MSECS_TO_TICKS(t*1000)
-#define ARCH_TIMER_MSECS_TO_TICKS(t) ARCH_TIMER_USECS_TO_TICKS(t*1000)
-#define ARCH_TIMER_USECS_TO_TICKS(t) ((unsigned long)((double)(t) * ((double)arch_timer_get_freq() / 1000000.0)))
-
-#define arch_timer_start_secs(t)  (arch_timer_start(ARCH_TIMER_SECS_TO_TICKS(t)))
-#define arch_timer_start_msecs(t) (arch_timer_start(ARCH_TIMER_MSECS_TO_TICKS(t)))
-#define arch_timer_start_usecs(t) (arch_timer_start(ARCH_TIMER_USECS_TO_TICKS(t)))
-
 #endif // _ARCH_TIMER_H_
@@ -226,6 +226,11 @@ typedef uint64_t pte_t;
 // Kernel pmap
 pmap_t kernel_pmap;
 
+// Translation table identity mapping the kernel image and the memory attributes the MMU was enabled with. Secondary
+// CPUs need these to turn on their MMUs
+paddr_t identity_ttb;
+unsigned long kernel_mair;
+
 // Linker symbols
 extern uintptr_t __kernel_virtual_start;
 extern uintptr_t __kernel_physical_start;
@@ -279,6 +284,9 @@ kmem_slab_t page_table_slab;
 #define PMAP_SLAB_NUM             (256)
 kmem_slab_t pmap_slab;
 
+// pmap_remove invalidates the TLB per VA for ranges up to this many pages, otherwise it flushes the ASID once
+#define PMAP_REMOVE_BATCH_PAGES   (32)
+
 list_compare_result_t _pmap_pte_page_search(list_node_t *n1, list_node_t *n2) {
     pte_page_t *p1 = list_entry(n1, pte_page_t, ll_node), *p2 = list_entry(n2, pte_page_t, ll_node);
     return (p1->pmap < p2->pmap) ? LIST_COMPARE_LT : (p1->pmap > p2->pmap) ? LIST_COMPARE_GT : LIST_COMPARE_EQ;
@@ -349,8 +357,9 @@ void _pmap_update_pte(vaddr_t va, unsigned int asid, pte_t *old_pte, pte_t new_p
 }
 
 void _pmap_clear_pte(vaddr_t va, unsigned int asid, pte_t *old_pte) {
+    bool was_valid = IS_PTE_VALID(*old_pte);
     *old_pte = 0;
-    if (IS_PTE_VALID(*old_pte)) {
+    if (was_valid) {
         arch_barrier_dsb();
         arch_tlb_invalidate_va(va, (unsigned long)asid);
     }
@@ -368,10 +377,33 @@ pte_t _pmap_insert_table(pmap_t *pmap, pte_t *parent_table_pte) {
     return *parent_table_pte;
 }
 
-void _pmap_remove_table(pmap_t *pmap, pte_t *parent_table_pte) {
+// Frees a table that is no longer reachable from the pmap. If deferred is not NULL the table is added to it instead,
+// the caller hasn't invalidated the TLB yet and the table walker may still be using it. Deferred tables are chained
+// through their first entry which remains an invalid descriptor since bit 0 of a table's address is always clear
+void _pmap_free_table(pte_t *table, pte_t **deferred) {
+    if (deferred == NULL) {
+        kmem_slab_free(&page_table_slab, (void*)table);
+        return;
+    }
+
+    table[0] = (pte_t)*deferred;
+    *deferred = table;
+}
+
+// Frees the tables deferred by _pmap_free_table. Must only be called after the TLB has been invalidated
+void _pmap_free_deferred_tables(pte_t *deferred) {
+    while (deferred != NULL) {
+        pte_t *next = (pte_t*)deferred[0];
+        deferred[0] = 0;
+        kmem_slab_free(&page_table_slab, (void*)deferred);
+        deferred = next;
+    }
+}
+
+void _pmap_remove_table(pmap_t *pmap, pte_t *parent_table_pte, pte_t **deferred) {
     paddr_t table_pa = PTE_TO_PA(*parent_table_pte);
     *parent_table_pte = 0;
-    kmem_slab_free(&page_table_slab, (void*)TABLE_PA_TO_KVA(table_pa));
+    _pmap_free_table((pte_t*)TABLE_PA_TO_KVA(table_pa), deferred);
 }
 
 bool _pmap_is_table_empty(pte_t *table) {
@@ -429,7 +461,9 @@ pte_t* _pmap_enter(pmap_t *pmap, vaddr_t va, paddr_t pa, bp_uattr_t bpu, bp_latt
     return ptep;
 }
 
-pte_t* _pmap_remove(pmap_t *pmap, vaddr_t va) {
+// Removes the mapping at va. If deferred is NULL the TLB entry is invalidated and any emptied tables are freed.
+// Otherwise the caller is responsible for TLB maintenance and for freeing the emptied tables added to deferred after it
+pte_t* _pmap_remove(pmap_t *pmap, vaddr_t va, pte_t **deferred) {
     unsigned long level = (PAGESIZE == _64KB) ? 1 : 0, width = PAGESHIFT - 3, mask = (1 << width) - 1;
     unsigned long lsb = PAGESHIFT + ((3 - level) * width), index = GET_TABLE_IDX(va, lsb, mask);
     pte_t pte, *ptep[4];
@@ -464,20 +498,24 @@ pte_t* _pmap_remove(pmap_t *pmap, vaddr_t va) {
     // Level 3 - Finally remove the mapping
     pte = table[level][index], ptep[level] = &table[level][index];
     if (!IS_PDE_VALID(pte)) return NULL;
-    _pmap_clear_pte(va, pmap->asid, ptep[level]);
+    if (deferred == NULL) {
+        _pmap_clear_pte(va, pmap->asid, ptep[level]);
+    } else {
+        _pmap_clear_pte_no_tlbi(ptep[level]);
+    }
 
     // Now scan the tables in the table walk hierarchy in reverse order, if the table is empty remove it from the
-    // parent table and the scan the parent table
-    for (unsigned int l = 3; l >= 0; l--) {
-        if (_pmap_is_table_empty(table[l])) {
-            // Just free the base translation table
-            if (l == 0) {
-                kmem_slab_free(&page_table_slab, (void*)TABLE_PA_TO_KVA(pmap->ttb));
-                pmap->ttb = 0;
-            } else {
-                _pmap_remove_table(pmap, ptep[l-1]);
-            }
+    // parent table and the scan the parent table. Stop at the first table that still has valid entries
+    unsigned long top_level = (PAGESIZE == _64KB) ? 1 : 0;
+    for (unsigned long l = level; _pmap_is_table_empty(table[l]); l--) {
+        // Just free the base translation table
+        if (l == top_level) {
+            _pmap_free_table((pte_t*)TABLE_PA_TO_KVA(pmap->ttb), deferred);
+            pmap->ttb = 0;
+            break;
         }
+
+        _pmap_remove_table(pmap, ptep[l-1], deferred);
     }
 
     return ptep[level];
@@ -676,7 +714,7 @@ void pmap_bootstrap(void) {
     identity_tables += PAGESIZE;
     identity_pmap.asid = 0;
 
-    // These mappings will be just thrown out after
+    // These mappings are kept around for secondary CPUs to use when they enable their MMUs
     for (size_t offset = 0; offset < kernel_size; offset += PAGESIZE) {
         paddr_t pa = kernel_physical_start + offset;
 
@@ -726,10 +764,16 @@ void pmap_bootstrap(void) {
         table[index] = MAKE_PDE(pa, bp_uattr_page, bp_lattr_page);
     }
 
+    // Reserve the identity mapping tables along with the rest of the kernel. They start right after the last kernel
+    // table used which may be well before the end of the space reserved for the kernel tables
+    if (identity_tables > kernel_physical_end) kernel_physical_end = identity_tables;
+    identity_ttb = identity_pmap.ttb;
+
     // Finally enable the MMU!
     ma_index_t ma_index = {.attrs = {MA_DEVICE_NGNRNE, MA_DEVICE_NGNRE, MA_NORMAL_NC, MA_NORMAL_INC, MA_NORMAL_WBWARA,
         MA_NORMAL_WTWARA, MA_NORMAL_WTWNRA, MA_NORMAL_WTWNRN}};
-    arch_mmu_enable(identity_pmap.ttb, kernel_pmap.ttb, MAIR(ma_index), PAGESIZE);
+    kernel_mair = MAIR(ma_index);
+    arch_mmu_enable(identity_pmap.ttb, kernel_pmap.ttb, kernel_mair, PAGESIZE);
     arch_mmu_kernel_longjmp(kernel_physical_start, kernel_virtual_start);
 
     arch_mmu_clear_ttbr0();
@@ -769,6 +813,13 @@ void pmap_virtual_space(vaddr_t *vstartp, vaddr_t *vendp) {
     *vendp = kernel_virtual_end;
 }
 
+void pmap_bootstrap_params(paddr_t *ttbr0, paddr_t *ttbr1, unsigned long *mair) {
+    kassert(ttbr0 != NULL && ttbr1 != NULL && mair != NULL);
+    *ttbr0 = identity_ttb;
+    *ttbr1 = kernel_pmap.ttb;
+    *mair = kernel_mair;
+}
+
 vaddr_t pmap_steal_memory(size_t vsize, vaddr_t *vstartp, vaddr_t *vendp) {
     static paddr_t next_unused_addr = 0;
     if (next_unused_addr == 0) next_unused_addr = kernel_physical_end;
@@ -894,13 +945,31 @@ void pmap_remove(pmap_t *pmap, vaddr_t sva, vaddr_t eva) {
     bp_uattr_t bpu = {0};
     bp_lattr_t bpl = {0};
 
+    // For large ranges it is cheaper to clear all the PTEs and then invalidate the whole ASID (or the entire TLB for
+    // the kernel's global mappings) once rather than invalidating one VA at a time
+    // The tables emptied along the way can only be freed once the TLB (including any cached walks) is invalidated
+    bool batch = ((eva - sva) >> PAGESHIFT) > PMAP_REMOVE_BATCH_PAGES;
+    pte_t *deferred = NULL;
+
     lock_acquire_exclusive(&pmap->lock);
     for (vaddr_t va = sva; va < eva; va += PAGESIZE) {
         if (_pmap_lookup(pmap, va, &pa, &bpu, &bpl)) {
-            pte_t *ptep = _pmap_remove(pmap, va);
+            pte_t *ptep = _pmap_remove(pmap, va, batch ? &deferred : NULL);
             _pmap_pte_page_remove(pmap, pa);
         }
     }
+
+    if (batch) {
+        arch_barrier_dsb();
+        if (pmap == pmap_kernel()) {
+            arch_tlb_invalidate_all();
+        } else {
+            arch_tlb_invalidate_asid((unsigned long)pmap->asid);
+        }
+
+        // The invalidates above complete with a dsb so the walker can no longer reach the emptied tables
+        _pmap_free_deferred_tables(deferred);
+    }
     lock_release_exclusive(&pmap->lock);
 }
 
@@ -1007,7 +1076,7 @@ void pmap_kenter_pa(vaddr_t va, paddr_t pa, vm_prot_t prot, pmap_flags_t flags)
 void pmap_kremove(vaddr_t va, size_t size) {
     lock_acquire_exclusive(&kernel_pmap.lock);
     for (size_t s = 0; s < size; s += PAGESIZE) {
-        _pmap_remove(pmap_kernel(), va + s);
+        _pmap_remove(pmap_kernel(), va + s, NULL);
     }
     lock_release_exclusive(&kernel_pmap.lock);
 }
@@ -1086,6 +1155,23 @@ void pmap_page_protect(paddr_t pa, vm_prot_t prot) {
 
     lock_acquire(&pte_page_list.lock[GET_PTE_PAGE_LIST_IDX(pa)]);
 
+    // Remove every mapping of the page. pmap_remove frees the pte_page_t entry so the list lock needs to be dropped
+    if (prot == VM_PROT_NONE) {
+        while (!list_is_empty(&pte_page_list.list[GET_PTE_PAGE_LIST_IDX(pa)])) {
+            pte_page_t *entry = list_entry(list_first(&pte_page_list.list[GET_PTE_PAGE_LIST_IDX(pa)]), pte_page_t,
+                ll_node);
+            pmap_t *pmap = entry->pmap;
+            vaddr_t va = entry->va;
+
+            lock_release(&pte_page_list.lock[GET_PTE_PAGE_LIST_IDX(pa)]);
+            pmap_remove(pmap, va, va + PAGESIZE);
+            lock_acquire(&pte_page_list.lock[GET_PTE_PAGE_LIST_IDX(pa)]);
+        }
+
+        lock_release(&pte_page_list.lock[GET_PTE_PAGE_LIST_IDX(pa)]);
+        return;
+    }
+
     pte_page_t *entry = NULL;
     list_for_each_entry(&pte_page_list.list[GET_PTE_PAGE_LIST_IDX(pa)], entry, ll_node) {
         vaddr_t eva = entry->va + PAGESIZE;
@@ -1096,17 +1182,13 @@ void pmap_page_protect(paddr_t pa, vm_prot_t prot) {
 }
 
 bool pmap_clear_modify(vm_page_t *page) {
-    lock_acquire_exclusive(&page->object->lock);
     bool dirty = page->status.is_dirty;
     page->status.is_dirty = 0;
-    lock_release_exclusive(&page->object->lock);
     return dirty;
 }
 
 bool pmap_clear_reference(vm_page_t *page) {
-    lock_acquire_exclusive(&page->object->lock);
     bool referenced = page->status.is_referenced;
     page->status.is_referenced = 0;
-    lock_release_exclusive(&page->object->lock);
     return referenced;
 }
@@ -49,6 +49,10 @@ void pmap_bootstrap(void);
 // Initializes the pmap system
 void pmap_init(void);
 
+// Returns the translation table bases and memory attributes the boot CPU enabled its MMU with. ttbr0 points to the
+// identity mapping of the kernel image which lets other CPUs turn on their MMUs
+void pmap_bootstrap_params(paddr_t *ttbr0, paddr_t *ttbr1, unsigned long *mair);
+
 // Used to determine the kernel's virtual address space start and end that will be managed by the vmm
 void pmap_virtual_space(vaddr_t *vstartp, vaddr_t *vendp);
 
@@ -127,9 +131,11 @@ void pmap_copy_page(paddr_t src, paddr_t dst);
 void pmap_page_protect(paddr_t pa, vm_prot_t prot);
 
 // Clear the modified attribute on the given page. Returns old value of the modified attribute
+// The page's object lock must be held exclusively
 bool pmap_clear_modify(vm_page_t *page);
 
 // Clear the referenced attribute on the given page. Returns old value of the referenced attribute
+// The page's object lock must be held exclusively
 bool pmap_clear_reference(vm_page_t *page);
 
 // Check whether modified attribute is set
@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <kernel/kassert.h>
+#include <kernel/clocksource.h>
+
+// Largest shift used for the conversions. More bits give more precision as long as to << shift fits in 64 bits
+#define CLOCKSOURCE_MAX_SHIFT (32)
+
+clocksource_t clocksource;
+
+// Computes mult and shift such that x * to / from == (x * mult) >> shift, rounding mult to the nearest integer
+void _clocksource_calc_mult_shift(unsigned long from, unsigned long to, unsigned long *mult, unsigned int *shift) {
+    unsigned int s = CLOCKSOURCE_MAX_SHIFT;
+    while (s > 0 && (to >> (64 - s)) != 0) s--;
+
+    *mult = ((to << s) + (from / 2)) / from;
+    *shift = s;
+}
+
+void clocksource_init(void) {
+    clocksource.freq = arch_timer_get_freq();
+    kassert(clocksource.freq != 0);
+
+    _clocksource_calc_mult_shift(clocksource.freq, NSECS_PER_SEC, &clocksource.mult, &clocksource.shift);
+    _clocksource_calc_mult_shift(NSECS_PER_SEC, clocksource.freq, &clocksource.inv_mult, &clocksource.inv_shift);
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _CLOCKSOURCE_H_
+#define _CLOCKSOURCE_H_
+
+#include <sys/types.h>
+#include <kernel/arch/arch_timer.h>
+
+/*
+ * clocksource - System clock
+ * The system time is read from the generic timer's counter. The counter runs at a fixed frequency and is shared by all
+ * CPUs, so the clock is monotonic and the same on every CPU. Counter cycles are converted to nanoseconds and back with
+ * a fixed point multiply and shift precomputed from the counter frequency, so reading the time or converting a
+ * duration to cycles never uses floating point. The multiply is done in 128 bits so any cycle count since the counter
+ * started converts without overflowing.
+ */
+
+#define NSECS_PER_SEC  (1000000000UL)
+#define NSECS_PER_MSEC (1000000UL)
+#define NSECS_PER_USEC (1000UL)
+
+typedef struct {
+    unsigned long freq;        // Counter frequency in Hz
+    unsigned long mult;        // ns = (cycles * mult) >> shift
+    unsigned int shift;
+    unsigned long inv_mult;    // cycles = (ns * inv_mult) >> inv_shift
+    unsigned int inv_shift;
+} clocksource_t;
+
+extern clocksource_t clocksource;
+
+// Computes the conversion factors from the counter frequency. Time reads as 0 until this is called
+void clocksource_init(void);
+
+#define clocksource_get_cycles()       (arch_timer_get_ticks())
+
+#define clocksource_cycles_to_ns(c)\
+    ((unsigned long)(((unsigned __int128)(c) * clocksource.mult) >> clocksource.shift))
+#define clocksource_ns_to_cycles(ns)\
+    ((unsigned long)(((unsigned __int128)(ns) * clocksource.inv_mult) >> clocksource.inv_shift))
+#define clocksource_usecs_to_cycles(t) (clocksource_ns_to_cycles((unsigned long)(t) * NSECS_PER_USEC))
+
+// Monotonic time since the counter started
+#define clocksource_get_ns()           (clocksource_cycles_to_ns(clocksource_get_cycles()))
+#define clocksource_get_usecs()        (clocksource_get_ns() / NSECS_PER_USEC)
+#define clocksource_get_msecs()        (clocksource_get_ns() / NSECS_PER_MSEC)
+#define clocksource_get_secs()         (clocksource_get_ns() / NSECS_PER_SEC)
+
+#endif // _CLOCKSOURCE_H_
@@ -4,12 +4,64 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <string.h>
 #include <kernel/fdt.h>
 #include <kernel/devicetree.h>
+#include <kernel/arch/arch_asm.h>
 
 extern fdt_header_t *fdt_header;
 
-#include <kernel/kstdio.h>
+// Memory is trimmed in units of the largest translation granule since the page size isn't known yet. The remaining
+// size is kept a multiple of 2MB so the linear map still covers all of it
+#define DEVICETREE_MEM_BASE_ALIGN  (0x10000UL)
+#define DEVICETREE_MEM_SIZE_ALIGN  (0x200000UL)
+#define DEVICETREE_ALIGN_DOWN(x, a) ((x) & ~((a) - 1))
+#define DEVICETREE_ALIGN_UP(x, a)   DEVICETREE_ALIGN_DOWN((x) + (a) - 1, a)
+
+// Returns the end of the region at the base of memory that firmware still needs: /memreserve/ entries starting at the
+// base and spin-table release addresses in the granule that the reserved region ends in. The kernel is relocated to
+// the base of memory so it must not overwrite these
+unsigned long _devicetree_reserved_end(unsigned long base) {
+    unsigned long end = base;
+    unsigned int cpus = fdt_get_node(fdt_header, "/cpus");
+    bool changed = true;
+
+    // Reserved regions may abut each other so keep going until the end stops moving
+    while (changed) {
+        changed = false;
+
+        for (fdt_reserve_entry_t *rsv = fdt_get_rsv_from_offset(fdt_header, arch_rev32(fdt_header->off_mem_rsvmap));
+            rsv->address != 0 || rsv->size != 0; rsv++) {
+            unsigned long rsv_base = arch_rev64(rsv->address), rsv_end = rsv_base + arch_rev64(rsv->size);
+            if (rsv_base <= end && rsv_end > end) {
+                end = rsv_end;
+                changed = true;
+            }
+        }
+
+        // Not every firmware reserves its spin-table so treat the release addresses as reserved too
+        for (unsigned int node = (cpus != 0) ? fdt_next_subnode(fdt_header, cpus) : 0; node != 0;
+            node = fdt_next_node(fdt_header, node)) {
+            if (strncmp("cpu", fdt_get_node_from_offset(fdt_header, node)->name, 3) != 0) break;
+
+            unsigned int prop = fdt_get_prop(fdt_header, node, "cpu-release-addr");
+            if (prop == 0) continue;
+
+            unsigned int offset = 0;
+            unsigned long release_addr = fdt_next_data_cells_from_prop(fdt_get_prop_from_offset(fdt_header, prop),
+                &offset, 2);
+            unsigned long release_end = release_addr + sizeof(uint64_t);
+            unsigned long granule_end = DEVICETREE_ALIGN_UP(end + 1, DEVICETREE_MEM_BASE_ALIGN);
+            if (release_addr >= base && release_addr < granule_end && release_end > end) {
+                end = release_end;
+                changed = true;
+            }
+        }
+    }
+
+    return end;
+}
+
 bool devicetree_find_memory(unsigned long *base_addr, unsigned long *size) {
     // Get the size and address cells
     unsigned int root_offset = fdt_get_root_node(fdt_header), data_offset = 0;
@@ -40,6 +92,16 @@ bool devicetree_find_memory(unsigned long *base_addr, unsigned long *size) {
         mem_size = (mem_size << 32) | fdt_next_data_from_prop(prop, &data_offset);
     }
 
+    // Skip over anything firmware left at the base of memory
+    unsigned long reserved_end = _devicetree_reserved_end(mem_base_addr);
+    if (reserved_end != mem_base_addr) {
+        reserved_end = DEVICETREE_ALIGN_UP(reserved_end, DEVICETREE_MEM_BASE_ALIGN);
+        if (reserved_end - mem_base_addr >= mem_size) return false;
+
+        mem_size = DEVICETREE_ALIGN_DOWN(mem_size - (reserved_end - mem_base_addr), DEVICETREE_MEM_SIZE_ALIGN);
+        mem_base_addr = reserved_end;
+    }
+
     *base_addr = mem_base_addr;
     *size = mem_size;
 
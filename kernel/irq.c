@@ -5,6 +5,7 @@
  */
 
 #include <kernel/kassert.h>
+#include <kernel/ktimer.h>
 #include <kernel/arch/arch_interrupts.h>
 #include <kernel/arch/arch_timer.h>
 #include <kernel/proc/proc_scheduler.h>
@@ -17,6 +18,20 @@ void irq_init(void) {
     kassert(irq_controller.ops != NULL && irq_controller.ops->init != NULL);
     irq_controller.ops->init(irq_controller.data);
 
+    // The platform enabled the timer interrupt on the boot CPU but IPIs are enabled here
+    if (irq_controller.ops->send_ipi != NULL) irq_enable(IRQ_IPI_ID, 0, IRQ_TYPE_EDGE_TRIGGERED);
+
+    arch_interrupts_enable();
+}
+
+void irq_init_cpu(void) {
+    kassert(irq_controller.ops != NULL);
+    if (irq_controller.ops->init_cpu != NULL) irq_controller.ops->init_cpu(irq_controller.data);
+
+    // The timer interrupt is private to each CPU so it has to be enabled on every CPU
+    irq_enable(IRQ_TIMER_ID, 0, irq_controller.timer_type);
+    if (irq_controller.ops->send_ipi != NULL) irq_enable(IRQ_IPI_ID, 0, IRQ_TYPE_EDGE_TRIGGERED);
+
     arch_interrupts_enable();
 }
 
@@ -74,6 +89,16 @@ kresult_t irq_clr(irq_id_t id) {
     return KRESULT_OK;
 }
 
+kresult_t irq_send_ipi(unsigned int cpu) {
+    if (irq_controller.ops->send_ipi == NULL) {
+        return KRESULT_OPERATION_NOT_SUPPORTED;
+    }
+
+    irq_controller.ops->send_ipi(irq_controller.data, IRQ_IPI_ID, cpu);
+
+    return KRESULT_OK;
+}
+
 kresult_t irq_thread_sleep(struct proc_thread_s *thread, irq_id_t id) {
     // FIXME Add the thread to the event hash table; event is (irq_controller.data << 16) | id
     return KRESULT_UNIMPLEMENTED;
@@ -85,12 +110,21 @@ void irq_handler(void) {
     // Ignore spurious interrupts for now
     if (id == IRQ_SPURIOUS_ID) return;
 
+    // IPIs are only sent to get the CPU to run the scheduler
+    if (id == IRQ_IPI_ID && irq_controller.ops->send_ipi != NULL) {
+        irq_end(id);
+        irq_done(id);
+        proc_scheduler_choose();
+        return;
+    }
+
     // FIXME Wake thread from hash table to run with interrupt priority
     arch_timer_stop();
 
     irq_end(id);
     irq_done(id);
 
-    arch_timer_start_msecs(10);
+    // Run the expired timers, this programs the timer for the next deadline. The scheduler's tick is one of them
+    ktimer_expire();
     proc_scheduler_choose();
 }
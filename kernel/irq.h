@@ -22,6 +22,7 @@ struct proc_thread_s;
 
 // Kernel interface
 void irq_init(void);
+void irq_init_cpu(void);
 void irq_enable(irq_id_t id, irq_priority_t priority, irq_type_t type);
 void irq_disable(irq_id_t id);
 kresult_t irq_get_pending(irq_id_t *id);
@@ -30,6 +31,9 @@ void irq_end(irq_id_t id);
 kresult_t irq_done(irq_id_t id);
 kresult_t irq_clr(irq_id_t id);
 
+// Interrupts the given CPU so it runs the scheduler
+kresult_t irq_send_ipi(unsigned int cpu);
+
 // Puts the thread to sleep on the specified IRQ id
 kresult_t irq_thread_sleep(struct proc_thread_s *thread, irq_id_t id);
 
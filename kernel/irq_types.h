@@ -21,6 +21,10 @@ typedef struct {
     // Initializes the IRQ controller
     void (*init)(void*);
 
+    // Initializes the calling CPU's interface to the IRQ controller. init will have been called on the boot CPU before
+    // any other CPU calls this. May be NULL if the controller has no per-CPU state
+    void (*init_cpu)(void*);
+
     // Enables the given IRQ ID with the given priority and type
     void (*enable)(void*, irq_id_t, irq_priority_t, irq_type_t);
 
@@ -44,17 +48,24 @@ typedef struct {
 
     // Clears the pending interrupt
     void (*clr)(void*, irq_id_t);
+
+    // Raises the given inter-processor interrupt ID on the CPU with the given ID. Drivers find the physical CPU to
+    // target with arch_smp_get_mpidr. May be NULL if the controller can't send IPIs
+    void (*send_ipi)(void*, irq_id_t, unsigned int);
 } irq_controller_dev_ops_t;
 
 typedef struct {
     void *data;                    // Device specific data
     irq_id_t spurious_id;          // The ID of the spurious interrupt
     irq_id_t timer_id;             // The timer interrupt ID
+    irq_type_t timer_type;         // The timer interrupt type, needed to enable the timer on every CPU
+    irq_id_t ipi_id;               // The interrupt ID used to interrupt other CPUs
     irq_controller_dev_ops_t *ops; // Device operations
 } irq_controller_dev_t;
 
 #define IRQ_SPURIOUS_ID (irq_controller.spurious_id)
 #define IRQ_TIMER_ID    (irq_controller.timer_id)
+#define IRQ_IPI_ID      (irq_controller.ipi_id)
 
 // Initialized by platform code
 extern irq_controller_dev_t irq_controller;
@@ -11,9 +11,13 @@
 #include <kernel/devicetree.h>
 #include <kernel/rbtree.h>
 #include <kernel/console.h>
+#include <kernel/clocksource.h>
+#include <kernel/kmem_atomic.h>
+#include <kernel/ktimer.h>
+#include <kernel/percpu.h>
 #include <kernel/irq.h>
 #include <kernel/arch/arch_exceptions.h>
-#include <kernel/arch/arch_timer.h>
+#include <kernel/arch/arch_smp.h>
 #include <kernel/vm/vm_types.h>
 #include <kernel/vm/vm_init.h>
 #include <kernel/vm/vm_map.h>
@@ -35,14 +39,12 @@ unsigned long MEMBASEADDR;
 unsigned long MEMSIZE;
 
 void thread_start(void) {
-    unsigned long delay = 1000;
+    unsigned long delay = 1000000;
 
     for (;;) {
-        unsigned long start = arch_timer_get_msecs();
-        kprintf("%f s: thread id = %d\n", arch_timer_get_secs(), proc_thread_current()->tid);
-        while ((arch_timer_get_msecs() - start) < delay) {
-            asm volatile ("wfi\n");
-        }
+        unsigned long start = ktimer_now();
+        kprintf("%lu.%06lu s: thread id = %d\n", start / 1000000, start % 1000000, proc_thread_current()->tid);
+        proc_thread_sleep_until(start + delay);
     }
 }
 
@@ -66,6 +68,10 @@ void kmain(void) {
 
     vm_init();
 
+    // The per-CPU data is addressed by its virtual address so this has to wait for the MMU
+    percpu_init();
+    clocksource_init();
+
     // Update FDT header virtual address
     fdt_header = (fdt_header_t*)(kernel_virtual_start + fdth_offset);
 
@@ -77,12 +83,21 @@ void kmain(void) {
 
     kprintf("vm_init() - done!\n");
 
+    ktimer_init();
+    kprintf("ktimer_init() - done!\n");
+
     proc_init();
     kprintf("proc_init() - done!\n");
 
+    kmem_atomic_init();
+    kprintf("kmem_atomic_init() - done!\n");
+
     irq_init();
     kprintf("irq_init() - done!\n");
 
+    arch_smp_init(fdt_header);
+    kprintf("arch_smp_init() - %u CPUs online\n", arch_smp_num_cpus_online());
+
 #define NUM_THREADS (32)
     proc_thread_t *threads[NUM_THREADS];
 
@@ -93,6 +108,5 @@ void kmain(void) {
         proc_thread_resume(thread);
     }
 
-    arch_timer_start_msecs(10);
     thread_start();
 }
@@ -10,22 +10,42 @@
 #include <kernel/list.h>
 #include <kernel/arch/arch_asm.h>
 #include <kernel/slab.h>
+#include <kernel/kmem_slab.h>
+#include <kernel/kmem_shrinker.h>
+#include <kernel/spinlock.h>
+#include <kernel/hash.h>
 #include <kernel/vm/vm_km.h>
+#include <kernel/vm/vm_page.h>
 #include <kernel/kmem.h>
 
 #define INITIAL_SLAB_BUF_COUNT         (64)
 
-// Minimum block size of 32B and maximum block size of 64KB
-#define NUM_BINS                       (12)
-#define MIN_BLOCK_SIZE                 (0x20)
-#define MAX_BLOCK_SIZE                 (1ul << ((NUM_BINS-1) + arch_ctz(MIN_BLOCK_SIZE)))
-#define BIN_TO_BLOCK_SIZE(x)           (1ul << ((x) + arch_ctz(MIN_BLOCK_SIZE)))
+// Minimum block size of 32B and maximum block size of 64KB. Between each power of 2 there are 4 size classes spaced
+// a quarter of the power of 2 apart, e.g. 32, 40, 48, 56, 64, 80, 96, 112, 128, 160... This bounds the internal
+// fragmentation to 20% instead of the 50% of power of 2 only size classes
+#define MIN_BLOCK_SHIFT                (5)
+#define MAX_BLOCK_SHIFT                (16)
+#define CLASS_STEPS_SHIFT              (2)
+#define NUM_BINS                       (((MAX_BLOCK_SHIFT - MIN_BLOCK_SHIFT) << CLASS_STEPS_SHIFT) + 1)
+#define MIN_BLOCK_SIZE                 (1ul << MIN_BLOCK_SHIFT)
+#define MAX_BLOCK_SIZE                 (1ul << MAX_BLOCK_SHIFT)
+#define BIN_TO_BLOCK_SIZE(x)           ((1ul << (((x) >> CLASS_STEPS_SHIFT) + MIN_BLOCK_SHIFT)) +\
+    (((x) & ((1ul << CLASS_STEPS_SHIFT) - 1)) << (((x) >> CLASS_STEPS_SHIFT) + MIN_BLOCK_SHIFT - CLASS_STEPS_SHIFT)))
+
+// Sizes up to this are mapped to a bin with a lookup table indexed in 8 byte granules
+#define SMALL_SIZE_MAX                 (1024)
+#define SMALL_SIZE_SHIFT               (3)
 
 #define IS_POW2(n)                     (((n) & ((n)-1)) == 0 && (n) != 0)
 #define ROUND_DOWN_POW2(n)             (arch_rbit(arch_rbit(n) & ~(arch_rbit(n) - 1ul)))
 #define ROUND_UP_POW2(n)               (IS_POW2(n) ? (n) : arch_rbit(1ul << (arch_ctz(arch_rbit(n)) - 1)))
-#define CONSTRAIN_TO_MIN_BLOCK_SIZE(n) (((n) < MIN_BLOCK_SIZE) ? MIN_BLOCK_SIZE : (n))
-#define GET_BIN_INDEX(n)               (arch_ctz(n) - arch_ctz(MIN_BLOCK_SIZE))
+#define GET_BIN_INDEX(n)               (((n) <= SMALL_SIZE_MAX) ?\
+    kmem_small_bins[((n) + (1ul << SMALL_SIZE_SHIFT) - 1) >> SMALL_SIZE_SHIFT] : _kmem_size_to_bin(n))
+
+// Slab buffers added to bins from the page allocator are a power of 2 # of pages. The block size may not divide the
+// buffer evenly so round the size of the blocks back up to get the size of the buffer
+#define LINEAR_SLAB_BUF_SIZE(slab, slab_buf)\
+    (ROUND_UP_POW2(ROUND_PAGE_UP(SLAB_BUF_SIZE(slab, slab_buf)) >> PAGESHIFT) << PAGESHIFT)
 
 typedef struct {
     slab_t slab;                // Slab struct for this bin
@@ -33,20 +53,56 @@ typedef struct {
     size_t total_slab_size;     // Combined size of all slab buffers in this bin
     unsigned long total_allocs; // Total number of allocations for this bin
     unsigned long total_frees;  // Total number of frees for this bin
+    size_t requested_size;      // Combined size requested by the current allocations in this bin
 } kmem_bin_t;
 
+// Large allocations of up to this many pages are served by contiguous pages from the page allocator through the linear
+// map. Anything bigger than that gets its own mapping from vm_km
+#define KMEM_LARGE_MAX_PAGES           (256)
+#define KMEM_LARGE_HASH_BUCKETS        (64)
+#define KMEM_LARGE_HASH(addr)          (hash64_fnv1a(addr) & (KMEM_LARGE_HASH_BUCKETS - 1))
+
+// Tracks an allocation larger than MAX_BLOCK_SIZE
+typedef struct {
+    list_node_t ll_node;        // Hash bucket linkage
+    vaddr_t addr;               // Address returned to the caller
+    size_t size;                // Size of the memory backing the allocation
+    vm_page_t *pages;           // First page of the contiguous pages or NULL if allocated with vm_km_alloc
+    size_t num_pages;           // # of pages allocated
+} kmem_large_t;
+
 typedef struct {
-    kmem_bin_t bins[NUM_BINS];  // Array of bins, each bin holds a slab of power-of-2 sized blocks
+    kmem_bin_t bins[NUM_BINS];  // Array of bins, each bin holds a slab of blocks of one size class
     list_t ll_lru;              // List of all bins ordered by least recently allocated
     slab_t slab_buf_slab;       // Slab to allocate slab_buf_t's from
     size_t total_slab_size;     // Combined size of all slabs from each bin
     unsigned long total_allocs; // Total number of allocations
     unsigned long total_frees;  // Total number of frees
     lock_t lock;                // Lock
+
+    list_t large[KMEM_LARGE_HASH_BUCKETS]; // Hash table of large allocations keyed by address
+    spinlock_t large_lock;      // Protects the large allocation hash table
+    size_t large_size;          // Combined size of all outstanding large allocations
+    unsigned long large_allocs; // Total number of large allocations
+    unsigned long large_frees;  // Total number of large frees
 } kmem_t;
 
 kmem_t kmem;
 
+// Size to bin lookup table for small sizes
+uint8_t kmem_small_bins[(SMALL_SIZE_MAX >> SMALL_SIZE_SHIFT) + 1];
+
+unsigned int _kmem_size_to_bin(size_t size) {
+    if (size <= MIN_BLOCK_SIZE) return 0;
+
+    // Find the power of 2 below the size, i.e. 2^shift < size <= 2^(shift+1), then the quarter step within it
+    unsigned long shift = 63 - arch_clz(size - 1);
+    unsigned long step_shift = shift - CLASS_STEPS_SHIFT;
+    unsigned long step = ((size - (1ul << shift)) + (1ul << step_shift) - 1) >> step_shift;
+
+    return ((shift - MIN_BLOCK_SHIFT) << CLASS_STEPS_SHIFT) + step;
+}
+
 void _kmem_grow(unsigned int bin) {
     size_t block_size = BIN_TO_BLOCK_SIZE(bin);
 
@@ -58,58 +114,191 @@ void _kmem_grow(unsigned int bin) {
     long increase = ROUND_PAGE_UP(((kmem.bins[bin].total_slab_size) * alloc_pct) / 100);
     increase = (increase < block_size) ? block_size : increase;
 
-    // Try and grab pages from other least recently used bins if possible. Only check half the bins in the LRU list
-    // This bin should be at the end of this list by now
-    kmem_bin_t *lru = list_entry(list_first(&kmem.ll_lru), kmem_bin_t, ll_node);
-    for (unsigned int i = 0; i < (NUM_BINS / 2) && !list_end(lru); i++) {
-        slab_buf_t *slab_buf = slab_shrink(&lru->slab);
+    // Allocate a slab_buf_t for this new slab buffer; allocate more memory from VM system if we are out of the
+    // slab_buf_t slab
+    slab_buf_t *slab_buf = (slab_buf_t*)slab_alloc(&kmem.slab_buf_slab);
+    if (slab_buf == NULL) {
+        size_t size = ROUND_PAGE_UP(sizeof(slab_buf_t)*INITIAL_SLAB_BUF_COUNT);
+        vaddr_t sa = vm_km_alloc(size, VM_KM_FLAGS_WIRED);
+        slab_grow(&kmem.slab_buf_slab, NULL, (void*)sa, size);
 
-        if (slab_buf != NULL) {
-            size_t slab_buf_size = SLAB_BUF_SIZE(&lru->slab, slab_buf);
+        slab_buf = (slab_buf_t*)slab_alloc(&kmem.slab_buf_slab);
+    }
 
-            // This slab buffer is too small for an allocation of one block, put it back from where it came
-            if (slab_buf_size < block_size) {
-                slab_grow(&lru->slab, slab_buf, slab_buf->buf, slab_buf_size);
-                continue;
+    // Prefer contiguous pages used through the linear map. Only those can be given back by the shrinker since it
+    // can't use the kernel's VM map
+    size_t num_pages = ROUND_UP_POW2(increase >> PAGESHIFT);
+    vm_page_t *pages = vm_page_alloc_contiguous(num_pages, NULL, 0);
+    paddr_t pa = (pages != NULL) ? vm_page_to_pa(pages) : 0;
+    vaddr_t va;
+
+    if (pages != NULL && IS_LINEAR_MAPPED(pa, num_pages << PAGESHIFT)) {
+        increase = num_pages << PAGESHIFT;
+        va = PA_TO_KVA(pa);
+    } else {
+        // Pages below the kernel aren't covered by the linear map
+        if (pages != NULL) vm_page_free_contiguous(pages, num_pages);
+        va = vm_km_alloc(increase, VM_KM_FLAGS_WIRED);
+    }
+
+    kmem.bins[bin].total_slab_size += increase;
+    kmem.total_slab_size += increase;
+
+    slab_grow(&kmem.bins[bin].slab, slab_buf, (void*)va, increase);
+    kmem_slab_buf_register(slab_buf, (void*)va, increase);
+}
+
+size_t _kmem_shrinker_count(void) {
+    size_t count = 0;
+
+    if (!lock_try_acquire(&kmem.lock)) return 0;
+
+    // Count the empty slab buffers that can be released
+    for (unsigned int i = 0; i < NUM_BINS; i++) {
+        slab_buf_t *slab_buf;
+        list_for_each_entry(&kmem.bins[i].slab.ll_slabs, slab_buf, ll_node) {
+            if (slab_buf_is_full(slab_buf) && IS_LINEAR_KVA((vaddr_t)slab_buf->buf)) {
+                count += LINEAR_SLAB_BUF_SIZE(&kmem.bins[i].slab, slab_buf) >> PAGESHIFT;
             }
+        }
+    }
+
+    lock_release(&kmem.lock);
+
+    return count;
+}
+
+size_t _kmem_shrinker_scan(size_t num_pages) {
+    size_t freed = 0;
+
+    if (!lock_try_acquire(&kmem.lock)) return 0;
+
+    // Give back empty slab buffers from the least recently allocated bins first. Every bin keeps at least one buffer
+    kmem_bin_t *lru;
+    list_for_each_entry(&kmem.ll_lru, lru, ll_node) {
+        if (freed >= num_pages) break;
+
+        slab_buf_t *next = NULL;
+        for (slab_buf_t *slab_buf = list_entry(list_first(&lru->slab.ll_slabs), slab_buf_t, ll_node);
+            slab_buf != NULL && freed < num_pages; slab_buf = next) {
+            next = list_entry(list_next(&slab_buf->ll_node), slab_buf_t, ll_node);
 
-            slab_grow(&kmem.bins[bin].slab, slab_buf, slab_buf->buf, slab_buf_size);
+            if (list_first(&lru->slab.ll_slabs) == list_last(&lru->slab.ll_slabs)) break;
+            if (!slab_buf_is_full(slab_buf) || !IS_LINEAR_KVA((vaddr_t)slab_buf->buf)) continue;
 
-            kmem.bins[bin].total_slab_size += slab_buf_size;
-            lru->total_slab_size -= slab_buf_size;
+            size_t size = LINEAR_SLAB_BUF_SIZE(&lru->slab, slab_buf);
 
-            increase -= slab_buf_size;
-            if (increase <= 0) break;
+            kassert(list_remove(&lru->slab.ll_slabs, &slab_buf->ll_node));
+            kmem_slab_buf_register(NULL, slab_buf->buf, size);
+            vm_page_free_contiguous(vm_page_from_pa(KVA_TO_PA((vaddr_t)slab_buf->buf)), size >> PAGESHIFT);
+            slab_free(&kmem.slab_buf_slab, slab_buf);
+
+            lru->total_slab_size -= size;
+            kmem.total_slab_size -= size;
+            freed += size >> PAGESHIFT;
+        }
+    }
+
+    lock_release(&kmem.lock);
+
+    return freed;
+}
+
+list_compare_result_t _kmem_large_find(list_node_t *n1, list_node_t *n2) {
+    kmem_large_t *l1 = list_entry(n1, kmem_large_t, ll_node), *l2 = list_entry(n2, kmem_large_t, ll_node);
+    return (l1->addr == l2->addr) ? LIST_COMPARE_EQ : LIST_COMPARE_LT;
+}
+
+void* _kmem_large_alloc(size_t size) {
+    kmem_large_t *large = (kmem_large_t*)kmem_alloc(sizeof(kmem_large_t));
+    if (large == NULL) return NULL;
+
+    list_node_init(&large->ll_node);
+    large->size = ROUND_PAGE_UP(size);
+    large->num_pages = large->size >> PAGESHIFT;
+    large->pages = NULL;
+    large->addr = 0;
+
+    // Contiguous pages can be used directly through the linear map without touching the page tables. The page
+    // allocator hands out power of 2 sized blocks
+    if (large->num_pages <= KMEM_LARGE_MAX_PAGES) {
+        size_t num_pages = ROUND_UP_POW2(large->num_pages);
+        vm_page_t *pages = vm_page_alloc_contiguous(num_pages, NULL, 0);
+        paddr_t pa = (pages != NULL) ? vm_page_to_pa(pages) : 0;
+
+        // Pages below the kernel aren't covered by the linear map
+        if (pages != NULL && !IS_LINEAR_MAPPED(pa, num_pages << PAGESHIFT)) {
+            vm_page_free_contiguous(pages, num_pages);
+            pages = NULL;
+        }
+
+        if (pages != NULL) {
+            for (size_t i = 0; i < num_pages; i++) {
+                pages[i].status.wired_count++;
+            }
+
+            large->pages = pages;
+            large->num_pages = num_pages;
+            large->size = num_pages << PAGESHIFT;
+            large->addr = PA_TO_KVA(pa);
         }
+    }
 
-        lru = list_entry(list_next(&lru->ll_node), kmem_bin_t, ll_node);
+    // Fall back to mapping pages into new kernel virtual address space
+    if (large->addr == 0) {
+        large->addr = vm_km_alloc(large->size, VM_KM_FLAGS_WIRED | VM_KM_FLAGS_CANFAIL);
+        if (large->addr == 0) {
+            kmem_free(large, sizeof(kmem_large_t));
+            return NULL;
+        }
     }
 
-    // If we can't satisfy memory by stealing slab buffers from least recently used bins, then ask the VM system for
-    // more pages
-    if (increase > 0) {
-        vaddr_t va = vm_km_alloc(increase, VM_KM_FLAGS_WIRED);
+    spinlock_acquire(&kmem.large_lock);
+    kassert(list_push(&kmem.large[KMEM_LARGE_HASH(large->addr)], &large->ll_node));
+    kmem.large_size += large->size;
+    kmem.large_allocs++;
+    spinlock_release(&kmem.large_lock);
 
-        kmem.bins[bin].total_slab_size += increase;
-        kmem.total_slab_size += increase;
+    return (void*)large->addr;
+}
 
-        // Allocate a slab_buf_t for this new slab buffer; allocate more memory from VM system if we are out of the
-        // slab_buf_t slab
-        slab_buf_t *slab_buf = (slab_buf_t*)slab_alloc(&kmem.slab_buf_slab);
-        if (slab_buf == NULL) {
-            size_t size = ROUND_PAGE_UP(sizeof(slab_buf_t)*INITIAL_SLAB_BUF_COUNT);
-            vaddr_t sa = vm_km_alloc(size, VM_KM_FLAGS_WIRED);
-            slab_grow(&kmem.slab_buf_slab, NULL, (void*)sa, size);
+void _kmem_large_free(void *mem) {
+    kmem_large_t tmp = { .addr = (vaddr_t)mem };
+    list_t *bucket = &kmem.large[KMEM_LARGE_HASH(tmp.addr)];
 
-            slab_buf = (slab_buf_t*)slab_alloc(&kmem.slab_buf_slab);
+    spinlock_acquire(&kmem.large_lock);
+    list_node_t *node = list_search(bucket, _kmem_large_find, &tmp.ll_node);
+    kmem_large_t *large = list_entry(node, kmem_large_t, ll_node);
+
+    // Must be freeing something allocated through the large path
+    kassert(large != NULL);
+    kassert(list_remove(bucket, &large->ll_node));
+    kmem.large_size -= large->size;
+    kmem.large_frees++;
+    spinlock_release(&kmem.large_lock);
+
+    if (large->pages != NULL) {
+        for (size_t i = 0; i < large->num_pages; i++) {
+            large->pages[i].status.wired_count--;
         }
 
-        slab_grow(&kmem.bins[bin].slab, slab_buf, (void*)va, increase);
+        vm_page_free_contiguous(large->pages, large->num_pages);
+    } else {
+        vm_km_free(large->addr, large->size, VM_KM_FLAGS_WIRED);
     }
+
+    kmem_free(large, sizeof(kmem_large_t));
 }
 
 void kmem_init(void) {
-    arch_fast_zero((unsigned long)&kmem, sizeof(kmem_t));
+    arch_fast_zero(&kmem, sizeof(kmem_t));
+    lock_init(&kmem.lock);
+    spinlock_init(&kmem.large_lock);
+
+    // Fill in the size to bin lookup table
+    for (size_t i = 0; i <= (SMALL_SIZE_MAX >> SMALL_SIZE_SHIFT); i++) {
+        kmem_small_bins[i] = _kmem_size_to_bin(i << SMALL_SIZE_SHIFT);
+    }
 
     // Grab some space for the slab_buf slab
     size_t size = ROUND_PAGE_UP(sizeof(slab_buf_t)*INITIAL_SLAB_BUF_COUNT);
@@ -130,15 +319,17 @@ void kmem_init(void) {
     for (unsigned int i = 0; i < NUM_BINS; i++) {
         slab_buf_t *slab_buf = (slab_buf_t*)slab_alloc(&kmem.slab_buf_slab);
         slab_init(&kmem.bins[i].slab, slab_buf, (void*)va, kmem.bins[i].total_slab_size, BIN_TO_BLOCK_SIZE(i));
+        kmem_slab_buf_register(slab_buf, (void*)va, kmem.bins[i].total_slab_size);
         va += kmem.bins[i].total_slab_size;
     }
+
+    kassert(kmem_shrinker_register(_kmem_shrinker_count, _kmem_shrinker_scan) == KRESULT_OK);
 }
 
 void* kmem_alloc(size_t size) {
-    if (size > MAX_BLOCK_SIZE) return NULL;
+    if (size > MAX_BLOCK_SIZE) return _kmem_large_alloc(size);
 
-    // Round size to a power-of-2 size
-    size = CONSTRAIN_TO_MIN_BLOCK_SIZE(ROUND_UP_POW2(size));
+    // Find the size class for this size
     unsigned int bin = GET_BIN_INDEX(size);
 
     lock_acquire(&kmem.lock);
@@ -147,6 +338,7 @@ void* kmem_alloc(size_t size) {
     list_remove(&kmem.ll_lru, &kmem.bins[bin].ll_node);
     list_insert_last(&kmem.ll_lru, &kmem.bins[bin].ll_node);
     kmem.bins[bin].total_allocs++;
+    kmem.bins[bin].requested_size += size;
     kmem.total_allocs++;
 
     void *block = slab_alloc(&kmem.bins[bin].slab);
@@ -165,37 +357,49 @@ void* kmem_alloc(size_t size) {
 
 void* kmem_zalloc(size_t size) {
     void *mem = kmem_alloc(size);
-    if (mem != NULL) arch_fast_zero((uintptr_t)mem, size);
+    if (mem != NULL) arch_fast_zero(mem, size);
     return mem;
 }
 
 void kmem_free(void *mem, size_t size) {
-    kassert(size <= MAX_BLOCK_SIZE);
+    if (size > MAX_BLOCK_SIZE) {
+        _kmem_large_free(mem);
+        return;
+    }
 
-    // Round size to a power-of-2 size
-    size = CONSTRAIN_TO_MIN_BLOCK_SIZE(ROUND_UP_POW2(size));
+    // Find the size class for this size
     unsigned int bin = GET_BIN_INDEX(size);
 
     lock_acquire(&kmem.lock);
 
     // Update book-keeping
     kmem.bins[bin].total_frees++;
+    kmem.bins[bin].requested_size -= size;
     kmem.total_frees++;
 
-    slab_free(&kmem.bins[bin].slab, mem);
+    // Find the block's slab buffer through its page's back pointer rather than searching the bin's buffers
+    slab_buf_t *slab_buf = kmem_slab_buf_lookup(mem);
+    if (slab_buf != NULL) {
+        slab_free_buf(&kmem.bins[bin].slab, slab_buf, mem);
+    } else {
+        slab_free(&kmem.bins[bin].slab, mem);
+    }
 
     lock_release(&kmem.lock);
 }
 
 void kmem_stats(void) {
-    unsigned long total_alloc_size = 0;
+    unsigned long total_alloc_size = 0, total_requested_size = 0;
 
     kprintf("KMEM STATS\n");
     kprintf("----------\n");
-    kprintf("\tTotal\t\tTotal\tCurrent\t\t\t\t\t\t\tTotal\tTotal\t\tTotal\n");
-    kprintf("\tAllocations\tFrees\tAllocations\tAllocated\tSlab\t\tUsed\tUsed %%\tAllocated %%\tSlab %%\n");
+    kprintf("\tTotal\t\tTotal\tCurrent\t\t\t\t\t\t\tTotal\tTotal\t\tTotal\tInternal\n");
+    kprintf("\tAllocations\tFrees\tAllocations\tAllocated\tSlab\t\tUsed\tUsed %%\tAllocated %%\tSlab %%\tFrag %%\n");
 
     for (unsigned int i = 0; i < NUM_BINS; i++) {
+        // Skip size classes that have never been used
+        if (kmem.bins[i].total_allocs == 0) continue;
+
         unsigned long current_allocs = kmem.bins[i].total_allocs - kmem.bins[i].total_frees;
         unsigned long alloc_size = current_allocs * BIN_TO_BLOCK_SIZE(i);
         unsigned long used_pct = (alloc_size * 100) / kmem.bins[i].total_slab_size;
@@ -203,15 +407,26 @@ void kmem_stats(void) {
         unsigned long total_alloc_pct = (current_allocs * 100) / kmem.total_allocs;
         unsigned long total_slab_pct = (kmem.bins[i].total_slab_size * 100) / kmem.total_slab_size;
 
+        // Space lost to rounding requests up to the block size of this size class
+        unsigned long frag_pct = (alloc_size != 0) ?
+            ((alloc_size - kmem.bins[i].requested_size) * 100) / alloc_size : 0;
+
         total_alloc_size += alloc_size;
+        total_requested_size += kmem.bins[i].requested_size;
 
-        kprintf("%5uB:\t%u\t\t%u\t%u\t\t%uB\t\t%uB\t\t%u%%\t%u%%\t%u%%\t\t%u%%\n",
+        kprintf("%5uB:\t%u\t\t%u\t%u\t\t%uB\t\t%uB\t\t%u%%\t%u%%\t%u%%\t\t%u%%\t%u%%\n",
             BIN_TO_BLOCK_SIZE(i), kmem.bins[i].total_allocs, kmem.bins[i].total_frees, current_allocs,
-            alloc_size, kmem.bins[i].total_slab_size, used_pct, total_used_pct, total_alloc_pct, total_slab_pct);
+            alloc_size, kmem.bins[i].total_slab_size, used_pct, total_used_pct, total_alloc_pct, total_slab_pct,
+            frag_pct);
     }
 
     unsigned long total_current_allocs = kmem.total_allocs - kmem.total_frees;
+    unsigned long total_frag_pct = (total_alloc_size != 0) ?
+        ((total_alloc_size - total_requested_size) * 100) / total_alloc_size : 0;
     kprintf("------\n");
-    kprintf("Total:\t%u\t\t%u\t%u\t\t%uB\t\t%uB\n",
-        kmem.total_allocs, kmem.total_frees, total_current_allocs, total_alloc_size, kmem.total_slab_size);
+    kprintf("Total:\t%u\t\t%u\t%u\t\t%uB\t\t%uB\t\t\t\t\t\t\t\t%u%%\n",
+        kmem.total_allocs, kmem.total_frees, total_current_allocs, total_alloc_size, kmem.total_slab_size,
+        total_frag_pct);
+    kprintf("Large:\t%u\t\t%u\t%u\t\t%uB\n",
+        kmem.large_allocs, kmem.large_frees, kmem.large_allocs - kmem.large_frees, kmem.large_size);
 }
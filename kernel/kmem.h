@@ -11,12 +11,16 @@
 
 /*
  * kmem - General purpose kernel memory allocator (CURRENTLY UNUSED)
- * kmem is built on top of slabs, in fact it allocates slabs for each of the power of 2 block sizes up to some maximum
- * (i.e. 64KB). The minimum block size it can allocate is 32 bytes so anything smaller will waste space. It will round
- * up allocation requests to the nearest power of 2 block size and allocate a block from the slab holding those blocks.
- * It has an interesting mechanism when slabs run out of free space; it keeps track of least recently used slabs and
- * steals buffers from them for the slab that ran out of blocks. It will do this as long as buffers can be stolen.
- * Eventually it will ask the VM system for more pages mapped into the kernel virtual address space.
+ * kmem is built on top of slabs, in fact it allocates slabs for each of its size classes up to some maximum (i.e.
+ * 64KB). There are 4 size classes for each power of 2, a quarter of the power of 2 apart (32, 40, 48, 56, 64, 80...).
+ * The minimum block size it can allocate is 32 bytes so anything smaller will waste space. It will round up
+ * allocation requests to the nearest size class and allocate a block from the slab holding those blocks.
+ * When a slab runs out of free space it is grown with contiguous pages from the page allocator, in proportion to how
+ * much of the allocations come from it. kmem keeps track of the least recently used slabs and registers a shrinker
+ * that gives the empty buffers of those slabs back to the page allocator first when memory runs low.
+ * Allocations larger than the biggest block size are served by contiguous pages from the page allocator accessed
+ * through the kernel's linear map, or by a new kernel mapping if they are very large. These are tracked in a hash
+ * table by address so kmem_free works the same for any size.
  */
 
 // Initialize the kmem memory allocator syb-system
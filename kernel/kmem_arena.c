@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <kernel/kassert.h>
+#include <kernel/arch/arch_asm.h>
+#include <kernel/vm/vm_types.h>
+#include <kernel/vm/vm_page.h>
+#include <kernel/vm/vm_km.h>
+#include <kernel/kmem_arena.h>
+
+#define ARENA_ALIGN_UP(addr, align) (((addr) + ((align) - 1)) & ~((uintptr_t)(align) - 1))
+
+#define IS_POW2(n)                  (((n) & ((n)-1)) == 0 && (n) != 0)
+#define ROUND_UP_POW2(n)            (IS_POW2(n) ? (n) : arch_rbit(1ul << (arch_ctz(arch_rbit(n)) - 1)))
+
+// Chunks of up to this many pages are taken from the page allocator through the linear map. Anything bigger than that
+// gets its own mapping from vm_km
+#define KMEM_ARENA_CHUNK_MAX_PAGES  (256)
+
+kmem_arena_chunk_t* _kmem_arena_chunk_alloc(size_t size) {
+    size_t num_pages = size >> PAGESHIFT;
+    vaddr_t va = 0;
+
+    // Chunks come from the page allocator through the linear map when possible to keep them off the kernel's VM map.
+    // The page allocator hands out power of 2 sized blocks so the chunk is grown to use all of the block
+    if (num_pages <= KMEM_ARENA_CHUNK_MAX_PAGES) {
+        num_pages = ROUND_UP_POW2(num_pages);
+
+        vm_page_t *pages = vm_page_alloc_contiguous(num_pages, NULL, 0);
+        paddr_t pa = (pages != NULL) ? vm_page_to_pa(pages) : 0;
+
+        // Pages below the kernel aren't covered by the linear map
+        if (pages != NULL && IS_LINEAR_MAPPED(pa, num_pages << PAGESHIFT)) {
+            va = PA_TO_KVA(pa);
+            size = num_pages << PAGESHIFT;
+        } else if (pages != NULL) {
+            vm_page_free_contiguous(pages, num_pages);
+        }
+    }
+
+    if (va == 0) {
+        va = vm_km_alloc(size, VM_KM_FLAGS_WIRED | VM_KM_FLAGS_CANFAIL);
+        if (va == 0) return NULL;
+    }
+
+    kmem_arena_chunk_t *chunk = (kmem_arena_chunk_t*)va;
+    chunk->prev = NULL;
+    chunk->size = size;
+
+    return chunk;
+}
+
+void _kmem_arena_chunk_free(kmem_arena_chunk_t *chunk) {
+    vaddr_t va = (vaddr_t)chunk;
+
+    if (IS_LINEAR_KVA(va)) {
+        vm_page_free_contiguous(vm_page_from_pa(KVA_TO_PA(va)), chunk->size >> PAGESHIFT);
+    } else {
+        vm_km_free(va, chunk->size, VM_KM_FLAGS_WIRED | VM_KM_FLAGS_CANFAIL);
+    }
+}
+
+void _kmem_arena_chunk_push(kmem_arena_t *arena, kmem_arena_chunk_t *chunk) {
+    chunk->prev = arena->chunk;
+    arena->chunk = chunk;
+    arena->next = (uintptr_t)chunk + sizeof(kmem_arena_chunk_t);
+    arena->end = (uintptr_t)chunk + chunk->size;
+    arena->total_size += chunk->size;
+}
+
+// Frees chunks from the top of the chunk stack until stop is the current chunk
+void _kmem_arena_chunk_pop_until(kmem_arena_t *arena, kmem_arena_chunk_t *stop) {
+    while (arena->chunk != stop) {
+        kassert(arena->chunk != NULL);
+
+        kmem_arena_chunk_t *chunk = arena->chunk;
+        arena->chunk = chunk->prev;
+        arena->total_size -= chunk->size;
+        _kmem_arena_chunk_free(chunk);
+    }
+
+    if (arena->chunk != NULL) {
+        arena->next = (uintptr_t)arena->chunk + sizeof(kmem_arena_chunk_t);
+        arena->end = (uintptr_t)arena->chunk + arena->chunk->size;
+    } else {
+        arena->next = 0;
+        arena->end = 0;
+    }
+}
+
+void kmem_arena_init(kmem_arena_t *arena, size_t chunk_size) {
+    kassert(arena != NULL);
+
+    arena->chunk = NULL;
+    arena->next = 0;
+    arena->end = 0;
+    arena->chunk_size = (chunk_size == 0) ? KMEM_ARENA_CHUNK_SIZE_DEFAULT : ROUND_PAGE_UP(chunk_size);
+    arena->total_size = 0;
+}
+
+void* kmem_arena_alloc_aligned(kmem_arena_t *arena, size_t size, size_t align) {
+    kassert(arena != NULL);
+
+    align = (align == 0) ? sizeof(void*) : align;
+    kassert((align & (align - 1)) == 0 && align <= PAGESIZE);
+
+    if (size == 0) return NULL;
+
+    uintptr_t addr = ARENA_ALIGN_UP(arena->next, align);
+
+    if (arena->chunk == NULL || addr < arena->next || addr + size < addr || addr + size > arena->end) {
+        // Allocations that wouldn't fit in a regular chunk get a chunk sized for them. Either way, the rest of the
+        // current chunk is abandoned; it is reclaimed when the arena is rewound, reset or destroyed
+        size_t header = ARENA_ALIGN_UP(sizeof(kmem_arena_chunk_t), align);
+        if (header < sizeof(kmem_arena_chunk_t) || header + size < header) return NULL;
+
+        size_t chunk_size = (header + size > arena->chunk_size) ? ROUND_PAGE_UP(header + size) : arena->chunk_size;
+        if (chunk_size < header + size) return NULL;
+
+        kmem_arena_chunk_t *chunk = _kmem_arena_chunk_alloc(chunk_size);
+        if (chunk == NULL) return NULL;
+
+        // Chunks are page aligned so alignments up to the page size are satisfied at the same offset in every chunk
+        _kmem_arena_chunk_push(arena, chunk);
+        addr = ARENA_ALIGN_UP(arena->next, align);
+    }
+
+    arena->next = addr + size;
+
+    return (void*)addr;
+}
+
+void* kmem_arena_alloc(kmem_arena_t *arena, size_t size) {
+    return kmem_arena_alloc_aligned(arena, size, 0);
+}
+
+void* kmem_arena_zalloc(kmem_arena_t *arena, size_t size) {
+    void *ptr = kmem_arena_alloc_aligned(arena, size, 0);
+    if (ptr != NULL) arch_fast_zero(ptr, size);
+
+    return ptr;
+}
+
+kmem_arena_mark_t kmem_arena_mark(kmem_arena_t *arena) {
+    kassert(arena != NULL);
+    return (kmem_arena_mark_t){ .chunk = arena->chunk, .next = arena->next };
+}
+
+void kmem_arena_rewind(kmem_arena_t *arena, kmem_arena_mark_t mark) {
+    kassert(arena != NULL);
+
+    _kmem_arena_chunk_pop_until(arena, mark.chunk);
+
+    if (mark.chunk != NULL) {
+        kassert(mark.next >= (uintptr_t)mark.chunk + sizeof(kmem_arena_chunk_t) && mark.next <= arena->end);
+        arena->next = mark.next;
+    }
+}
+
+void kmem_arena_reset(kmem_arena_t *arena) {
+    kassert(arena != NULL);
+
+    if (arena->chunk == NULL) return;
+
+    // Keep the first chunk around. It's the bottom of the chunk stack
+    kmem_arena_chunk_t *first = arena->chunk;
+    while (first->prev != NULL) first = first->prev;
+
+    _kmem_arena_chunk_pop_until(arena, first);
+}
+
+void kmem_arena_destroy(kmem_arena_t *arena) {
+    kassert(arena != NULL);
+
+    _kmem_arena_chunk_pop_until(arena, NULL);
+    kassert(arena->total_size == 0);
+}
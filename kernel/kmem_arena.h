@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _KMEM_ARENA_H_
+#define _KMEM_ARENA_H_
+
+#include <sys/types.h>
+
+/*
+ * kmem_arena - Region allocator for short-lived objects that are all freed together
+ * An arena hands out memory by bumping a pointer through large chunks of pages taken from the page allocator. There
+ * is no per-object free; everything allocated from the arena is released at once by resetting or destroying it, or
+ * everything allocated after a checkpoint is released by rewinding to that checkpoint. This suits work like parsing
+ * the device tree or loading an ELF image where many small objects are created and thrown away together.
+ *
+ * Arenas aren't locked, they must only be used by one thread at a time. Allocating may sleep to get more pages.
+ */
+
+// Default size of the chunks an arena grabs from the page allocator
+#define KMEM_ARENA_CHUNK_SIZE_DEFAULT (4 * PAGESIZE)
+
+typedef struct kmem_arena_chunk_s {
+    struct kmem_arena_chunk_s *prev;   // The chunk allocated before this one
+    size_t size;                       // Size of the chunk including this header
+} kmem_arena_chunk_t;
+
+typedef struct {
+    kmem_arena_chunk_t *chunk;         // Chunk allocations are currently bumped from
+    uintptr_t next;                    // Next free byte in the current chunk
+    uintptr_t end;                     // End of the current chunk
+    size_t chunk_size;                 // Size of the chunks taken from the page allocator
+    size_t total_size;                 // Total size of all chunks held by the arena
+} kmem_arena_t;
+
+// Saved allocation position of an arena to rewind to
+typedef struct {
+    kmem_arena_chunk_t *chunk;
+    uintptr_t next;
+} kmem_arena_mark_t;
+
+// Initializes an empty arena. chunk_size is rounded up to a multiple of the page size; 0 selects the default size.
+// No memory is taken until the first allocation
+void kmem_arena_init(kmem_arena_t *arena, size_t chunk_size);
+
+// Allocates size bytes aligned to align bytes, which must be a power of 2. 0 selects pointer alignment. Requests
+// larger than the chunk size get a chunk of their own. Returns NULL if there is no memory left
+void* kmem_arena_alloc_aligned(kmem_arena_t *arena, size_t size, size_t align);
+
+// Allocates size bytes with pointer alignment. The kmem_arena_zalloc variant zeros out the memory
+void* kmem_arena_alloc(kmem_arena_t *arena, size_t size);
+void* kmem_arena_zalloc(kmem_arena_t *arena, size_t size);
+
+// Saves the current allocation position of the arena
+kmem_arena_mark_t kmem_arena_mark(kmem_arena_t *arena);
+
+// Frees everything allocated since the mark was taken. Marks taken after this one become invalid
+void kmem_arena_rewind(kmem_arena_t *arena, kmem_arena_mark_t mark);
+
+// Frees everything allocated from the arena. The first chunk is kept so the arena can be reused without going back to
+// the page allocator
+void kmem_arena_reset(kmem_arena_t *arena);
+
+// Frees everything allocated from the arena and gives all its chunks back. The arena can be reused after this
+void kmem_arena_destroy(kmem_arena_t *arena);
+
+#endif // _KMEM_ARENA_H_
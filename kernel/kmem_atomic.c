@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <kernel/kassert.h>
+#include <kernel/spinlock.h>
+#include <kernel/kmem_slab.h>
+#include <kernel/vm/vm_page.h>
+#include <kernel/proc/proc_task.h>
+#include <kernel/proc/proc_thread.h>
+#include <kernel/kmem_atomic.h>
+
+typedef struct {
+    spinlock_t lock;            // Interlock for the worker sleeping
+    bool pending;               // Set when the reserves need attention
+    proc_thread_t *thread;      // The worker thread, NULL until it is started
+} kmem_atomic_worker_t;
+
+kmem_atomic_worker_t kmem_atomic_worker;
+
+void _kmem_atomic_worker_run(void) {
+    for (;;) {
+        spinlock_acquire_irq(&kmem_atomic_worker.lock);
+
+        while (!kmem_atomic_worker.pending) {
+            proc_thread_sleep(&kmem_atomic_worker, &kmem_atomic_worker.lock, false);
+            spinlock_acquire_irq(&kmem_atomic_worker.lock);
+        }
+
+        kmem_atomic_worker.pending = false;
+        spinlock_release_irq(&kmem_atomic_worker.lock);
+
+        // Kicks that come in while refilling set pending again so nothing is missed. Deferred objects go back to
+        // their slabs first so the reserves can be refilled from them
+        kmem_slab_free_deferred();
+        vm_page_atomic_refill();
+        kmem_slab_atomic_refill();
+    }
+}
+
+void kmem_atomic_init(void) {
+    proc_thread_t *thread;
+    kassert(proc_thread_create(proc_task_kernel(), &thread) == KRESULT_OK);
+    proc_thread_set_entry(thread, _kmem_atomic_worker_run);
+
+    spinlock_acquire_irq(&kmem_atomic_worker.lock);
+    kmem_atomic_worker.thread = thread;
+    kmem_atomic_worker.pending = true;
+    spinlock_release_irq(&kmem_atomic_worker.lock);
+
+    proc_thread_resume(thread);
+}
+
+void kmem_atomic_kick(void) {
+    spinlock_acquire_irq(&kmem_atomic_worker.lock);
+    bool started = kmem_atomic_worker.thread != NULL;
+    kmem_atomic_worker.pending = true;
+    spinlock_release_irq(&kmem_atomic_worker.lock);
+
+    if (started) proc_thread_wake(&kmem_atomic_worker, 1);
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _KMEM_ATOMIC_H_
+#define _KMEM_ATOMIC_H_
+
+#include <sys/types.h>
+
+/*
+ * kmem_atomic - Refill worker for the allocation reserves used by code that can't sleep
+ * The page allocator and kmem_slab both use lock_t which may put the thread to sleep, so they can't be used from
+ * interrupt handlers or with spinlocks held. vm_page_alloc_atomic and kmem_slab_alloc_atomic instead draw from small
+ * reserves protected by spinlocks. When a reserve runs low (or a free overfills it) the allocator kicks a kernel worker
+ * thread which brings the reserves back to their target size using the normal, sleeping, allocation paths. Objects
+ * freed atomically when there is no room to cache them are handed to the worker as well, which returns them to their
+ * slabs.
+ */
+
+// Starts the refill worker thread. Must be called after the proc module is initialized. Kicks before this are
+// remembered and handled when the worker starts
+void kmem_atomic_init(void);
+
+// Wakes up the refill worker. Safe to call from interrupt handlers and with spinlocks held, except for the scheduler
+// lock which waking a thread needs
+void kmem_atomic_kick(void);
+
+#endif // _KMEM_ATOMIC_H_
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <kernel/kassert.h>
+#include <kernel/spinlock.h>
+#include <kernel/arch/arch_atomic.h>
+#include <kernel/arch/arch_barrier.h>
+#include <kernel/kmem_shrinker.h>
+
+// Maximum # of shrinkers that can be registered
+#define KMEM_SHRINKER_MAX (16)
+
+typedef struct {
+    kmem_shrinker_count_t count;
+    kmem_shrinker_scan_t scan;
+} kmem_shrinker_t;
+
+typedef struct {
+    spinlock_t lock;                            // Protects registration
+    volatile atomic_t running;                  // Set while the shrinkers run so they are never re-entered
+    kmem_shrinker_t shrinkers[KMEM_SHRINKER_MAX];
+    size_t num_shrinkers;
+} kmem_shrinker_list_t;
+
+kmem_shrinker_list_t kmem_shrinker_list;
+
+kresult_t kmem_shrinker_register(kmem_shrinker_count_t count, kmem_shrinker_scan_t scan) {
+    if (count == NULL || scan == NULL) return KRESULT_INVALID_ARGUMENT;
+
+    spinlock_acquire(&kmem_shrinker_list.lock);
+
+    if (kmem_shrinker_list.num_shrinkers == KMEM_SHRINKER_MAX) {
+        spinlock_release(&kmem_shrinker_list.lock);
+        return KRESULT_NO_SPACE;
+    }
+
+    kmem_shrinker_t *shrinker = &kmem_shrinker_list.shrinkers[kmem_shrinker_list.num_shrinkers];
+    shrinker->count = count;
+    shrinker->scan = scan;
+    kmem_shrinker_list.num_shrinkers++;
+
+    spinlock_release(&kmem_shrinker_list.lock);
+
+    return KRESULT_OK;
+}
+
+size_t kmem_shrink(size_t num_pages) {
+    // Allocations made by the shrinkers themselves may find memory low as well; don't recurse. The scans may sleep so
+    // this is a flag rather than a spinlock
+    if (num_pages == 0 || arch_atomic_test_and_set(&kmem_shrinker_list.running, 1) != 0) return 0;
+    arch_barrier_dmb();
+
+    size_t counts[KMEM_SHRINKER_MAX], total = 0, freed = 0;
+    size_t num_shrinkers = kmem_shrinker_list.num_shrinkers;
+
+    for (size_t i = 0; i < num_shrinkers; i++) {
+        counts[i] = kmem_shrinker_list.shrinkers[i].count();
+        total += counts[i];
+    }
+
+    // Each cache releases its share of the pages needed, weighted by how much it has to give
+    for (size_t i = 0; i < num_shrinkers && total > 0; i++) {
+        if (counts[i] == 0) continue;
+
+        size_t share = ((counts[i] * num_pages) + total - 1) / total;
+        share = (share > counts[i]) ? counts[i] : share;
+
+        freed += kmem_shrinker_list.shrinkers[i].scan(share);
+    }
+
+    arch_barrier_dmb();
+    kmem_shrinker_list.running = 0;
+
+    return freed;
+}
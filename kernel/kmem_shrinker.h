@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _KMEM_SHRINKER_H_
+#define _KMEM_SHRINKER_H_
+
+#include <sys/types.h>
+#include <kernel/kresult.h>
+
+/*
+ * kmem_shrinker - Memory pressure callbacks for kernel caches
+ * Kernel caches that hold on to memory they could give back (free slab buffers, cached objects etc.) register a pair
+ * of callbacks. When the page allocator runs low on free pages it asks the caches for memory; every cache is asked to
+ * release a share of the pages needed in proportion to how many pages it says it could release.
+ *
+ * Shrinkers may be called from the page allocator in the context of any allocation, including ones made while the
+ * cache's own locks are held. They must not wait on locks an allocating thread may hold (i.e. use lock_try_acquire
+ * and skip what is locked) and must only give pages back to the page allocator directly, never through the kernel's
+ * VM map. Scans may otherwise sleep, e.g. on a lock no allocation is ever made under.
+ */
+
+// Returns the # of pages the cache could release
+typedef size_t (*kmem_shrinker_count_t)(void);
+
+// Asks the cache to release up to num_pages pages. Returns the # of pages released
+typedef size_t (*kmem_shrinker_scan_t)(size_t num_pages);
+
+// Registers a cache's shrinker callbacks
+kresult_t kmem_shrinker_register(kmem_shrinker_count_t count, kmem_shrinker_scan_t scan);
+
+// Asks the registered caches to release num_pages pages between them. Returns the # of pages released. Returns 0
+// without doing anything if the shrinkers are already running. May sleep
+size_t kmem_shrink(size_t num_pages);
+
+#endif // _KMEM_SHRINKER_H_
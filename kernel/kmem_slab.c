@@ -8,32 +8,597 @@
 #include <kernel/kstdio.h>
 #include <kernel/list.h>
 #include <kernel/slab.h>
+#include <kernel/arch/arch_asm.h>
+#include <kernel/arch/arch_interrupts.h>
+#include <kernel/arch/arch_mmu.h>
+#include <kernel/arch/pmap.h>
+#include <kernel/vm/vm_page.h>
 #include <kernel/vm/vm_km.h>
+#include <kernel/kmem_shrinker.h>
+#include <kernel/kmem_atomic.h>
 #include <kernel/kmem_slab.h>
 
+// Pool of magazines shared by all caches
+#define KMEM_MAGAZINE_NUM (512)
+slab_t kmem_magazine_slab;
+slab_buf_t kmem_magazine_slab_buf;
+spinlock_t kmem_magazine_lock;
+bool kmem_magazine_ready = false;
+
+// Pool of slab_buf_t structs for the slab buffers caches grow by. They are kept out of the buffers themselves so the
+// objects keep the alignment of the pages
+#define KMEM_SLAB_BUF_NUM (1024)
+slab_t kmem_slab_buf_pool;
+slab_buf_t kmem_slab_buf_pool_buf;
+spinlock_t kmem_slab_buf_pool_lock;
+
+// Caches grow by at least this many objects at a time
+#define KMEM_SLAB_GROW_MIN_OBJECTS (8)
+
+// List of caches that can grow, for the shrinker
+lock_t kmem_slab_caches_lock;
+list_t kmem_slab_caches;
+
+// List of caches with a reserve for atomic allocations, for the refill worker
+lock_t kmem_slab_reserve_caches_lock;
+list_t kmem_slab_reserve_caches;
+
+// List of caches with objects freed atomically waiting to be returned to the slab by the worker. Atomic frees add to it
+// so it is protected by a spinlock taken with interrupts disabled
+spinlock_t kmem_slab_deferred_lock;
+list_t kmem_slab_deferred_caches;
+
+// Set once the first slab buffer has been registered. Pages can only be registered after the page allocator is
+// initialized so lookups before that can't find anything
+bool kmem_slab_buf_registered = false;
+
+kmem_magazine_t* _kmem_magazine_alloc(void) {
+    if (!kmem_magazine_ready) return NULL;
+
+    // Magazines are also allocated from atomic allocations in interrupt context
+    spinlock_acquire_irq(&kmem_magazine_lock);
+    kmem_magazine_t *mag = (kmem_magazine_t*)slab_alloc(&kmem_magazine_slab);
+    spinlock_release_irq(&kmem_magazine_lock);
+
+    if (mag != NULL) {
+        mag->next = NULL;
+        mag->rounds = 0;
+    }
+
+    return mag;
+}
+
+void _kmem_magazine_free(kmem_magazine_t *mag) {
+    spinlock_acquire_irq(&kmem_magazine_lock);
+    slab_free(&kmem_magazine_slab, mag);
+    spinlock_release_irq(&kmem_magazine_lock);
+}
+
+void _kmem_magazine_push(kmem_magazine_t **list, kmem_magazine_t *mag) {
+    if (mag == NULL) return;
+    mag->next = *list;
+    *list = mag;
+}
+
+slab_buf_t* _kmem_slab_buf_alloc(void) {
+    spinlock_acquire(&kmem_slab_buf_pool_lock);
+    slab_buf_t *slab_buf = (slab_buf_t*)slab_alloc(&kmem_slab_buf_pool);
+    spinlock_release(&kmem_slab_buf_pool_lock);
+
+    return slab_buf;
+}
+
+void _kmem_slab_buf_free(slab_buf_t *slab_buf) {
+    spinlock_acquire(&kmem_slab_buf_pool_lock);
+    slab_free(&kmem_slab_buf_pool, slab_buf);
+    spinlock_release(&kmem_slab_buf_pool_lock);
+}
+
+void _kmem_slab_cache_init(kmem_slab_t *kmem_slab) {
+    kmem_slab->grow_size = 0;
+    kmem_slab->num_grown = 0;
+    kmem_slab->ctor = NULL;
+    kmem_slab->dtor = NULL;
+    list_node_init(&kmem_slab->ll_node);
+
+    kmem_slab->reserve = NULL;
+    kmem_slab->reserve_count = 0;
+    kmem_slab->reserve_target = 0;
+    list_node_init(&kmem_slab->ll_rnode);
+
+    kmem_slab->deferred = NULL;
+    list_node_init(&kmem_slab->ll_dnode);
+
+    spinlock_init(&kmem_slab->depot_lock);
+    kmem_slab->depot_full = NULL;
+    kmem_slab->depot_empty = NULL;
+    kmem_slab->depot_full_count = 0;
+    kmem_slab->depot_empty_count = 0;
+
+    for (unsigned int i = 0; i < MAX_NUM_CPUS; i++) {
+        kmem_slab->cpu[i].loaded = NULL;
+        kmem_slab->cpu[i].previous = NULL;
+    }
+}
+
+void* _kmem_slab_cpu_alloc(kmem_slab_t *kmem_slab) {
+    void *ptr = NULL;
+
+    // Disabling interrupts keeps the thread on this CPU while its magazines are being used
+    bool enabled = arch_interrupts_is_enabled();
+    arch_interrupts_disable();
+
+    kmem_slab_cpu_t *cpu = &kmem_slab->cpu[arch_cpu_get_id()];
+
+    for (;;) {
+        if (cpu->loaded != NULL && cpu->loaded->rounds > 0) {
+            ptr = cpu->loaded->objs[--cpu->loaded->rounds];
+            break;
+        }
+
+        // The previous magazine is either full or empty; if it's full swap it with the loaded one and try again
+        if (cpu->previous != NULL && cpu->previous->rounds > 0) {
+            kmem_magazine_t *tmp = cpu->loaded;
+            cpu->loaded = cpu->previous;
+            cpu->previous = tmp;
+            continue;
+        }
+
+        // Both magazines are empty. Exchange the previous one for a full magazine from the depot
+        spinlock_acquire(&kmem_slab->depot_lock);
+        kmem_magazine_t *full = kmem_slab->depot_full;
+        if (full != NULL) {
+            kmem_slab->depot_full = full->next;
+            kmem_slab->depot_full_count--;
+
+            if (cpu->previous != NULL) {
+                _kmem_magazine_push(&kmem_slab->depot_empty, cpu->previous);
+                kmem_slab->depot_empty_count++;
+            }
+        }
+        spinlock_release(&kmem_slab->depot_lock);
+
+        if (full == NULL) break;
+
+        cpu->previous = cpu->loaded;
+        cpu->loaded = full;
+    }
+
+    if (enabled) arch_interrupts_enable();
+    return ptr;
+}
+
+bool _kmem_slab_cpu_free(kmem_slab_t *kmem_slab, void *ptr) {
+    bool freed = false;
+
+    bool enabled = arch_interrupts_is_enabled();
+    arch_interrupts_disable();
+
+    kmem_slab_cpu_t *cpu = &kmem_slab->cpu[arch_cpu_get_id()];
+
+    for (;;) {
+        if (cpu->loaded != NULL && cpu->loaded->rounds < KMEM_MAGAZINE_SIZE) {
+            cpu->loaded->objs[cpu->loaded->rounds++] = ptr;
+            freed = true;
+            break;
+        }
+
+        // The previous magazine is either full or empty; if it's empty swap it with the loaded one and try again
+        if (cpu->previous != NULL && cpu->previous->rounds < KMEM_MAGAZINE_SIZE) {
+            kmem_magazine_t *tmp = cpu->loaded;
+            cpu->loaded = cpu->previous;
+            cpu->previous = tmp;
+            continue;
+        }
+
+        // Both magazines are full. Get an empty magazine from the depot or the magazine pool
+        spinlock_acquire(&kmem_slab->depot_lock);
+        kmem_magazine_t *empty = kmem_slab->depot_empty;
+        if (empty != NULL) {
+            kmem_slab->depot_empty = empty->next;
+            kmem_slab->depot_empty_count--;
+        }
+        spinlock_release(&kmem_slab->depot_lock);
+
+        if (empty == NULL) empty = _kmem_magazine_alloc();
+        if (empty == NULL) break;
+
+        // Hand the full previous magazine to the depot
+        if (cpu->previous != NULL) {
+            spinlock_acquire(&kmem_slab->depot_lock);
+            _kmem_magazine_push(&kmem_slab->depot_full, cpu->previous);
+            kmem_slab->depot_full_count++;
+            spinlock_release(&kmem_slab->depot_lock);
+        }
+
+        cpu->previous = cpu->loaded;
+        cpu->loaded = empty;
+    }
+
+    if (enabled) arch_interrupts_enable();
+    return freed;
+}
+
+bool _kmem_slab_grow(kmem_slab_t *kmem_slab) {
+    if (kmem_slab->grow_size == 0) return false;
+
+    slab_buf_t *slab_buf = _kmem_slab_buf_alloc();
+    if (slab_buf == NULL) return false;
+
+    // Slab buffers come straight from the page allocator and are used through the linear map. This keeps them off
+    // the kernel's VM map so they can be given back from within the page allocator when memory runs low
+    size_t num_pages = kmem_slab->grow_size >> PAGESHIFT;
+    vm_page_t *pages = vm_page_alloc_contiguous(num_pages, NULL, 0);
+    paddr_t pa = (pages != NULL) ? vm_page_to_pa(pages) : 0;
+
+    // Pages below the kernel aren't covered by the linear map
+    if (pages != NULL && !IS_LINEAR_MAPPED(pa, kmem_slab->grow_size)) {
+        vm_page_free_contiguous(pages, num_pages);
+        pages = NULL;
+    }
+
+    if (pages == NULL) {
+        _kmem_slab_buf_free(slab_buf);
+        return false;
+    }
+
+    void *buf = (void*)PA_TO_KVA(pa);
+    slab_grow(&kmem_slab->slab, slab_buf, buf, kmem_slab->grow_size);
+    kmem_slab_buf_register(slab_buf, buf, kmem_slab->grow_size);
+    kmem_slab->num_grown++;
+
+    return true;
+}
+
+void _kmem_slab_release(kmem_slab_t *kmem_slab, slab_buf_t *slab_buf) {
+    kassert(slab_buf != &kmem_slab->slab_buf && slab_buf_is_full(slab_buf));
+    kassert(list_remove(&kmem_slab->slab.ll_slabs, &slab_buf->ll_node));
+
+    kmem_slab_buf_register(NULL, slab_buf->buf, kmem_slab->grow_size);
+    vm_page_free_contiguous(vm_page_from_pa(KVA_TO_PA((vaddr_t)slab_buf->buf)), kmem_slab->grow_size >> PAGESHIFT);
+    _kmem_slab_buf_free(slab_buf);
+    kmem_slab->num_grown--;
+}
+
+size_t _kmem_slab_shrink(kmem_slab_t *kmem_slab, size_t num_pages) {
+    slab_buf_t *next = NULL;
+    size_t freed = 0;
+
+    // Release added slab buffers that don't have any allocated objects. The initial buffer is always kept
+    for (slab_buf_t *slab_buf = list_entry(list_first(&kmem_slab->slab.ll_slabs), slab_buf_t, ll_node);
+        slab_buf != NULL && kmem_slab->num_grown > 0 && freed < num_pages; slab_buf = next) {
+        next = list_entry(list_next(&slab_buf->ll_node), slab_buf_t, ll_node);
+
+        if (slab_buf != &kmem_slab->slab_buf && slab_buf_is_full(slab_buf)) {
+            _kmem_slab_release(kmem_slab, slab_buf);
+            freed += kmem_slab->grow_size >> PAGESHIFT;
+        }
+    }
+
+    return freed;
+}
+
+void* _kmem_slab_alloc(kmem_slab_t *kmem_slab) {
+    void *ptr = slab_alloc(&kmem_slab->slab);
+    if (ptr == NULL && _kmem_slab_grow(kmem_slab)) ptr = slab_alloc(&kmem_slab->slab);
+
+    // Objects are constructed when they leave the slab layer
+    if (ptr != NULL && kmem_slab->ctor != NULL) kmem_slab->ctor(ptr);
+
+    return ptr;
+}
+
+void _kmem_slab_free_destructed(kmem_slab_t *kmem_slab, void *ptr) {
+    // Use the page's back pointer to the slab buffer if it has one rather than searching the slab's buffers
+    slab_buf_t *slab_buf = kmem_slab_buf_lookup(ptr);
+    if (slab_buf != NULL) {
+        slab_free_buf(&kmem_slab->slab, slab_buf, ptr);
+    } else {
+        slab_free(&kmem_slab->slab, ptr);
+    }
+}
+
+void _kmem_slab_free(kmem_slab_t *kmem_slab, void *ptr) {
+    // The slab layer reuses the object's memory for its free list
+    if (kmem_slab->dtor != NULL) kmem_slab->dtor(ptr);
+
+    _kmem_slab_free_destructed(kmem_slab, ptr);
+}
+
+void _kmem_slab_depot_take(kmem_slab_t *kmem_slab, kmem_magazine_t **mags) {
+    // Empty out the depot. Atomic allocations in interrupt context use the depot lock as well
+    spinlock_acquire_irq(&kmem_slab->depot_lock);
+    while (kmem_slab->depot_full != NULL) {
+        kmem_magazine_t *mag = kmem_slab->depot_full;
+        kmem_slab->depot_full = mag->next;
+        _kmem_magazine_push(mags, mag);
+    }
+    while (kmem_slab->depot_empty != NULL) {
+        kmem_magazine_t *mag = kmem_slab->depot_empty;
+        kmem_slab->depot_empty = mag->next;
+        _kmem_magazine_push(mags, mag);
+    }
+    kmem_slab->depot_full_count = 0;
+    kmem_slab->depot_empty_count = 0;
+    spinlock_release_irq(&kmem_slab->depot_lock);
+}
+
+void _kmem_slab_defer(kmem_slab_t *kmem_slab, void *ptr) {
+    // Destroy the object now since the destructor can't be run once the object is linked into the deferred list; the
+    // worker returns it to the slab
+    if (kmem_slab->dtor != NULL) kmem_slab->dtor(ptr);
+
+    spinlock_acquire_irq(&kmem_slab_deferred_lock);
+    if (kmem_slab->deferred == NULL) kassert(list_insert_last(&kmem_slab_deferred_caches, &kmem_slab->ll_dnode));
+    *(void**)ptr = kmem_slab->deferred;
+    kmem_slab->deferred = ptr;
+    spinlock_release_irq(&kmem_slab_deferred_lock);
+
+    kmem_atomic_kick();
+}
+
+void* _kmem_slab_reserve_take(kmem_slab_t *kmem_slab) {
+    void *ptr = NULL;
+
+    spinlock_acquire_irq(&kmem_slab->depot_lock);
+
+    kmem_magazine_t *mag = kmem_slab->reserve;
+    if (mag != NULL) {
+        ptr = mag->objs[--mag->rounds];
+        kmem_slab->reserve_count--;
+
+        // Hand emptied magazines to the depot
+        if (mag->rounds == 0) {
+            kmem_slab->reserve = mag->next;
+            _kmem_magazine_push(&kmem_slab->depot_empty, mag);
+            kmem_slab->depot_empty_count++;
+        }
+    }
+
+    bool low = kmem_slab->reserve_target != 0 && kmem_slab->reserve_count <= (kmem_slab->reserve_target >> 1);
+    spinlock_release_irq(&kmem_slab->depot_lock);
+
+    if (low) kmem_atomic_kick();
+
+    return ptr;
+}
+
+void _kmem_slab_reserve_put(kmem_slab_t *kmem_slab, void *ptr) {
+    spinlock_acquire_irq(&kmem_slab->depot_lock);
+
+    kmem_magazine_t *mag = kmem_slab->reserve;
+    bool put = mag != NULL && mag->rounds < KMEM_MAGAZINE_SIZE;
+    if (put) {
+        mag->objs[mag->rounds++] = ptr;
+        kmem_slab->reserve_count++;
+    }
+
+    spinlock_release_irq(&kmem_slab->depot_lock);
+
+    // No room anywhere, the worker returns it to the slab
+    if (!put) _kmem_slab_defer(kmem_slab, ptr);
+}
+
+void* _kmem_slab_deferred_take(kmem_slab_t *kmem_slab) {
+    spinlock_acquire_irq(&kmem_slab_deferred_lock);
+
+    void *deferred = kmem_slab->deferred;
+    if (deferred != NULL) kassert(list_remove(&kmem_slab_deferred_caches, &kmem_slab->ll_dnode));
+    kmem_slab->deferred = NULL;
+
+    spinlock_release_irq(&kmem_slab_deferred_lock);
+
+    return deferred;
+}
+
+void _kmem_slab_deferred_free(kmem_slab_t *kmem_slab, void *deferred) {
+    lock_acquire(&kmem_slab->lock);
+
+    while (deferred != NULL) {
+        void *next = *(void**)deferred;
+        _kmem_slab_free_destructed(kmem_slab, deferred);
+        deferred = next;
+    }
+
+    lock_release(&kmem_slab->lock);
+}
+
+void _kmem_slab_reserve_refill(kmem_slab_t *kmem_slab) {
+    lock_acquire(&kmem_slab->lock);
+
+    // Fill magazines from the slab layer until the reserve is back at its target
+    for (;;) {
+        spinlock_acquire_irq(&kmem_slab->depot_lock);
+        size_t needed = (kmem_slab->reserve_count < kmem_slab->reserve_target) ?
+            kmem_slab->reserve_target - kmem_slab->reserve_count : 0;
+        spinlock_release_irq(&kmem_slab->depot_lock);
+
+        if (needed == 0) break;
+
+        kmem_magazine_t *mag = _kmem_magazine_alloc();
+        if (mag == NULL) break;
+
+        while (mag->rounds < KMEM_MAGAZINE_SIZE && mag->rounds < needed) {
+            void *ptr = _kmem_slab_alloc(kmem_slab);
+            if (ptr == NULL) break;
+            mag->objs[mag->rounds++] = ptr;
+        }
+
+        if (mag->rounds == 0) {
+            _kmem_magazine_free(mag);
+            break;
+        }
+
+        spinlock_acquire_irq(&kmem_slab->depot_lock);
+        _kmem_magazine_push(&kmem_slab->reserve, mag);
+        kmem_slab->reserve_count += mag->rounds;
+        spinlock_release_irq(&kmem_slab->depot_lock);
+    }
+
+    lock_release(&kmem_slab->lock);
+}
+
+size_t _kmem_slab_flush(kmem_slab_t *kmem_slab, kmem_magazine_t *mags) {
+    size_t num_objs = 0;
+
+    // Return all the objects in the magazines to the slab and the magazines to the pool. The slab lock must be held
+    while (mags != NULL) {
+        kmem_magazine_t *next = mags->next;
+
+        for (size_t i = 0; i < mags->rounds; i++) {
+            _kmem_slab_free(kmem_slab, mags->objs[i]);
+        }
+
+        num_objs += mags->rounds;
+        _kmem_magazine_free(mags);
+        mags = next;
+    }
+
+    return num_objs;
+}
+
+size_t _kmem_slab_shrinker_count(void) {
+    size_t count = 0;
+
+    // The shrinker may be called while the list is being modified; just report nothing then
+    if (!lock_try_acquire(&kmem_slab_caches_lock)) return 0;
+
+    kmem_slab_t *kmem_slab;
+    list_for_each_entry(&kmem_slab_caches, kmem_slab, ll_node) {
+        count += kmem_slab->num_grown * (kmem_slab->grow_size >> PAGESHIFT);
+    }
+
+    lock_release(&kmem_slab_caches_lock);
+
+    return count;
+}
+
+size_t _kmem_slab_shrinker_scan(size_t num_pages) {
+    size_t freed = 0;
+
+    if (!lock_try_acquire(&kmem_slab_caches_lock)) return 0;
+
+    kmem_slab_t *kmem_slab;
+    list_for_each_entry(&kmem_slab_caches, kmem_slab, ll_node) {
+        if (freed >= num_pages) break;
+
+        // Skip caches that are busy, including the one whose allocation may have led here
+        if (kmem_slab->num_grown == 0 || !lock_try_acquire(&kmem_slab->lock)) continue;
+
+        // Objects sitting in the depot may be all that is keeping added slab buffers from being released
+        kmem_magazine_t *mags = NULL;
+        _kmem_slab_depot_take(kmem_slab, &mags);
+        _kmem_slab_flush(kmem_slab, mags);
+
+        freed += _kmem_slab_shrink(kmem_slab, num_pages - freed);
+        lock_release(&kmem_slab->lock);
+    }
+
+    lock_release(&kmem_slab_caches_lock);
+
+    return freed;
+}
+
+void kmem_slab_init(void) {
+    size_t size = KMEM_MAGAZINE_NUM * sizeof(kmem_magazine_t);
+    void *buf = (void*)pmap_steal_memory(size, NULL, NULL);
+
+    spinlock_init(&kmem_magazine_lock);
+    slab_init(&kmem_magazine_slab, &kmem_magazine_slab_buf, buf, size, sizeof(kmem_magazine_t));
+    kmem_magazine_ready = true;
+
+    size = KMEM_SLAB_BUF_NUM * sizeof(slab_buf_t);
+    buf = (void*)pmap_steal_memory(size, NULL, NULL);
+
+    spinlock_init(&kmem_slab_buf_pool_lock);
+    slab_init(&kmem_slab_buf_pool, &kmem_slab_buf_pool_buf, buf, size, sizeof(slab_buf_t));
+
+    lock_init(&kmem_slab_caches_lock);
+    list_init(&kmem_slab_caches);
+    lock_init(&kmem_slab_reserve_caches_lock);
+    list_init(&kmem_slab_reserve_caches);
+    spinlock_init(&kmem_slab_deferred_lock);
+    list_init(&kmem_slab_deferred_caches);
+    kassert(kmem_shrinker_register(_kmem_slab_shrinker_count, _kmem_slab_shrinker_scan) == KRESULT_OK);
+}
+
 void kmem_slab_create_no_vm(kmem_slab_t *kmem_slab, size_t object_size, size_t num_objects, void *buf) {
     kassert(kmem_slab != NULL);
 
     lock_init(&kmem_slab->lock);
+    _kmem_slab_cache_init(kmem_slab);
     kmem_slab->size = object_size * num_objects;
 
     slab_init(&kmem_slab->slab, &kmem_slab->slab_buf, buf, kmem_slab->size, object_size);
 }
 
-void kmem_slab_create(kmem_slab_t *kmem_slab, size_t object_size, size_t num_objects) {
+void kmem_slab_create(kmem_slab_t *kmem_slab, size_t object_size, size_t num_objects, kmem_slab_ctor_t ctor,
+    kmem_slab_dtor_t dtor) {
     kassert(kmem_slab != NULL);
 
     lock_init(&kmem_slab->lock);
+    _kmem_slab_cache_init(kmem_slab);
     kmem_slab->size = object_size * num_objects;
+    kmem_slab->ctor = ctor;
+    kmem_slab->dtor = dtor;
+
+    // Grow by a power of 2 # of pages holding at least a few objects
+    size_t grow_pages = ROUND_PAGE_UP(object_size * KMEM_SLAB_GROW_MIN_OBJECTS) >> PAGESHIFT;
+    kmem_slab->grow_size = ((grow_pages > 1) ? (1ul << (64 - arch_clz(grow_pages - 1))) : 1) << PAGESHIFT;
 
     void *buf = (void*)vm_km_alloc(kmem_slab->size, VM_KM_FLAGS_WIRED);
     slab_init(&kmem_slab->slab, &kmem_slab->slab_buf, buf, kmem_slab->size, object_size);
+    kmem_slab_buf_register(&kmem_slab->slab_buf, buf, kmem_slab->size);
+
+    lock_acquire(&kmem_slab_caches_lock);
+    kassert(list_insert_last(&kmem_slab_caches, &kmem_slab->ll_node));
+    lock_release(&kmem_slab_caches_lock);
 }
 
 void kmem_slab_destroy(kmem_slab_t *kmem_slab) {
-    kassert(kmem_slab != NULL && slab_buf_is_full(&kmem_slab->slab_buf));
+    kassert(kmem_slab != NULL);
+
+    // The cache must no longer be in use so every CPU's magazines can be flushed from here
+    kmem_magazine_t *mags = NULL;
+    for (unsigned int i = 0; i < MAX_NUM_CPUS; i++) {
+        _kmem_magazine_push(&mags, kmem_slab->cpu[i].loaded);
+        _kmem_magazine_push(&mags, kmem_slab->cpu[i].previous);
+        kmem_slab->cpu[i].loaded = kmem_slab->cpu[i].previous = NULL;
+    }
+
+    if (kmem_slab->grow_size != 0) {
+        lock_acquire(&kmem_slab_caches_lock);
+        kassert(list_remove(&kmem_slab_caches, &kmem_slab->ll_node));
+        lock_release(&kmem_slab_caches_lock);
+    }
+
+    if (kmem_slab->reserve_target != 0) {
+        lock_acquire(&kmem_slab_reserve_caches_lock);
+        kassert(list_remove(&kmem_slab_reserve_caches, &kmem_slab->ll_rnode));
+        lock_release(&kmem_slab_reserve_caches_lock);
+    }
+
+    kmem_slab_reap(kmem_slab);
+
+    // Empty the reserve and return the objects that were freed atomically
+    kmem_slab->reserve_target = 0;
+    while (kmem_slab->reserve != NULL) {
+        kmem_magazine_t *mag = kmem_slab->reserve;
+        kmem_slab->reserve = mag->next;
+        _kmem_magazine_push(&mags, mag);
+    }
+    kmem_slab->reserve_count = 0;
+    _kmem_slab_deferred_free(kmem_slab, _kmem_slab_deferred_take(kmem_slab));
 
     lock_acquire(&kmem_slab->lock);
+    _kmem_slab_flush(kmem_slab, mags);
+
+    kassert(slab_buf_is_full(&kmem_slab->slab_buf));
+
+    _kmem_slab_shrink(kmem_slab, (size_t)-1);
+    kassert(kmem_slab->num_grown == 0);
+
+    kmem_slab_buf_register(NULL, kmem_slab->slab_buf.buf, kmem_slab->size);
     vm_km_free((vaddr_t)kmem_slab->slab_buf.buf, kmem_slab->size, 0);
     lock_release(&kmem_slab->lock);
 }
@@ -41,19 +606,21 @@ void kmem_slab_destroy(kmem_slab_t *kmem_slab) {
 void* kmem_slab_alloc(kmem_slab_t *kmem_slab) {
     kassert(kmem_slab != NULL);
 
+    void *ptr = _kmem_slab_cpu_alloc(kmem_slab);
+    if (ptr != NULL) return ptr;
+
     lock_acquire(&kmem_slab->lock);
-    void *ptr = slab_alloc(&kmem_slab->slab);
+    ptr = _kmem_slab_alloc(kmem_slab);
     lock_release(&kmem_slab->lock);
 
     return ptr;
 }
 
 void* kmem_slab_zalloc(kmem_slab_t *kmem_slab) {
-    kassert(kmem_slab != NULL);
+    kassert(kmem_slab != NULL && kmem_slab->ctor == NULL);
 
-    lock_acquire(&kmem_slab->lock);
-    void *ptr = slab_zalloc(&kmem_slab->slab);
-    lock_release(&kmem_slab->lock);
+    void *ptr = kmem_slab_alloc(kmem_slab);
+    if (ptr != NULL) arch_fast_zero(ptr, kmem_slab->slab.block_size);
 
     return ptr;
 }
@@ -61,7 +628,131 @@ void* kmem_slab_zalloc(kmem_slab_t *kmem_slab) {
 void kmem_slab_free(kmem_slab_t *kmem_slab, void *ptr) {
     kassert(kmem_slab != NULL && ptr != NULL);
 
+    if (_kmem_slab_cpu_free(kmem_slab, ptr)) return;
+
     lock_acquire(&kmem_slab->lock);
-    slab_free(&kmem_slab->slab, ptr);
+    _kmem_slab_free(kmem_slab, ptr);
     lock_release(&kmem_slab->lock);
 }
+
+void* kmem_slab_alloc_atomic(kmem_slab_t *kmem_slab) {
+    kassert(kmem_slab != NULL);
+
+    // The per-CPU magazines and the depot only use spinlocks so try them before digging into the reserve
+    void *ptr = _kmem_slab_cpu_alloc(kmem_slab);
+    if (ptr != NULL) return ptr;
+
+    return _kmem_slab_reserve_take(kmem_slab);
+}
+
+void kmem_slab_free_atomic(kmem_slab_t *kmem_slab, void *ptr) {
+    kassert(kmem_slab != NULL && ptr != NULL);
+
+    // The per-CPU magazines and the depot only use spinlocks
+    if (_kmem_slab_cpu_free(kmem_slab, ptr)) return;
+
+    _kmem_slab_reserve_put(kmem_slab, ptr);
+}
+
+void kmem_slab_set_reserve(kmem_slab_t *kmem_slab, size_t num_objects) {
+    kassert(kmem_slab != NULL);
+
+    lock_acquire(&kmem_slab_reserve_caches_lock);
+
+    if (kmem_slab->reserve_target == 0 && num_objects != 0) {
+        kassert(list_insert_last(&kmem_slab_reserve_caches, &kmem_slab->ll_rnode));
+    } else if (kmem_slab->reserve_target != 0 && num_objects == 0) {
+        kassert(list_remove(&kmem_slab_reserve_caches, &kmem_slab->ll_rnode));
+    }
+
+    spinlock_acquire_irq(&kmem_slab->depot_lock);
+    kmem_slab->reserve_target = num_objects;
+    spinlock_release_irq(&kmem_slab->depot_lock);
+
+    lock_release(&kmem_slab_reserve_caches_lock);
+
+    // Fill the reserve right away so it's usable as soon as this returns
+    _kmem_slab_reserve_refill(kmem_slab);
+}
+
+void kmem_slab_atomic_refill(void) {
+    lock_acquire(&kmem_slab_reserve_caches_lock);
+
+    kmem_slab_t *kmem_slab;
+    list_for_each_entry(&kmem_slab_reserve_caches, kmem_slab, ll_rnode) {
+        _kmem_slab_reserve_refill(kmem_slab);
+    }
+
+    lock_release(&kmem_slab_reserve_caches_lock);
+}
+
+void kmem_slab_free_deferred(void) {
+    for (;;) {
+        list_node_t *node = NULL;
+
+        spinlock_acquire_irq(&kmem_slab_deferred_lock);
+
+        list_pop(&kmem_slab_deferred_caches, node);
+        kmem_slab_t *kmem_slab = list_entry(node, kmem_slab_t, ll_dnode);
+
+        void *deferred = NULL;
+        if (kmem_slab != NULL) {
+            deferred = kmem_slab->deferred;
+            kmem_slab->deferred = NULL;
+        }
+
+        spinlock_release_irq(&kmem_slab_deferred_lock);
+
+        if (kmem_slab == NULL) break;
+
+        _kmem_slab_deferred_free(kmem_slab, deferred);
+    }
+}
+
+void kmem_slab_buf_register(slab_buf_t *slab_buf, void *buf, size_t size) {
+    for (vaddr_t va = ROUND_PAGE_DOWN(buf); va < (vaddr_t)buf + size; va += PAGESIZE) {
+        paddr_t pa = arch_mmu_translate_va(va);
+        kassert(pa != (paddr_t)-1);
+
+        vm_page_from_pa(pa)->slab_buf = slab_buf;
+    }
+
+    kmem_slab_buf_registered = true;
+}
+
+slab_buf_t* kmem_slab_buf_lookup(void *block) {
+    if (!kmem_slab_buf_registered) return NULL;
+
+    // Translating through the MMU avoids walking the kernel pmap under its lock
+    paddr_t pa = arch_mmu_translate_va((vaddr_t)block);
+    if (pa == (paddr_t)-1 || !IS_WITHIN_MEM_BOUNDS(pa)) return NULL;
+
+    return (slab_buf_t*)vm_page_from_pa(pa)->slab_buf;
+}
+
+size_t kmem_slab_reap(kmem_slab_t *kmem_slab) {
+    kassert(kmem_slab != NULL);
+
+    kmem_magazine_t *mags = NULL;
+
+    bool enabled = arch_interrupts_is_enabled();
+    arch_interrupts_disable();
+
+    // Take this CPU's magazines
+    kmem_slab_cpu_t *cpu = &kmem_slab->cpu[arch_cpu_get_id()];
+    _kmem_magazine_push(&mags, cpu->loaded);
+    _kmem_magazine_push(&mags, cpu->previous);
+    cpu->loaded = cpu->previous = NULL;
+
+    _kmem_slab_depot_take(kmem_slab, &mags);
+
+    if (enabled) arch_interrupts_enable();
+
+    // The slab lock may sleep so the magazines are flushed with interrupts enabled
+    lock_acquire(&kmem_slab->lock);
+    size_t num_objs = _kmem_slab_flush(kmem_slab, mags);
+    _kmem_slab_shrink(kmem_slab, (size_t)-1);
+    lock_release(&kmem_slab->lock);
+
+    return num_objs;
+}
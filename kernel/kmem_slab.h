@@ -10,6 +10,8 @@
 #include <sys/types.h>
 #include <kernel/slab.h>
 #include <kernel/lock.h>
+#include <kernel/spinlock.h>
+#include <kernel/arch/arch_cpu.h>
 
 /*
  * kmem_slab - General purpose slab allocator using the kernel virtual address space and protected by locks
@@ -17,29 +19,119 @@
  * for setting up their own slab of objects to allocate from. The modules will handle out-of-memory conditions
  * themselves (typically by purging least recently used objects and freeing them). kmem_slab will grab free virtual
  * memory from the kernel for new slabs. For the most part, kmem_slab is a convenience wrapper around the slabs module.
+ *
+ * Allocations and frees are cached in per-CPU magazines (arrays of object pointers) as described in Bonwick's
+ * "Magazines and Vmem" paper. Each CPU has a loaded and a previous magazine which satisfy the common case without
+ * taking any locks or touching cache lines shared with other CPUs. When both are exhausted, full or empty magazines
+ * are exchanged with the cache's depot under a spinlock. Only when the depot can't help does the slab layer and its
+ * lock get involved.
+ *
+ * Caches created with kmem_slab_create grow by adding slab buffers from the page allocator when they run out of
+ * objects; num_objects is only the initial size of the cache. Added buffers that no longer have any allocated objects
+ * are released when the cache is reaped or by the kmem_slab shrinker when memory runs low. An optional constructor is
+ * run on an object when it leaves the slab layer and the optional destructor when it returns to it, so objects
+ * cycling through the magazines stay constructed. Objects must be returned to their constructed state before they are
+ * freed.
  */
 
-// kmem_slab is just a slab with mutex lock using the kernel VM address space
+// # of objects a magazine holds
+#define KMEM_MAGAZINE_SIZE (15)
+
+typedef struct kmem_magazine_s {
+    struct kmem_magazine_s *next;      // Linkage in the depot's full or empty magazine list
+    size_t rounds;                     // # of objects currently in the magazine
+    void *objs[KMEM_MAGAZINE_SIZE];    // Object pointers
+} kmem_magazine_t;
+
+// Per-CPU magazines, aligned to a cache line so CPUs never share one
+typedef struct {
+    kmem_magazine_t *loaded;           // Magazine objects are allocated from and freed to
+    kmem_magazine_t *previous;         // Previously loaded magazine, either full or empty
+} __attribute__((aligned(CACHE_LINE_SIZE))) kmem_slab_cpu_t;
+
+// Object constructor and destructor callbacks
+typedef void (*kmem_slab_ctor_t)(void *obj);
+typedef void (*kmem_slab_dtor_t)(void *obj);
+
+// kmem_slab is just a slab with mutex lock using the kernel VM address space fronted by per-CPU magazines
 typedef struct {
     lock_t lock;
     slab_t slab;
     slab_buf_t slab_buf;
     size_t size;
+
+    size_t grow_size;                  // Size of the slab buffers added when the cache runs out, 0 if it can't grow
+    size_t num_grown;                  // # of slab buffers added to the cache
+    kmem_slab_ctor_t ctor;             // Optional object constructor
+    kmem_slab_dtor_t dtor;             // Optional object destructor
+    list_node_t ll_node;               // Linkage in the list of caches that can grow
+
+    kmem_magazine_t *reserve;          // Magazines of objects set aside for atomic allocations
+    size_t reserve_count;              // # of objects in the reserve
+    size_t reserve_target;             // # of objects the refill worker keeps in the reserve
+    list_node_t ll_rnode;              // Linkage in the list of caches with a reserve
+
+    void *deferred;                    // Objects freed atomically that couldn't be cached, linked by their first word
+    list_node_t ll_dnode;              // Linkage in the list of caches with deferred objects
+
+    spinlock_t depot_lock;             // Protects the depot
+    kmem_magazine_t *depot_full;       // List of full magazines
+    kmem_magazine_t *depot_empty;      // List of empty magazines
+    size_t depot_full_count;           // # of magazines in the full list
+    size_t depot_empty_count;          // # of magazines in the empty list
+
+    kmem_slab_cpu_t cpu[MAX_NUM_CPUS];
 } kmem_slab_t;
 
+// Initializes the pool magazines are allocated from. Must be called before the page allocator is initialized. Caches
+// created before this don't use magazines until the pool is ready
+void kmem_slab_init(void);
+
 // Create a new slab. The no_vm version takes the pointer to the slab buffer instead
-// of allocating kernel virtual address space for it.
+// of allocating kernel virtual address space for it. no_vm caches are created before the page allocator is available
+// so they are fixed in size and don't support constructors or destructors.
 void kmem_slab_create_no_vm(kmem_slab_t *kmem_slab, size_t object_size, size_t num_objects, void *buf);
-void kmem_slab_create(kmem_slab_t *kmem_slab, size_t object_size, size_t num_objects);
+void kmem_slab_create(kmem_slab_t *kmem_slab, size_t object_size, size_t num_objects, kmem_slab_ctor_t ctor,
+    kmem_slab_dtor_t dtor);
 
 // Delete an allocation zone
 void kmem_slab_destroy(kmem_slab_t *kmem_slab);
 
-// Allocate memory according to the given size. The kmem_slab_zalloc variant zeros out the memory
+// Allocate memory according to the given size. The kmem_slab_zalloc variant zeros out the memory and can't be used on
+// caches with a constructor
 void* kmem_slab_alloc(kmem_slab_t *kmem_slab);
 void* kmem_slab_zalloc(kmem_slab_t *kmem_slab);
 
 // Free the memory previously allocated by kmem_slab_(z)alloc
 void kmem_slab_free(kmem_slab_t *kmem_slab, void *ptr);
 
+// Allocate and free objects without sleeping, i.e. from interrupt handlers or with spinlocks held. Allocations come
+// from this CPU's magazines, the depot and finally the cache's reserve; NULL is returned if those are all empty.
+// Frees go to the magazines, the depot or the reserve. Objects freed when there is no room to cache them are
+// destroyed and handed to the kmem_atomic worker, so the destructor of caches used this way must not sleep
+void* kmem_slab_alloc_atomic(kmem_slab_t *kmem_slab);
+void kmem_slab_free_atomic(kmem_slab_t *kmem_slab, void *ptr);
+
+// Sets the # of objects kept in reserve for kmem_slab_alloc_atomic and fills the reserve. Setting it to 0 stops
+// refilling the reserve
+void kmem_slab_set_reserve(kmem_slab_t *kmem_slab, size_t num_objects);
+
+// Brings the reserves of all caches back to their target size. Called by the kmem_atomic worker; may sleep
+void kmem_slab_atomic_refill(void);
+
+// Returns the objects handed to the worker by kmem_slab_free_atomic to their slabs. Called by the worker; may sleep
+void kmem_slab_free_deferred(void);
+
+// Records slab_buf as the owner of every page in the given kernel virtual address range so frees of blocks in it can
+// find their slab buffer in constant time. Passing a NULL slab_buf clears the record
+void kmem_slab_buf_register(slab_buf_t *slab_buf, void *buf, size_t size);
+
+// Returns the slab buffer owning the block, or NULL if the block's page wasn't registered
+slab_buf_t* kmem_slab_buf_lookup(void *block);
+
+// Returns the objects held in the depot's full magazines to the slab and releases the depot's empty magazines. The
+// calling CPU's magazines are flushed as well. Slab buffers added to the cache that no longer have any allocated
+// objects are then released. Returns the # of objects returned to the slab
+size_t kmem_slab_reap(kmem_slab_t *kmem_slab);
+
 #endif // _KMEM_SLAB_H_
@@ -15,6 +15,7 @@ typedef enum {
     KRESULT_RESOURCE_SHORTAGE,
     KRESULT_OPERATION_NOT_SUPPORTED,
     KRESULT_UNIMPLEMENTED,
+    KRESULT_TIMED_OUT,
 } kresult_t;
 
 #endif // _KRESULT_H_
@@ -11,13 +11,13 @@
 #include <kernel/console.h>
 #include <kernel/lock.h>
 #include <kernel/kstdio.h>
+#include <kernel/percpu.h>
 
 typedef struct {
     lock_t lock;
-    char buffer[1024];
 } kstdio_t;
 
-kstdio_t kstdio = { .lock = LOCK_INITIALIZER, .buffer = {0}};
+kstdio_t kstdio = { .lock = LOCK_INITIALIZER };
 
 int kputs(const char *s) {
     size_t len = strlen(s), count = 0;
@@ -38,11 +38,16 @@ int kprintf(const char *fmt, ...) {
 
     lock_acquire_exclusive(&kstdio.lock);
 
+    // Format into the buffer of the CPU we're on. Moving to another CPU halfway is fine, the lock keeps every other
+    // thread out of all the buffers. A panic can print before the per-CPU data is set up
+    percpu_t *cpu = this_cpu();
+    char *buffer = (cpu != NULL) ? cpu->kstdio_buffer : per_cpu_ptr(arch_cpu_get_id())->kstdio_buffer;
+
     va_start(args, fmt);
-    r = vsprintf(kstdio.buffer, fmt, args);
+    r = vsprintf(buffer, fmt, args);
     va_end(args);
 
-    kputs(kstdio.buffer);
+    kputs(buffer);
 
     lock_release_exclusive(&kstdio.lock);
 
@@ -7,6 +7,9 @@
 #ifndef _KSTDIO_H_
 #define _KSTDIO_H_
 
+// Size of the buffer kprintf formats strings into
+#define KSTDIO_BUFFER_SIZE (1024)
+
 int kputs(const char *s);
 int kprintf(const char *fmt, ...);
 
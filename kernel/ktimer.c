@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <kernel/kassert.h>
+#include <kernel/percpu.h>
+#include <kernel/arch/arch_timer.h>
+#include <kernel/ktimer.h>
+
+#define _ktimer_wheel(cpu)        (&per_cpu_ptr(cpu)->ktimer)
+#define _ktimer_shift(level)      ((level) * KTIMER_SLOT_BITS)
+#define _ktimer_slot(block)       ((unsigned int)(block) & (KTIMER_SLOTS - 1))
+
+// Locks the timing wheel of the CPU we're running on. The CPU may change until interrupts are disabled so check that
+// the locked wheel is still ours
+ktimer_cpu_t* _ktimer_lock_this_wheel(void) {
+    for (;;) {
+        ktimer_cpu_t *wheel = &this_cpu()->ktimer;
+        spinlock_acquire_irq(&wheel->lock);
+        if (wheel == &this_cpu()->ktimer) return wheel;
+        spinlock_release_irq(&wheel->lock);
+    }
+}
+
+// Puts the timer in the slot covering its deadline on the lowest level that reaches it. Slots on level 0 cover the
+// next KTIMER_SLOTS usecs starting at clk. Slots on higher levels cover the next KTIMER_SLOTS - 1 blocks after the one
+// clk is in, the slot of clk's own block is always empty. Deadlines beyond the top level are parked in its last slot
+// and placed again when it's cascaded. The wheel must be locked
+void _ktimer_insert(ktimer_cpu_t *wheel, ktimer_t *timer) {
+    unsigned long deadline = (timer->deadline > wheel->clk) ? timer->deadline : wheel->clk;
+    unsigned int level = 0;
+
+    while (level < KTIMER_LEVELS - 1 &&
+        (deadline >> _ktimer_shift(level)) - (wheel->clk >> _ktimer_shift(level)) >= KTIMER_SLOTS) level++;
+
+    unsigned long block = deadline >> _ktimer_shift(level), clk_block = wheel->clk >> _ktimer_shift(level);
+    if (block - clk_block >= KTIMER_SLOTS) block = clk_block + KTIMER_SLOTS - 1;
+
+    timer->level = level;
+    timer->slot = _ktimer_slot(block);
+    timer->cpu = wheel->cpu;
+    timer->armed = true;
+
+    kassert(list_insert_last(&wheel->slots[level][timer->slot], &timer->ll_node));
+    wheel->pending[level] |= 1UL << timer->slot;
+}
+
+void _ktimer_remove(ktimer_cpu_t *wheel, ktimer_t *timer) {
+    list_t *slot = &wheel->slots[timer->level][timer->slot];
+
+    kassert(list_remove(slot, &timer->ll_node));
+    if (list_is_empty(slot)) wheel->pending[timer->level] &= ~(1UL << timer->slot);
+
+    timer->armed = false;
+}
+
+// Returns the earliest time the wheel needs to be run at: the deadline of the first timer on level 0 or the start of
+// the first pending block on a higher level, whichever comes first. The wheel must be locked
+unsigned long _ktimer_next(ktimer_cpu_t *wheel) {
+    unsigned long next = KTIMER_NONE;
+
+    for (unsigned int level = 0; level < KTIMER_LEVELS; level++) {
+        unsigned long pending = wheel->pending[level];
+        if (pending == 0) continue;
+
+        // Rotate the bitmap so bit 0 is the slot of clk's block
+        unsigned long clk_block = wheel->clk >> _ktimer_shift(level);
+        unsigned int index = _ktimer_slot(clk_block);
+        if (index != 0) pending = (pending >> index) | (pending << (KTIMER_SLOTS - index));
+
+        unsigned long start = (clk_block + __builtin_ctzl(pending)) << _ktimer_shift(level);
+        if (start < next) next = start;
+    }
+
+    return next;
+}
+
+// Programs the generic timer for the earliest deadline in the wheel or stops it if there is none. The wheel must be
+// this CPU's and must be locked
+void _ktimer_program(ktimer_cpu_t *wheel) {
+    unsigned long next = _ktimer_next(wheel);
+
+    wheel->next_event = next;
+
+    // The compare value is absolute so a deadline that has already passed fires right away. Round up a cycle so the
+    // interrupt never comes in before the deadline's usec
+    if (next == KTIMER_NONE) arch_timer_stop();
+    else arch_timer_start_at(clocksource_usecs_to_cycles(next) + 1);
+}
+
+// Moves the timers in the slot of clk's block on the given level down to the lower levels
+void _ktimer_cascade(ktimer_cpu_t *wheel, unsigned int level) {
+    unsigned int index = _ktimer_slot(wheel->clk >> _ktimer_shift(level));
+    if ((wheel->pending[level] & (1UL << index)) == 0) return;
+
+    list_t *slot = &wheel->slots[level][index];
+    list_t cascade = *slot;
+
+    list_init(slot);
+    wheel->pending[level] &= ~(1UL << index);
+
+    list_node_t *node;
+    while (!list_is_empty(&cascade)) {
+        list_pop(&cascade, node);
+        _ktimer_insert(wheel, list_entry(node, ktimer_t, ll_node));
+    }
+}
+
+// Advances the wheel's clock to now, stopping at every pending slot on the way to cascade it or call the functions of
+// the timers in it. The wheel must be locked, it's unlocked while the timer functions are called
+void _ktimer_run(ktimer_cpu_t *wheel, unsigned long now) {
+    for (;;) {
+        unsigned long next = _ktimer_next(wheel);
+        if (next > now) break;
+
+        wheel->clk = next;
+
+        // The lower levels may have a slot that starts at the same time as the one being cascaded
+        for (unsigned int level = KTIMER_LEVELS - 1; level > 0; level--) _ktimer_cascade(wheel, level);
+
+        // Timers in the level 0 slot of clk have all expired. Functions may arm timers into the same slot again
+        list_t *slot = &wheel->slots[0][_ktimer_slot(wheel->clk)];
+        while (!list_is_empty(slot)) {
+            ktimer_t *timer = list_entry(list_first(slot), ktimer_t, ll_node);
+            _ktimer_remove(wheel, timer);
+
+            wheel->running = timer;
+            spinlock_release_irq(&wheel->lock);
+
+            timer->func(timer, timer->arg);
+
+            spinlock_acquire_irq(&wheel->lock);
+            wheel->running = NULL;
+        }
+    }
+
+    // Jumping over empty slots is fine, every timer left in the wheel is still after the new clk
+    if (now > wheel->clk) wheel->clk = now;
+}
+
+void ktimer_init(void) {
+    unsigned long now = ktimer_now();
+
+    for (unsigned int i = 0; i < MAX_NUM_CPUS; i++) {
+        ktimer_cpu_t *wheel = _ktimer_wheel(i);
+
+        spinlock_init(&wheel->lock);
+        wheel->cpu = i;
+        wheel->clk = now;
+        wheel->next_event = KTIMER_NONE;
+        wheel->running = NULL;
+
+        for (unsigned int level = 0; level < KTIMER_LEVELS; level++) {
+            wheel->pending[level] = 0;
+            for (unsigned int slot = 0; slot < KTIMER_SLOTS; slot++) list_init(&wheel->slots[level][slot]);
+        }
+    }
+}
+
+void ktimer_setup(ktimer_t *timer, ktimer_func_t func, void *arg) {
+    kassert(timer != NULL && func != NULL);
+
+    list_node_init(&timer->ll_node);
+    timer->deadline = KTIMER_NONE;
+    timer->func = func;
+    timer->arg = arg;
+    timer->cpu = KTIMER_CPU_NONE;
+    timer->level = 0;
+    timer->slot = 0;
+    timer->armed = false;
+}
+
+void ktimer_arm(ktimer_t *timer, unsigned long deadline) {
+    kassert(timer != NULL);
+
+    ktimer_cpu_t *wheel;
+    for (;;) {
+        wheel = _ktimer_lock_this_wheel();
+        if (!timer->armed || timer->cpu == wheel->cpu) break;
+
+        // The timer is in another CPU's wheel. Take it out of there first, only one wheel is ever locked at a time
+        spinlock_release_irq(&wheel->lock);
+
+        ktimer_cpu_t *other = _ktimer_wheel(timer->cpu);
+        spinlock_acquire_irq(&other->lock);
+        if (timer->armed && timer->cpu == other->cpu) _ktimer_remove(other, timer);
+        spinlock_release_irq(&other->lock);
+    }
+
+    if (timer->armed) _ktimer_remove(wheel, timer);
+
+    timer->deadline = deadline;
+    _ktimer_insert(wheel, timer);
+
+    // Only bring the generic timer forward. When called from a timer function the wheel is programmed once it has run
+    if (deadline < wheel->next_event && wheel->running == NULL) _ktimer_program(wheel);
+
+    spinlock_release_irq(&wheel->lock);
+}
+
+bool ktimer_cancel(ktimer_t *timer) {
+    kassert(timer != NULL);
+
+    unsigned int cpu;
+    ktimer_cpu_t *wheel;
+    for (;;) {
+        cpu = timer->cpu;
+        if (cpu == KTIMER_CPU_NONE) return false;
+
+        wheel = _ktimer_wheel(cpu);
+        spinlock_acquire_irq(&wheel->lock);
+
+        // The timer may have been armed on another CPU before the wheel was locked
+        if (timer->cpu == cpu) break;
+        spinlock_release_irq(&wheel->lock);
+    }
+
+    // The generic timer is left alone. If it fires for this timer the wheel simply has nothing to run
+    bool armed = timer->armed;
+    if (armed) _ktimer_remove(wheel, timer);
+    bool local = cpu == arch_cpu_get_id();
+
+    spinlock_release_irq(&wheel->lock);
+
+    // Timer functions run with interrupts disabled so one can only be running on this CPU if it's the caller
+    if (!local) while (wheel->running == timer);
+
+    return armed;
+}
+
+void ktimer_expire(void) {
+    ktimer_cpu_t *wheel = _ktimer_lock_this_wheel();
+
+    _ktimer_run(wheel, ktimer_now());
+    _ktimer_program(wheel);
+
+    spinlock_release_irq(&wheel->lock);
+}
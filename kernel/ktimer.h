@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _KTIMER_H_
+#define _KTIMER_H_
+
+#include <sys/types.h>
+#include <kernel/list.h>
+#include <kernel/spinlock.h>
+#include <kernel/arch/arch_cpu.h>
+#include <kernel/clocksource.h>
+
+/*
+ * ktimer - Kernel timers
+ * A timer calls its function once the system time passes its deadline. Every CPU keeps the timers armed on it in a
+ * hierarchical timing wheel: KTIMER_LEVELS levels of KTIMER_SLOTS slots where each slot on level n covers
+ * KTIMER_SLOTS^n usecs. A timer is hashed into the slot covering its deadline on the lowest level that reaches that
+ * far, so arming and cancelling a timer take constant time no matter how many timers are armed. When the wheel's clock
+ * enters a slot on a higher level the timers in it are cascaded down to the lower levels, which means a timer sits in
+ * the level 0 slot of its exact usec by the time it expires. Each level has a bitmap of its non-empty slots so the
+ * earliest deadline is found without walking the slots.
+ *
+ * There is no periodic tick. The CPU's generic timer is only programmed for the earliest deadline in its wheel. Timer
+ * functions are called from the timer interrupt on the CPU the timer was armed on.
+ */
+
+#define KTIMER_SLOT_BITS (6)
+#define KTIMER_SLOTS     (1 << KTIMER_SLOT_BITS)
+#define KTIMER_LEVELS    (5)
+
+// Deadline that never comes
+#define KTIMER_NONE      (~0UL)
+
+// CPU of a timer that has never been armed
+#define KTIMER_CPU_NONE  (MAX_NUM_CPUS)
+
+struct ktimer_s;
+
+// Called with the expired timer and the argument given to ktimer_setup. The timer may be armed again from here
+typedef void (*ktimer_func_t)(struct ktimer_s *timer, void *arg);
+
+typedef struct ktimer_s {
+    list_node_t ll_node;                         // Wheel slot linkage
+    unsigned long deadline;                      // System time in usecs at which the timer expires
+    ktimer_func_t func;                          // Function to call when the timer expires
+    void *arg;                                   // Argument to pass to func
+    unsigned int cpu;                            // CPU whose wheel the timer was last armed on
+    unsigned int level;                          // Level and slot of the wheel the timer is in
+    unsigned int slot;
+    bool armed;                                  // Set while the timer is in a wheel
+} ktimer_t;
+
+// Timing wheel of a CPU, kept in the CPU's per-CPU data
+typedef struct {
+    spinlock_t lock;                             // Protects the wheel
+    unsigned int cpu;                            // CPU this wheel belongs to
+    unsigned long clk;                           // Time in usecs up to which the wheel has been run
+    unsigned long next_event;                    // Time the generic timer is programmed for or KTIMER_NONE
+    ktimer_t * volatile running;                 // Timer whose function is being called
+    unsigned long pending[KTIMER_LEVELS];        // Bit set for every slot that isn't empty
+    list_t slots[KTIMER_LEVELS][KTIMER_SLOTS];
+} ktimer_cpu_t;
+
+// Initializes the timing wheels of all CPUs
+void ktimer_init(void);
+
+// Sets up a timer to call func with arg when it expires. The timer is not armed
+void ktimer_setup(ktimer_t *timer, ktimer_func_t func, void *arg);
+
+// Arms the timer on the calling CPU to expire at the given system time in usecs. A timer that's already armed is
+// moved to its new deadline. Deadlines in the past expire on the next timer interrupt
+void ktimer_arm(ktimer_t *timer, unsigned long deadline);
+
+// Disarms the timer. If its function is running on another CPU this waits for it to return. Must not be called on a
+// timer from its own function. Returns true if the timer was armed
+bool ktimer_cancel(ktimer_t *timer);
+
+// Runs the functions of all expired timers on the calling CPU and programs the generic timer for the next deadline.
+// Called from the timer interrupt
+void ktimer_expire(void);
+
+// Returns true if the timer is armed
+#define ktimer_is_armed(timer) ((timer)->armed)
+
+// Current system time in usecs, the time base of all deadlines
+#define ktimer_now()           (clocksource_get_usecs())
+
+#endif // _KTIMER_H_
@@ -62,7 +62,10 @@ bool lock_try_acquire_exclusive(lock_t *lock) {
 
     spinlock_acquire_irq(&lock->interlock);
 
-    if (lock->state != LOCK_STATE_FREE) return false;
+    if (lock->state != LOCK_STATE_FREE) {
+        spinlock_release_irq(&lock->interlock);
+        return false;
+    }
 
     lock->thread = proc_thread_current();
     lock->state = LOCK_STATE_EXCLUSIVE;
@@ -80,6 +83,7 @@ bool lock_try_acquire_shared(lock_t *lock) {
     if (lock->state == LOCK_STATE_EXCLUSIVE
         || (lock->state == LOCK_STATE_EXCLUSIVE_UPGRADE
         && proc_scheduler_deserve(lock->thread, proc_thread_current()))) {
+        spinlock_release_irq(&lock->interlock);
         return false;
     }
 
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <kernel/lz4.h>
+
+#define LZ4_MIN_MATCH       (4)
+#define LZ4_LAST_LITERALS   (5)
+#define LZ4_MF_LIMIT        (12)
+#define LZ4_MAX_OFFSET      (0xffff)
+#define LZ4_RUN_MASK        (0xf)
+
+#define LZ4_HASH(v)         (((uint32_t)(v) * 2654435761u) >> (32 - LZ4_HASH_BITS))
+
+static inline uint32_t _lz4_read32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Writes the extra length bytes for literal and match lengths that don't fit in the token
+static inline uint8_t* _lz4_write_length(uint8_t *op, size_t len) {
+    for (; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// Reads the extra length bytes following a token. Returns NULL if the input ends prematurely
+static inline const uint8_t* _lz4_read_length(const uint8_t *ip, const uint8_t *iend, size_t *len) {
+    uint8_t b;
+    do {
+        if (ip >= iend) return NULL;
+        b = *ip++;
+        *len += b;
+    } while (b == 255);
+    return ip;
+}
+
+// Worst case number of bytes needed to emit a sequence with the given literal and match lengths
+static inline size_t _lz4_sequence_size(size_t literal_len, size_t match_len) {
+    return 1 + (literal_len / 255) + 1 + literal_len + 2 + (match_len / 255) + 1;
+}
+
+size_t lz4_compress(const void *src, size_t src_size, void *dst, size_t dst_capacity, uint16_t *hash_table) {
+    if (src_size > LZ4_MAX_INPUT_SIZE) return 0;
+
+    const uint8_t *base = (const uint8_t*)src, *ip = base, *anchor = base, *iend = base + src_size;
+    const uint8_t *mflimit = iend - LZ4_MF_LIMIT, *matchlimit = iend - LZ4_LAST_LITERALS;
+    uint8_t *op = (uint8_t*)dst, *oend = op + dst_capacity;
+
+    for (unsigned long i = 0; i < (1 << LZ4_HASH_BITS); i++) hash_table[i] = 0;
+
+    // Inputs too small to hold a match are emitted as a single literal run
+    while (src_size > LZ4_MF_LIMIT && ip < mflimit) {
+        uint32_t seq = _lz4_read32(ip);
+        uint32_t h = LZ4_HASH(seq);
+        const uint8_t *ref = base + hash_table[h];
+        hash_table[h] = (uint16_t)(ip - base);
+
+        // The hash table may hold stale or colliding positions so always verify the match
+        if (ref >= ip || (size_t)(ip - ref) > LZ4_MAX_OFFSET || _lz4_read32(ref) != seq) {
+            ip++;
+            continue;
+        }
+
+        // Extend the match backwards into the pending literals and then forwards as far as possible
+        while (ip > anchor && ref > base && ip[-1] == ref[-1]) ip--, ref--;
+
+        size_t match_len = LZ4_MIN_MATCH;
+        while (ip + match_len < matchlimit && ip[match_len] == ref[match_len]) match_len++;
+
+        size_t literal_len = ip - anchor;
+        if (_lz4_sequence_size(literal_len, match_len) > (size_t)(oend - op)) return 0;
+
+        // Emit the token, the literals, the offset and the match length
+        uint8_t *token = op++;
+        if (literal_len >= LZ4_RUN_MASK) {
+            *token = LZ4_RUN_MASK << 4;
+            op = _lz4_write_length(op, literal_len - LZ4_RUN_MASK);
+        } else {
+            *token = (uint8_t)(literal_len << 4);
+        }
+
+        for (size_t i = 0; i < literal_len; i++) *op++ = anchor[i];
+
+        size_t offset = ip - ref;
+        *op++ = (uint8_t)(offset & 0xff);
+        *op++ = (uint8_t)(offset >> 8);
+
+        size_t len = match_len - LZ4_MIN_MATCH;
+        if (len >= LZ4_RUN_MASK) {
+            *token |= LZ4_RUN_MASK;
+            op = _lz4_write_length(op, len - LZ4_RUN_MASK);
+        } else {
+            *token |= (uint8_t)len;
+        }
+
+        ip += match_len;
+        anchor = ip;
+    }
+
+    // The last sequence is literals only
+    size_t literal_len = iend - anchor;
+    if (1 + (literal_len / 255) + 1 + literal_len > (size_t)(oend - op)) return 0;
+
+    if (literal_len >= LZ4_RUN_MASK) {
+        *op++ = LZ4_RUN_MASK << 4;
+        op = _lz4_write_length(op, literal_len - LZ4_RUN_MASK);
+    } else {
+        *op++ = (uint8_t)(literal_len << 4);
+    }
+
+    for (size_t i = 0; i < literal_len; i++) *op++ = anchor[i];
+
+    return op - (uint8_t*)dst;
+}
+
+size_t lz4_decompress(const void *src, size_t src_size, void *dst, size_t dst_capacity) {
+    const uint8_t *ip = (const uint8_t*)src, *iend = ip + src_size;
+    uint8_t *op = (uint8_t*)dst, *oend = op + dst_capacity;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        // Copy the literals
+        size_t literal_len = token >> 4;
+        if (literal_len == LZ4_RUN_MASK && (ip = _lz4_read_length(ip, iend, &literal_len)) == NULL) return 0;
+        if (literal_len > (size_t)(iend - ip) || literal_len > (size_t)(oend - op)) return 0;
+
+        for (size_t i = 0; i < literal_len; i++) *op++ = *ip++;
+
+        // The last sequence has no match
+        if (ip == iend) break;
+
+        if (iend - ip < 2) return 0;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+
+        if (offset == 0 || offset > (size_t)(op - (uint8_t*)dst)) return 0;
+
+        // Copy the match one byte at a time since the source and destination may overlap
+        size_t match_len = token & LZ4_RUN_MASK;
+        if (match_len == LZ4_RUN_MASK && (ip = _lz4_read_length(ip, iend, &match_len)) == NULL) return 0;
+        match_len += LZ4_MIN_MATCH;
+        if (match_len > (size_t)(oend - op)) return 0;
+
+        const uint8_t *ref = op - offset;
+        for (size_t i = 0; i < match_len; i++) *op++ = *ref++;
+    }
+
+    return op - (uint8_t*)dst;
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _LZ4_H_
+#define _LZ4_H_
+
+#include <sys/types.h>
+
+/*
+ * lz4 - LZ4 block format compression
+ * A small, single-pass greedy compressor and a bounds-checked decompressor for the LZ4 block format. Inputs are limited
+ * to LZ4_MAX_INPUT_SIZE so that match positions fit in the 16-bit hash table provided by the caller.
+ */
+
+#define LZ4_MAX_INPUT_SIZE  (0x10000)
+#define LZ4_HASH_BITS       (12)
+#define LZ4_HASH_TABLE_SIZE ((1 << LZ4_HASH_BITS) * sizeof(uint16_t))
+
+// Compresses src_size bytes from src into dst. The hash_table must point to LZ4_HASH_TABLE_SIZE bytes of scratch
+// memory. Returns the compressed size or 0 if the compressed data would not fit in dst_capacity bytes
+size_t lz4_compress(const void *src, size_t src_size, void *dst, size_t dst_capacity, uint16_t *hash_table);
+
+// Decompresses src_size bytes of LZ4 block data from src into dst. Returns the decompressed size or 0 if the data is
+// malformed or does not fit in dst_capacity bytes
+size_t lz4_decompress(const void *src, size_t src_size, void *dst, size_t dst_capacity);
+
+#endif // _LZ4_H_
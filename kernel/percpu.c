@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <kernel/kassert.h>
+#include <kernel/percpu.h>
+
+percpu_t percpu[MAX_NUM_CPUS];
+
+void percpu_init(void) {
+    unsigned long cpu = arch_cpu_get_id();
+    kassert(cpu < MAX_NUM_CPUS);
+
+    percpu[cpu].cpu_id = cpu;
+    arch_cpu_set_local(&percpu[cpu]);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _PERCPU_H_
+#define _PERCPU_H_
+
+#include <sys/types.h>
+#include <kernel/kstdio.h>
+#include <kernel/ktimer.h>
+#include <kernel/arch/arch_cpu.h>
+#include <kernel/proc/proc_scheduler.h>
+
+/*
+ * percpu - Per-CPU data
+ * Every CPU has its own block of data for the state it uses the most, e.g. the current thread and the scheduler's
+ * per-CPU state. The blocks are aligned to a cache line so CPUs never share one. Each CPU keeps a pointer to its own
+ * block in a system register (TPIDR_EL1) so finding it doesn't involve reading the CPU ID and indexing a global array.
+ *
+ * A thread can be preempted and moved to another CPU at any time so the block returned by this_cpu() only stays the
+ * calling CPU's while interrupts are disabled. The current thread is the exception, it can be read at any time.
+ */
+
+struct proc_thread_s;
+
+typedef struct {
+    struct proc_thread_s *current_thread;    // Thread running on this CPU. Must be the first field, see percpu_current
+    unsigned long cpu_id;                    // ID of the CPU this block belongs to
+    proc_scheduler_cpu_t sched;              // Scheduler state for this CPU
+    ktimer_cpu_t ktimer;                     // Timing wheel of the timers armed on this CPU
+    char kstdio_buffer[KSTDIO_BUFFER_SIZE];  // kprintf formatting buffer
+} __attribute__((aligned(CACHE_LINE_SIZE))) percpu_t;
+
+extern percpu_t percpu[MAX_NUM_CPUS];
+
+// Points this CPU at its per-CPU data. Must be called on every CPU once its MMU is on and before any per-CPU data is
+// used. Until then percpu_current returns NULL
+void percpu_init(void);
+
+// Returns the calling CPU's per-CPU data
+#define this_cpu()          ((percpu_t*)arch_cpu_get_local())
+
+// Returns the per-CPU data of the given CPU
+#define per_cpu_ptr(cpu)    (&percpu[(cpu)])
+
+// Returns the thread running on this CPU
+#define percpu_current()    ((struct proc_thread_s*)arch_cpu_load_local_ptr())
+
+#endif // _PERCPU_H_
@@ -5,26 +5,77 @@
  */
 
 #include <kernel/kassert.h>
+#include <kernel/clocksource.h>
 #include <kernel/rbtree.h>
 #include <kernel/spinlock.h>
-#include <kernel/arch/arch_timer.h>
+#include <kernel/irq.h>
+#include <kernel/percpu.h>
+#include <kernel/arch/arch_barrier.h>
+#include <kernel/arch/arch_cpu.h>
 #include <kernel/proc/proc_task.h>
 #include <kernel/proc/proc_thread.h>
 #include <kernel/proc/proc_scheduler.h>
 
-#define PROC_SCHEDULER_QUANTUM_US (10000)
+// How often each CPU looks for a busier CPU to pull threads from
+#define PROC_SCHEDULER_BALANCE_INTERVAL_US (40000)
+
+// Maximum # of threads pulled by one load balance
+#define PROC_SCHEDULER_BALANCE_MAX_PULL (4)
+
+// Real-time threads may run for at most RT_RUNTIME out of every RT_PERIOD on each CPU
+#define PROC_SCHEDULER_RT_PERIOD_US        (1000000)
+#define PROC_SCHEDULER_RT_RUNTIME_US       (950000)
+
+// Time slice of round-robin threads
+#define PROC_SCHEDULER_RR_TIMESLICE_US     (100000)
 
 typedef struct {
-    spinlock_t lock;            // Simple non-preemptive lock
-    rbtree_t rb_threads;        // Thread tree keyed of virtual_runtime
-    size_t num_threads;         // Number of threads currently in the tree
-    unsigned long min_vruntime; // Track the current smallest vruntime in the tree
-    unsigned long exec_start;   // The time when a thread was scheduled for execution
-    unsigned long quantum;      // How long to run the current thread before deciding to switch threads
+    unsigned long rt_period;        // Real-time budget period
+    unsigned long rt_runtime;       // Real-time budget per period
+    unsigned long rr_timeslice;     // Time slice of round-robin threads
 } proc_scheduler_t;
 
 proc_scheduler_t proc_scheduler;
 
+// Weight of each nice level. Each level is 1.25 times heavier than the next one so a thread that goes up or down one
+// level loses or gains about 10% of the CPU time relative to a thread that didn't
+const unsigned long proc_scheduler_nice_to_weight[PROC_SCHEDULER_NICE_MAX - PROC_SCHEDULER_NICE_MIN + 1] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548,  7620,  6100,  4904,  3906,
+    /*  -5 */ 3121,  2501,  1991,  1586,  1277,
+    /*   0 */ 1024,  820,   655,   526,   423,
+    /*   5 */ 335,   272,   215,   172,   137,
+    /*  10 */ 110,   87,    70,    56,    45,
+    /*  15 */ 36,    29,    23,    18,    15,
+};
+
+// 2^32 divided by each weight above
+const unsigned long proc_scheduler_nice_to_inv_weight[PROC_SCHEDULER_NICE_MAX - PROC_SCHEDULER_NICE_MIN + 1] = {
+    /* -20 */ 48388,     59856,     76040,     92818,     118348,
+    /* -15 */ 147320,    184698,    229616,    287308,    360437,
+    /* -10 */ 449829,    563644,    704093,    875809,    1099582,
+    /*  -5 */ 1376151,   1717300,   2157191,   2708050,   3363326,
+    /*   0 */ 4194304,   5237765,   6557202,   8165337,   10153587,
+    /*   5 */ 12820798,  15790321,  19976592,  24970740,  31350126,
+    /*  10 */ 39045157,  49367440,  61356676,  76695844,  95443717,
+    /*  15 */ 119304647, 148102320, 186737708, 238609294, 286331153,
+};
+
+#define _proc_scheduler_rq(cpu)              (&per_cpu_ptr(cpu)->sched)
+#define _proc_scheduler_rq_is_online(rq)     ((rq)->idle != NULL)
+#define _proc_scheduler_allowed(thread, cpu) (((thread)->sched.affinity & PROC_SCHEDULER_CPUMASK(cpu)) != 0)
+#define _proc_scheduler_context(node)        rbtree_entry(node, proc_scheduler_context_t, rb_node)
+#define _proc_scheduler_thread(node)         rbtree_entry(_proc_scheduler_context(node), proc_thread_t, sched)
+#define _proc_scheduler_rt_thread(node)      list_entry(node, proc_thread_t, sched.ll_rt_node)
+#define _proc_scheduler_min(a, b)            (((a) < (b)) ? (a) : (b))
+
+// The running thread counts towards the average vruntime while it's a fair thread that isn't back in the tree. A
+// thread going to sleep is SLEEPING before it's switched out and counts until it's taken off the run queue
+#define _proc_scheduler_curr_is_fair(rq)\
+    ((rq)->curr != NULL && (rq)->curr != (rq)->idle && !proc_scheduler_is_rt((rq)->curr) &&\
+    ((rq)->curr->state == PROC_THREAD_STATE_RUNNING || (rq)->curr->state == PROC_THREAD_STATE_SLEEPING))
+
 rbtree_compare_result_t _proc_scheduler_compare(rbtree_node_t *n1, rbtree_node_t *n2) {
     proc_scheduler_context_t *t1 = rbtree_entry(n1, proc_scheduler_context_t, rb_node);
     proc_scheduler_context_t *t2 = rbtree_entry(n2, proc_scheduler_context_t, rb_node);
@@ -32,119 +83,1026 @@ rbtree_compare_result_t _proc_scheduler_compare(rbtree_node_t *n1, rbtree_node_t
     return (t1->vruntime >= t2->vruntime) ? RBTREE_COMPARE_GT : RBTREE_COMPARE_LT;
 }
 
-proc_thread_t* _proc_scheduler_choose(void) {
-    proc_thread_t *thread = NULL;
+// Keeps the earliest deadline of each subtree in its root
+void _proc_scheduler_augment(rbtree_node_t *node) {
+    proc_scheduler_context_t *sched = _proc_scheduler_context(node);
+    unsigned long min_deadline = sched->deadline;
+
+    rbtree_node_t *left = rbtree_left(node), *right = rbtree_right(node);
+    if (left != NULL) min_deadline = _proc_scheduler_min(min_deadline, _proc_scheduler_context(left)->min_deadline);
+    if (right != NULL) min_deadline = _proc_scheduler_min(min_deadline, _proc_scheduler_context(right)->min_deadline);
+
+    sched->min_deadline = min_deadline;
+}
+
+// Locks the run queue of the CPU we're running on. The CPU may change until interrupts are disabled so check that the
+// locked run queue is still ours
+proc_scheduler_cpu_t* _proc_scheduler_lock_this_rq(void) {
+    for (;;) {
+        proc_scheduler_cpu_t *rq = &this_cpu()->sched;
+        spinlock_acquire_irq(&rq->lock);
+        if (rq == &this_cpu()->sched) return rq;
+        spinlock_release_irq(&rq->lock);
+    }
+}
+
+// Locks another CPU's run queue while holding the lock of rq. CPUs only ever wait for the run queue lock of a higher
+// numbered CPU so two CPUs locking each other's run queues can't deadlock. Returns false if the lock wasn't acquired
+bool _proc_scheduler_lock_other(proc_scheduler_cpu_t *rq, proc_scheduler_cpu_t *other) {
+    if (other->cpu > rq->cpu) {
+        spinlock_acquire(&other->lock);
+        return true;
+    }
+
+    return spinlock_acquire_try(&other->lock);
+}
+
+// Scales the time a thread ran for by NICE_0_WEIGHT / weight to get how much its vruntime advances
+unsigned long _proc_scheduler_scale_runtime(proc_thread_t *thread, unsigned long delta) {
+    if (thread->sched.weight == PROC_SCHEDULER_NICE_0_WEIGHT) return delta;
+    return (unsigned long)(((unsigned __int128)delta * PROC_SCHEDULER_NICE_0_WEIGHT * thread->sched.inv_weight) >> 32);
+}
+
+// Counts a runnable thread in the run queue's load. A thread's weight may change while it's queued so remember the
+// weight it added. Real-time threads don't take part in the fair share
+void _proc_scheduler_load_add(proc_scheduler_cpu_t *rq, proc_thread_t *thread) {
+    thread->sched.load = proc_scheduler_is_rt(thread) ? 0 : thread->sched.weight;
+    rq->load_weight += thread->sched.load;
+    rq->num_threads++;
+}
+
+void _proc_scheduler_load_sub(proc_scheduler_cpu_t *rq, proc_thread_t *thread) {
+    rq->load_weight -= thread->sched.load;
+    rq->num_threads--;
+}
+
+// Virtual deadline of a request made by the thread at its current vruntime
+unsigned long _proc_scheduler_deadline(proc_thread_t *thread) {
+    return thread->sched.vruntime + _proc_scheduler_scale_runtime(thread, thread->sched.slice);
+}
+
+// How long the thread may run once it's picked. A fair thread runs until the virtual deadline of its request, converted
+// back to real time. Real-time threads aren't time sliced against fair threads, round-robin threads only run to the
+// end of their own time slice
+unsigned long _proc_scheduler_slice(proc_scheduler_cpu_t *rq, proc_thread_t *thread) {
+    if (thread == rq->idle) return PROC_SCHEDULER_SLICE_DEFAULT_US;
+
+    if (proc_scheduler_is_rt(thread))
+        return (thread->sched.policy == PROC_SCHEDULER_POLICY_RR) ? thread->sched.rr_left : proc_scheduler.rt_runtime;
+
+    unsigned long vleft = (thread->sched.deadline > thread->sched.vruntime) ?
+        thread->sched.deadline - thread->sched.vruntime : 0;
+    unsigned long slice = vleft * thread->sched.weight / PROC_SCHEDULER_NICE_0_WEIGHT;
+
+    return (slice > PROC_SCHEDULER_SLICE_MIN_US) ? slice : PROC_SCHEDULER_SLICE_MIN_US;
+}
+
+// Gets sum((v - min_vruntime) * w) and sum(w) over the fair threads on the run queue, the running thread included.
+// The vruntimes are taken relative to min_vruntime so the sum doesn't overflow
+void _proc_scheduler_avg_sums(proc_scheduler_cpu_t *rq, long *avg, long *load) {
+    *avg = rq->avg_vruntime;
+    *load = (long)rq->avg_load;
+
+    if (_proc_scheduler_curr_is_fair(rq)) {
+        *avg += (long)(rq->curr->sched.vruntime - rq->min_vruntime) * (long)rq->curr->sched.weight;
+        *load += (long)rq->curr->sched.weight;
+    }
+}
+
+// Returns the weighted average vruntime of the fair threads on the run queue, V = sum(v * w) / sum(w)
+unsigned long _proc_scheduler_avg_vruntime(proc_scheduler_cpu_t *rq) {
+    long avg, load;
+    _proc_scheduler_avg_sums(rq, &avg, &load);
+
+    if (load == 0) return rq->min_vruntime;
+
+    // Round towards negative infinity so a thread right at the average is eligible
+    if (avg < 0) avg -= load - 1;
+
+    return rq->min_vruntime + avg / load;
+}
+
+// A thread is eligible if its lag is at least 0, i.e. its vruntime is at or below the average. Compares the sums
+// rather than dividing so no precision is lost
+bool _proc_scheduler_eligible(proc_scheduler_cpu_t *rq, proc_thread_t *thread) {
+    long avg, load;
+    _proc_scheduler_avg_sums(rq, &avg, &load);
+
+    return avg >= (long)(thread->sched.vruntime - rq->min_vruntime) * load;
+}
+
+// Returns the thread's lag on the run queue. It's bounded by a couple of requests so a thread can neither bank nor owe
+// much more than it could use up or pay back in one go
+long _proc_scheduler_lag(proc_scheduler_cpu_t *rq, proc_thread_t *thread) {
+    long limit = (long)_proc_scheduler_scale_runtime(thread, 2 * thread->sched.slice);
+    long vlag = (long)(_proc_scheduler_avg_vruntime(rq) - thread->sched.vruntime);
+
+    if (vlag > limit) return limit;
+    if (vlag < -limit) return -limit;
+    return vlag;
+}
+
+// Places a fair thread about to be queued on rq so that it has the given lag once it's queued and starts a new
+// request. Adding the thread pulls the average towards it so its lag is scaled up to make up for that. rq must be
+// locked and the thread must not be in the average yet
+void _proc_scheduler_place(proc_scheduler_cpu_t *rq, proc_thread_t *thread, long vlag) {
+    unsigned long load = rq->avg_load;
+    if (_proc_scheduler_curr_is_fair(rq)) load += rq->curr->sched.weight;
+
+    if (load != 0) vlag = vlag * (long)(load + thread->sched.weight) / (long)load;
+
+    thread->sched.vruntime = _proc_scheduler_avg_vruntime(rq) - vlag;
+    thread->sched.deadline = _proc_scheduler_deadline(thread);
+}
+
+// Moves min_vruntime up to the smallest vruntime among the threads in the tree and the running thread if it's a fair
+// thread. It never goes back, the sum of the average is rebased on the new value
+void _proc_scheduler_update_min_vruntime(proc_scheduler_cpu_t *rq) {
+    proc_thread_t *curr = _proc_scheduler_curr_is_fair(rq) ? rq->curr : NULL;
+    rbtree_node_t *node = rbtree_min(&rq->rb_threads);
+    if (node == NULL && curr == NULL) return;
+
+    unsigned long min_vruntime;
+    if (node == NULL) min_vruntime = curr->sched.vruntime;
+    else if (curr == NULL) min_vruntime = _proc_scheduler_context(node)->vruntime;
+    else min_vruntime = _proc_scheduler_min(curr->sched.vruntime, _proc_scheduler_context(node)->vruntime);
+
+    if (min_vruntime <= rq->min_vruntime) return;
+
+    rq->avg_vruntime -= (long)(min_vruntime - rq->min_vruntime) * (long)rq->avg_load;
+    rq->min_vruntime = min_vruntime;
+}
+
+// Queues a runnable thread. Fair threads go in the tree and are added to the average vruntime, real-time threads go
+// at the back of the list of their priority or at the front if head is set
+void _proc_scheduler_enqueue_at(proc_scheduler_cpu_t *rq, proc_thread_t *thread, bool head) {
+    thread->state = PROC_THREAD_STATE_RUNNABLE;
+    thread->sched.cpu = rq->cpu;
+
+    if (!proc_scheduler_is_rt(thread)) {
+        rq->avg_vruntime += (long)(thread->sched.vruntime - rq->min_vruntime) * (long)thread->sched.weight;
+        rq->avg_load += thread->sched.weight;
+        kassert(rbtree_insert(&rq->rb_threads, _proc_scheduler_compare, &thread->sched.rb_node));
+        return;
+    }
+
+    unsigned int prio = thread->sched.rt_priority;
+    list_t *queue = &rq->rt.queues[prio];
+
+    if (head) kassert(list_insert_first(queue, &thread->sched.ll_rt_node));
+    else kassert(list_insert_last(queue, &thread->sched.ll_rt_node));
+
+    rq->rt.bitmap[prio / 64] |= 1UL << (prio % 64);
+    rq->rt.nr_queued++;
+}
+
+#define _proc_scheduler_enqueue(rq, thread) _proc_scheduler_enqueue_at(rq, thread, false)
+
+void _proc_scheduler_dequeue(proc_scheduler_cpu_t *rq, proc_thread_t *thread) {
+    if (!proc_scheduler_is_rt(thread)) {
+        kassert(rbtree_remove(&rq->rb_threads, &thread->sched.rb_node));
+        rq->avg_vruntime -= (long)(thread->sched.vruntime - rq->min_vruntime) * (long)thread->sched.weight;
+        rq->avg_load -= thread->sched.weight;
+        return;
+    }
+
+    unsigned int prio = thread->sched.rt_priority;
+    list_t *queue = &rq->rt.queues[prio];
+
+    kassert(list_remove(queue, &thread->sched.ll_rt_node));
+    if (list_is_empty(queue)) rq->rt.bitmap[prio / 64] &= ~(1UL << (prio % 64));
+    rq->rt.nr_queued--;
+}
+
+// Charges the running thread for the time since it was picked. Fair threads advance their vruntime and make a new
+// request once they're past the deadline of the last one, real-time threads use up the CPU's real-time budget and
+// their round-robin time slice
+void _proc_scheduler_update_curr(proc_scheduler_cpu_t *rq, proc_thread_t *thread, unsigned long now) {
+    unsigned long delta = now - rq->exec_start;
+
+    if (!proc_scheduler_is_rt(thread)) {
+        thread->sched.vruntime += _proc_scheduler_scale_runtime(thread, delta);
+        if (thread->sched.vruntime >= thread->sched.deadline) thread->sched.deadline = _proc_scheduler_deadline(thread);
+        return;
+    }
+
+    rq->rt.runtime += delta;
+    if (thread->sched.policy == PROC_SCHEDULER_POLICY_RR)
+        thread->sched.rr_left = (delta < thread->sched.rr_left) ? thread->sched.rr_left - delta : 0;
+}
+
+// Takes the running thread off the run queue as it goes to sleep. It's charged for the time it ran and its lag is
+// remembered while it still counts towards the average. There is no running thread until the next one is picked. rq
+// must be locked
+void _proc_scheduler_sleep_curr(proc_scheduler_cpu_t *rq, proc_thread_t *thread, unsigned long now) {
+    _proc_scheduler_load_sub(rq, thread);
+    _proc_scheduler_update_curr(rq, thread, now);
+    if (!proc_scheduler_is_rt(thread)) thread->sched.vlag = _proc_scheduler_lag(rq, thread);
+    rq->curr = NULL;
+}
+
+// Starts a new real-time period once the current one is over and throttles the real-time threads once they've used up
+// the budget of the current period
+void _proc_scheduler_rt_update(proc_scheduler_cpu_t *rq, unsigned long now) {
+    if (now - rq->rt.period_start >= proc_scheduler.rt_period) {
+        rq->rt.period_start = now;
+        rq->rt.runtime = 0;
+        rq->rt.throttled = false;
+    }
+
+    if (!rq->rt.throttled && rq->rt.runtime >= proc_scheduler.rt_runtime) {
+        rq->rt.throttled = true;
+        rq->stats.nr_rt_throttled++;
+    }
+}
+
+// Moves a queued thread from src to dst. Both run queues must be locked. A fair thread keeps its lag so it neither
+// jumps ahead of nor falls behind the threads already on dst
+void _proc_scheduler_migrate(proc_scheduler_cpu_t *src, proc_scheduler_cpu_t *dst, proc_thread_t *thread) {
+    bool fair = !proc_scheduler_is_rt(thread);
+    long vlag = fair ? _proc_scheduler_lag(src, thread) : 0;
+
+    _proc_scheduler_dequeue(src, thread);
+    _proc_scheduler_load_sub(src, thread);
+
+    if (fair) _proc_scheduler_place(dst, thread, vlag);
+
+    thread->sched.nr_migrations++;
+
+    _proc_scheduler_enqueue(dst, thread);
+    _proc_scheduler_load_add(dst, thread);
+    dst->stats.nr_migrations++;
+}
+
+// Compares run queues by the summed weight of their threads. Real-time threads don't add weight so the # of threads
+// breaks ties
+bool _proc_scheduler_rq_is_lighter(proc_scheduler_cpu_t *rq, proc_scheduler_cpu_t *other) {
+    if (rq->load_weight != other->load_weight) return rq->load_weight < other->load_weight;
+    return rq->num_threads < other->num_threads;
+}
+
+// Finds the least loaded online CPU the thread may run on, preferring idle CPUs and then the CPU the thread last ran
+// on. Falls back to the calling CPU if the thread may not run on any online CPU
+unsigned int _proc_scheduler_select_cpu(proc_thread_t *thread) {
+    unsigned int prev = thread->sched.cpu, best = PROC_SCHEDULER_CPU_NONE;
+
+    // The run queues are read without their locks, this is only a hint
+    if (prev != PROC_SCHEDULER_CPU_NONE && _proc_scheduler_allowed(thread, prev)) {
+        proc_scheduler_cpu_t *rq = _proc_scheduler_rq(prev);
+        if (_proc_scheduler_rq_is_online(rq)) {
+            if (rq->curr == rq->idle) return prev;
+            best = prev;
+        }
+    }
+
+    for (unsigned int cpu = 0; cpu < MAX_NUM_CPUS; cpu++) {
+        proc_scheduler_cpu_t *rq = _proc_scheduler_rq(cpu);
+        if (!_proc_scheduler_rq_is_online(rq) || !_proc_scheduler_allowed(thread, cpu)) continue;
+        if (rq->curr == rq->idle) return cpu;
+        if (best == PROC_SCHEDULER_CPU_NONE || _proc_scheduler_rq_is_lighter(rq, _proc_scheduler_rq(best))) best = cpu;
+    }
+
+    return (best != PROC_SCHEDULER_CPU_NONE) ? best : arch_cpu_get_id();
+}
+
+// Finds the online CPU with the most load that has more load than rq and a queued thread that could be moved
+proc_scheduler_cpu_t* _proc_scheduler_find_busiest(proc_scheduler_cpu_t *rq) {
+    proc_scheduler_cpu_t *busiest = NULL;
+    unsigned long max = rq->load_weight;
+
+    for (unsigned int cpu = 0; cpu < MAX_NUM_CPUS; cpu++) {
+        proc_scheduler_cpu_t *other = _proc_scheduler_rq(cpu);
+        if (other == rq || !_proc_scheduler_rq_is_online(other) || other->num_threads < 2) continue;
+
+        if (other->load_weight > max) {
+            busiest = other;
+            max = other->load_weight;
+        }
+    }
+
+    return busiest;
+}
+
+// Pulls up to max threads from the busiest CPU to even out the load. rq must be locked. Returns the # of threads pulled
+unsigned int _proc_scheduler_pull(proc_scheduler_cpu_t *rq, unsigned int max) {
+    proc_scheduler_cpu_t *busiest = _proc_scheduler_find_busiest(rq);
+    if (busiest == NULL || !_proc_scheduler_lock_other(rq, busiest)) return 0;
+
+    // Moving a thread only evens out the load if its weight is less than the difference in load between the CPUs,
+    // otherwise the imbalance just flips around. Stop once there is no difference left
+    unsigned int pulled = 0;
+
+    // Take threads from the right of the tree, they have waited the least and are least likely to run soon
+    rbtree_node_t *node = rbtree_max(&busiest->rb_threads);
+    while (node != NULL && pulled < max && busiest->load_weight > rq->load_weight) {
+        proc_thread_t *thread = _proc_scheduler_thread(node);
+        node = rbtree_node_predecessor(node);
+
+        if (!_proc_scheduler_allowed(thread, rq->cpu) || thread->sched.on_cpu) continue;
+        if (thread->sched.load >= busiest->load_weight - rq->load_weight) continue;
+
+        _proc_scheduler_migrate(busiest, rq, thread);
+        pulled++;
+    }
+
+    spinlock_release(&busiest->lock);
+
+    return pulled;
+}
+
+// Moves a queued thread to a CPU it may run on if it may no longer run on this CPU. rq must be locked
+void _proc_scheduler_push(proc_scheduler_cpu_t *rq, proc_thread_t *thread) {
+    // The thread that was just put back in the queue is still running until this CPU switches away from it
+    if (_proc_scheduler_allowed(thread, rq->cpu) || thread->sched.on_cpu) return;
+
+    unsigned int cpu = _proc_scheduler_select_cpu(thread);
+    proc_scheduler_cpu_t *dst = _proc_scheduler_rq(cpu);
+
+    // Try again on the next balance if the other run queue is busy
+    if (dst == rq || !_proc_scheduler_lock_other(rq, dst)) return;
+    _proc_scheduler_migrate(rq, dst, thread);
+    spinlock_release(&dst->lock);
+}
+
+// Moves queued threads that may no longer run on this CPU to a CPU they may run on. rq must be locked
+void _proc_scheduler_push_disallowed(proc_scheduler_cpu_t *rq) {
+    rbtree_node_t *node = rbtree_min(&rq->rb_threads);
+    while (node != NULL) {
+        proc_thread_t *thread = _proc_scheduler_thread(node);
+        node = rbtree_node_successor(node);
+        _proc_scheduler_push(rq, thread);
+    }
+
+    for (unsigned int prio = 0; prio < PROC_SCHEDULER_RT_PRIO_LEVELS && rq->rt.nr_queued > 0; prio++) {
+        list_node_t *rt_node = list_first(&rq->rt.queues[prio]);
+        while (rt_node != NULL) {
+            proc_thread_t *thread = _proc_scheduler_rt_thread(rt_node);
+            rt_node = list_next(rt_node);
+            _proc_scheduler_push(rq, thread);
+        }
+    }
+}
+
+// Idle CPUs have no tick so they don't balance on their own. Kick one of them if threads are waiting on rq, it will
+// try to pull from the busiest CPU as soon as it wakes up
+void _proc_scheduler_kick_idle(proc_scheduler_cpu_t *rq) {
+    if (rq->num_threads < 2) return;
+
+    // The run queues are read without their locks, this is only a hint
+    for (unsigned int cpu = 0; cpu < MAX_NUM_CPUS; cpu++) {
+        proc_scheduler_cpu_t *other = _proc_scheduler_rq(cpu);
+        if (other == rq || !_proc_scheduler_rq_is_online(other) || other->curr != other->idle) continue;
+
+        irq_send_ipi(cpu);
+        return;
+    }
+}
+
+void _proc_scheduler_balance(proc_scheduler_cpu_t *rq, unsigned long now) {
+    if (now < rq->next_balance) return;
+
+    rq->next_balance = now + PROC_SCHEDULER_BALANCE_INTERVAL_US;
+
+    _proc_scheduler_push_disallowed(rq);
+    rq->stats.nr_balance_pulls += _proc_scheduler_pull(rq, PROC_SCHEDULER_BALANCE_MAX_PULL);
+    _proc_scheduler_kick_idle(rq);
+}
+
+// There is nothing to do when the tick fires, the timer interrupt calls into the scheduler once its timers have run
+void _proc_scheduler_tick(ktimer_t *timer, void *arg) {
+}
+
+// Arms this CPU's tick for the next time the scheduler needs to run. A thread only needs to be preempted at the end of
+// its slice if other threads are waiting, otherwise the tick is only needed for load balancing. A real-time thread is
+// also stopped once it uses up the real-time budget and throttled real-time threads are picked up again when the
+// period ends. Otherwise the idle thread doesn't need a tick at all. rq must be this CPU's run queue and must be locked
+void _proc_scheduler_program_tick(proc_scheduler_cpu_t *rq) {
+    bool rt_waiting = rq->rt.nr_queued > 0;
+    bool waiting = !rbtree_is_empty(&rq->rb_threads) || (rt_waiting && !rq->rt.throttled);
+    unsigned long deadline = KTIMER_NONE;
+
+    if (rt_waiting && rq->rt.throttled) deadline = rq->rt.period_start + proc_scheduler.rt_period;
+
+    if (rq->curr == rq->idle) {
+        if (waiting) deadline = ktimer_now();
+    } else {
+        deadline = _proc_scheduler_min(deadline, rq->next_balance);
+        if (waiting) deadline = _proc_scheduler_min(deadline, rq->exec_start + rq->slice);
+
+        if (proc_scheduler_is_rt(rq->curr)) {
+            unsigned long left = (rq->rt.runtime < proc_scheduler.rt_runtime) ?
+                proc_scheduler.rt_runtime - rq->rt.runtime : 0;
+            deadline = _proc_scheduler_min(deadline, rq->exec_start + left);
+        }
+    }
+
+    if (deadline == KTIMER_NONE) {
+        ktimer_cancel(&rq->tick);
+        rq->stats.nr_tick_stops++;
+        return;
+    }
 
-    // Find the thread with lowest vruntime
-    proc_scheduler_context_t *sched = rbtree_entry(rbtree_min(&proc_scheduler.rb_threads),
-        proc_scheduler_context_t, rb_node);
-    thread = rbtree_entry(sched, proc_thread_t, sched);
+    // A deadline that has already passed fires right away
+    ktimer_arm(&rq->tick, deadline);
+}
+
+// Returns true if the thread queued on rq should preempt the running thread right away rather than wait for its
+// slice to end. Real-time threads preempt the idle thread, fair threads and lower priority real-time threads unless
+// they're throttled. A fair thread preempts a fair thread if it's eligible and its request is due first. rq must be
+// locked
+bool _proc_scheduler_preempts(proc_scheduler_cpu_t *rq, proc_thread_t *thread) {
+    if (rq->curr == NULL) return false;
+
+    if (!proc_scheduler_is_rt(thread)) {
+        return _proc_scheduler_curr_is_fair(rq) && thread->sched.deadline < rq->curr->sched.deadline &&
+            _proc_scheduler_eligible(rq, thread);
+    }
+
+    if (rq->rt.throttled) return false;
+    if (rq->curr == rq->idle || !proc_scheduler_is_rt(rq->curr)) return true;
+
+    return thread->sched.rt_priority > rq->curr->sched.rt_priority;
+}
+
+// Makes rq's CPU call into the scheduler as soon as possible. The tick fires right away on this CPU, other CPUs are
+// kicked with an IPI. rq must be locked
+void _proc_scheduler_resched(proc_scheduler_cpu_t *rq) {
+    if (rq->cpu == arch_cpu_get_id()) ktimer_arm(&rq->tick, ktimer_now());
+    else irq_send_ipi(rq->cpu);
+}
+
+// Returns the first thread that may run on this CPU in the highest priority real-time list, NULL if there is none or
+// real-time threads are throttled. The bitmap is scanned from the highest priority down so each word takes a single
+// count leading zeros to find its highest non-empty list
+proc_thread_t* _proc_scheduler_first_rt(proc_scheduler_cpu_t *rq) {
+    if (rq->rt.nr_queued == 0 || rq->rt.throttled) return NULL;
+
+    for (unsigned int word = PROC_SCHEDULER_RT_BITMAP_WORDS; word-- > 0;) {
+        unsigned long bitmap = rq->rt.bitmap[word];
+
+        while (bitmap != 0) {
+            unsigned int bit = 63 - __builtin_clzl(bitmap);
+            list_t *queue = &rq->rt.queues[word * 64 + bit];
+
+            for (list_node_t *node = list_first(queue); node != NULL; node = list_next(node)) {
+                proc_thread_t *thread = _proc_scheduler_rt_thread(node);
+                if (_proc_scheduler_allowed(thread, rq->cpu)) return thread;
+            }
+
+            bitmap &= ~(1UL << bit);
+        }
+    }
+
+    return NULL;
+}
+
+// Returns the leftmost thread in the tree that may run on this CPU
+proc_thread_t* _proc_scheduler_first_allowed(proc_scheduler_cpu_t *rq) {
+    for (rbtree_node_t *node = rbtree_min(&rq->rb_threads); node != NULL; node = rbtree_node_successor(node)) {
+        proc_thread_t *thread = _proc_scheduler_thread(node);
+        if (_proc_scheduler_allowed(thread, rq->cpu)) return thread;
+    }
+
+    return NULL;
+}
+
+// Returns the eligible thread in the tree with the earliest virtual deadline. The tree is ordered by vruntime so an
+// eligible thread's left subtree is all eligible and an ineligible thread's right subtree is all ineligible. Walking
+// down from the root towards the last eligible thread, the earliest deadline is either on that path or it's the
+// min_deadline of the left subtree of an eligible thread on it. Falls back to the leftmost thread if the pick may not
+// run on this CPU, which only happens until the next balance pushes it away
+proc_thread_t* _proc_scheduler_pick_eevdf(proc_scheduler_cpu_t *rq) {
+    proc_scheduler_context_t *best = NULL, *best_left = NULL;
+
+    for (rbtree_node_t *node = rbtree_root(&rq->rb_threads); node != NULL;) {
+        proc_scheduler_context_t *sched = _proc_scheduler_context(node);
+
+        if (!_proc_scheduler_eligible(rq, rbtree_entry(sched, proc_thread_t, sched))) {
+            node = rbtree_left(node);
+            continue;
+        }
+
+        if (best == NULL || sched->deadline < best->deadline) best = sched;
+
+        rbtree_node_t *left = rbtree_left(node);
+        if (left != NULL && (best_left == NULL ||
+            _proc_scheduler_context(left)->min_deadline < best_left->min_deadline))
+            best_left = _proc_scheduler_context(left);
+
+        node = rbtree_right(node);
+    }
+
+    // Find the thread whose deadline is the earliest in the left subtree by following min_deadline down
+    if (best_left != NULL && best_left->min_deadline < best->deadline) {
+        rbtree_node_t *node = &best_left->rb_node;
+
+        for (;;) {
+            proc_scheduler_context_t *sched = _proc_scheduler_context(node);
+            if (sched->deadline == best_left->min_deadline) break;
+
+            rbtree_node_t *left = rbtree_left(node);
+            if (left != NULL && _proc_scheduler_context(left)->min_deadline == best_left->min_deadline) node = left;
+            else node = rbtree_right(node);
+        }
+
+        best = _proc_scheduler_context(node);
+    }
+
+    proc_thread_t *thread = (best != NULL) ? rbtree_entry(best, proc_thread_t, sched) : NULL;
+    if (thread == NULL || !_proc_scheduler_allowed(thread, rq->cpu)) thread = _proc_scheduler_first_allowed(rq);
+
+    return thread;
+}
+
+proc_thread_t* _proc_scheduler_choose(proc_scheduler_cpu_t *rq) {
+    // Real-time threads go first, then the eligible thread with the earliest deadline. Try to pull threads from
+    // another CPU before going idle
+    proc_thread_t *thread = _proc_scheduler_first_rt(rq);
+    if (thread == NULL) thread = _proc_scheduler_pick_eevdf(rq);
+    if (thread == NULL && rq->idle != NULL) {
+        rq->stats.nr_idle_pulls += _proc_scheduler_pull(rq, 1);
+        thread = _proc_scheduler_pick_eevdf(rq);
+    }
+
+    // Fall back to this CPU's idle thread if there is nothing else to run
+    if (thread == NULL) thread = rq->idle;
 
     // There should always be at least one runnable thread
-    kassert(thread != NULL && thread->state == PROC_THREAD_STATE_RUNNABLE);
+    kassert(thread != NULL);
 
     spinlock_acquire_irq(&thread->lock);
 
-    // Remove it from the tree
+    // Remove it from the run queue
+    kassert(thread == rq->idle || thread->state == PROC_THREAD_STATE_RUNNABLE);
     thread->state = PROC_THREAD_STATE_RUNNING;
-    kassert(rbtree_remove(&proc_scheduler.rb_threads, &thread->sched.rb_node));
+    thread->sched.on_cpu = true;
+    if (thread != rq->idle) _proc_scheduler_dequeue(rq, thread);
 
-    // Update min_vruntime and start time of new thread execution
-    proc_scheduler.min_vruntime = thread->sched.vruntime;
-    proc_scheduler.exec_start = arch_timer_get_usecs();
+    // Update the start time of new thread execution
+    rq->curr = thread;
+    rq->exec_start = clocksource_get_usecs();
+    rq->slice = _proc_scheduler_slice(rq, thread);
+    _proc_scheduler_update_min_vruntime(rq);
 
     spinlock_release_irq(&thread->lock);
 
+    _proc_scheduler_program_tick(rq);
+
     return thread;
 }
 
 void proc_scheduler_init(void) {
-    spinlock_init(&proc_scheduler.lock);
-    rbtree_init(&proc_scheduler.rb_threads);
-    proc_scheduler.num_threads = 1;
-    proc_scheduler.min_vruntime = 0;
-    proc_scheduler.exec_start = 0;
-    proc_scheduler.quantum = PROC_SCHEDULER_QUANTUM_US;
+    proc_scheduler.rt_period = PROC_SCHEDULER_RT_PERIOD_US;
+    proc_scheduler.rt_runtime = PROC_SCHEDULER_RT_RUNTIME_US;
+    proc_scheduler.rr_timeslice = PROC_SCHEDULER_RR_TIMESLICE_US;
+
+    for (unsigned int i = 0; i < MAX_NUM_CPUS; i++) {
+        proc_scheduler_cpu_t *rq = _proc_scheduler_rq(i);
+
+        spinlock_init(&rq->lock);
+        rq->cpu = i;
+        rbtree_init_augmented(&rq->rb_threads, _proc_scheduler_augment);
+        rq->num_threads = 0;
+        rq->load_weight = 0;
+        rq->min_vruntime = 0;
+        rq->avg_vruntime = 0;
+        rq->avg_load = 0;
+        rq->idle = NULL;
+        rq->curr = NULL;
+        rq->exec_start = 0;
+        rq->slice = 0;
+        rq->next_balance = 0;
+        ktimer_setup(&rq->tick, _proc_scheduler_tick, rq);
+
+        for (unsigned int word = 0; word < PROC_SCHEDULER_RT_BITMAP_WORDS; word++) rq->rt.bitmap[word] = 0;
+        for (unsigned int prio = 0; prio < PROC_SCHEDULER_RT_PRIO_LEVELS; prio++) list_init(&rq->rt.queues[prio]);
+        rq->rt.nr_queued = 0;
+        rq->rt.runtime = 0;
+        rq->rt.period_start = 0;
+        rq->rt.throttled = false;
+
+        rq->stats = (proc_scheduler_stats_t){0};
+    }
+
+    // Account for the thread running kmain
+    proc_scheduler_cpu_t *rq = _proc_scheduler_rq(arch_cpu_get_id());
+    rq->num_threads = 1;
+    rq->load_weight = PROC_SCHEDULER_NICE_0_WEIGHT;
+}
+
+void proc_scheduler_set_idle(struct proc_thread_s *thread) {
+    kassert(thread != NULL);
+
+    proc_scheduler_cpu_t *rq = _proc_scheduler_lock_this_rq();
+
+    kassert(rq->idle == NULL);
+    rq->idle = thread;
+    rq->curr = proc_thread_current();
+    rq->exec_start = clocksource_get_usecs();
+
+    // Secondary CPUs start out on their idle thread and stay tickless until a thread is queued on them
+    _proc_scheduler_program_tick(rq);
+
+    spinlock_release_irq(&rq->lock);
+}
+
+void proc_scheduler_idle(void) {
+    // The tick is stopped while the idle thread runs. The IPI sent when a thread is queued on this CPU calls into the
+    // scheduler which switches away from the idle thread
+    for (;;) {
+        asm volatile ("wfi\n");
+    }
 }
 
 void proc_scheduler_add(struct proc_thread_s *thread) {
     kassert(thread != NULL);
 
-    // Assumes the given thread has been locked previously
-    spinlock_acquire_irq(&proc_scheduler.lock);
+    // A thread that just went to sleep may still be switching out on its old CPU. It can't run anywhere else until
+    // it's done
+    while (thread->sched.on_cpu);
+    arch_barrier_dmb();
 
-    proc_scheduler.num_threads++;
+    // The thread isn't locked. Its scheduling state is only read here since the caller has claimed the thread and
+    // nothing else queues it until it's in a run queue
+    unsigned int prev = thread->sched.cpu, cpu = _proc_scheduler_select_cpu(thread);
+    proc_scheduler_cpu_t *rq = _proc_scheduler_rq(cpu);
 
-    // Clamp the thread's vruntime to the current minimum in case the thread's been asleep for a long while
-    // This prevents the a thread taking up significant CPU time after waking up
-    thread->state = PROC_THREAD_STATE_RUNNABLE;
-    thread->sched.vruntime = proc_scheduler.min_vruntime;
-    kassert(rbtree_insert(&proc_scheduler.rb_threads, _proc_scheduler_compare, &thread->sched.rb_node));
+    spinlock_acquire_irq(&rq->lock);
+
+    // Bring the running thread's vruntime up to date so the average the thread is placed against is current
+    if (_proc_scheduler_curr_is_fair(rq)) {
+        unsigned long now = clocksource_get_usecs();
+        _proc_scheduler_update_curr(rq, rq->curr, now);
+        rq->exec_start = now;
+    }
+
+    _proc_scheduler_load_add(rq, thread);
+
+    // The thread gets back the lag it had when it went to sleep, so it's owed the same CPU time relative to the other
+    // threads however long it slept. A new thread starts at the average
+    if (!proc_scheduler_is_rt(thread)) _proc_scheduler_place(rq, thread, thread->sched.vlag);
+    _proc_scheduler_enqueue(rq, thread);
 
-    spinlock_release_irq(&proc_scheduler.lock);
+    if (prev != PROC_SCHEDULER_CPU_NONE && prev != cpu) {
+        thread->sched.nr_migrations++;
+        rq->stats.nr_migrations++;
+    }
+
+    // The CPU's tick may be stopped or set for the next load balance if it had nothing else to run. Bring it forward
+    // to the end of the running thread's request. Other CPUs are kicked so they do this themselves. A thread that
+    // preempts the running thread doesn't wait
+    if (rq->curr != NULL) rq->slice = _proc_scheduler_slice(rq, rq->curr);
+    bool preempt = _proc_scheduler_preempts(rq, thread);
+    bool late = !preempt && (!ktimer_is_armed(&rq->tick) || rq->tick.deadline > rq->exec_start + rq->slice);
+    bool kick = late && cpu != arch_cpu_get_id();
+    if (preempt) _proc_scheduler_resched(rq);
+    else if (late && !kick) _proc_scheduler_program_tick(rq);
+
+    spinlock_release_irq(&rq->lock);
+
+    if (kick) irq_send_ipi(cpu);
+}
+
+void proc_scheduler_wake(struct proc_thread_s *thread) {
+    kassert(thread != NULL);
+
+    // A thread that just went to sleep may still be switching out on its old CPU. on_cpu only changes with the
+    // thread locked so once it's clear the thread stays off the CPU until it's woken up
+    spinlock_acquire_irq(&thread->lock);
+    while (thread->state == PROC_THREAD_STATE_SLEEPING && thread->sched.on_cpu) {
+        spinlock_release_irq(&thread->lock);
+        while (thread->sched.on_cpu);
+        spinlock_acquire_irq(&thread->lock);
+    }
+
+    // Only a sleeping thread is off the run queues. Anything else was already woken up and may be queued. Mark it
+    // so nothing else wakes it up again before it's queued
+    bool sleeping = thread->state == PROC_THREAD_STATE_SLEEPING;
+    if (sleeping) thread->state = PROC_THREAD_STATE_SUSPENDED;
+
+    spinlock_release_irq(&thread->lock);
+
+    if (sleeping) proc_scheduler_add(thread);
 }
 
 void proc_scheduler_remove(struct proc_thread_s *thread) {
     kassert(thread != NULL);
 
-    // Assumes the given thread has been locked previously
-    spinlock_acquire_irq(&proc_scheduler.lock);
+    // The thread isn't locked, its run queue's lock protects it while it's queued. It may be pulled to another CPU
+    // until that lock is taken
+    kassert(thread->sched.cpu != PROC_SCHEDULER_CPU_NONE);
+
+    proc_scheduler_cpu_t *rq;
+    for (;;) {
+        rq = _proc_scheduler_rq(thread->sched.cpu);
+        spinlock_acquire_irq(&rq->lock);
+        if (rq->cpu == thread->sched.cpu) break;
+        spinlock_release_irq(&rq->lock);
+    }
 
-    proc_scheduler.num_threads--;
+    kassert(thread->state == PROC_THREAD_STATE_RUNNABLE && rq->curr != thread);
+    _proc_scheduler_load_sub(rq, thread);
 
+    if (!proc_scheduler_is_rt(thread)) thread->sched.vlag = _proc_scheduler_lag(rq, thread);
     thread->state = PROC_THREAD_STATE_SUSPENDED;
-    kassert(rbtree_remove(&proc_scheduler.rb_threads, &thread->sched.rb_node));
+    _proc_scheduler_dequeue(rq, thread);
 
-    spinlock_release_irq(&proc_scheduler.lock);
+    spinlock_release_irq(&rq->lock);
 }
 
 void proc_scheduler_choose(void) {
     proc_thread_t *thread = NULL;
+    proc_scheduler_cpu_t *rq = _proc_scheduler_lock_this_rq();
     proc_thread_t *current = proc_thread_current();
+    unsigned long now = clocksource_get_usecs();
 
-    spinlock_acquire_irq(&proc_scheduler.lock);
     spinlock_acquire_irq(&current->lock);
 
-    // Update the vruntime for the currently running thread and put it back in the tree
-    current->state = PROC_THREAD_STATE_RUNNABLE;
-    current->sched.vruntime += arch_timer_get_usecs() - proc_scheduler.exec_start;
-    kassert(rbtree_insert(&proc_scheduler.rb_threads, _proc_scheduler_compare, &current->sched.rb_node));
+    // Charge the currently running thread and put it back in the run queue. The idle thread only runs when the run
+    // queue is empty so it never goes in it. A preempted real-time thread keeps its place at the front of its list
+    // unless it's a round-robin thread that used up its time slice. A thread that may no longer run here is pushed to
+    // another CPU by the next load balance, which is brought forward to the next tick. A thread preempted on its way
+    // to sleep is taken off the run queue instead, proc_scheduler_sleep has nothing left to do once it's woken up
+    bool sleeping = current != rq->idle && current->state == PROC_THREAD_STATE_SLEEPING;
+    if (sleeping) {
+        _proc_scheduler_sleep_curr(rq, current, now);
+    } else if (current != rq->idle) {
+        _proc_scheduler_update_curr(rq, current, now);
+
+        bool expired = current->sched.policy == PROC_SCHEDULER_POLICY_RR && current->sched.rr_left == 0;
+        if (expired) current->sched.rr_left = proc_scheduler.rr_timeslice;
+
+        _proc_scheduler_enqueue_at(rq, current, proc_scheduler_is_rt(current) && !expired);
+    }
 
     spinlock_release_irq(&current->lock);
 
+    _proc_scheduler_rt_update(rq, now);
+    _proc_scheduler_balance(rq, now);
+    if (current != rq->idle && !sleeping && !_proc_scheduler_allowed(current, rq->cpu)) rq->next_balance = 0;
+
     // Get the next thread to run
-    thread = _proc_scheduler_choose();
+    thread = _proc_scheduler_choose(rq);
 
     // Check if we actually need to do a context switch
-    if (thread != current) proc_thread_switch(thread);
+    if (thread != current) {
+        rq->stats.nr_switches++;
+        proc_thread_switch(thread);
+    }
 
-    spinlock_release_irq(&proc_scheduler.lock);
+    // We may be running on another CPU if this thread was switched out and moved
+    proc_scheduler_unlock();
 }
 
 void proc_scheduler_sleep(void) {
     proc_thread_t *thread = NULL;
+    proc_scheduler_cpu_t *rq = _proc_scheduler_lock_this_rq();
     proc_thread_t *current = proc_thread_current();
+    unsigned long now = clocksource_get_usecs();
 
-    spinlock_acquire_irq(&proc_scheduler.lock);
     spinlock_acquire_irq(&current->lock);
 
-    // We need to remove the thread from the tree since it is being put to sleep
-    proc_scheduler.num_threads--;
+    // The idle thread must always be runnable
+    kassert(current != rq->idle);
+
+    // The thread may have been preempted after it set itself SLEEPING. It was taken off the run queue then and has
+    // already been woken up since
+    if (current->state != PROC_THREAD_STATE_SLEEPING) {
+        spinlock_release_irq(&current->lock);
+        spinlock_release_irq(&rq->lock);
+        return;
+    }
 
-    // Update the thread's state and vruntime
-    current->state = PROC_THREAD_STATE_SLEEPING;
-    current->sched.vruntime += arch_timer_get_usecs() - proc_scheduler.exec_start;
+    // The thread isn't on the run queue anymore since it is being put to sleep
+    _proc_scheduler_sleep_curr(rq, current, now);
 
     spinlock_release_irq(&current->lock);
 
+    _proc_scheduler_rt_update(rq, now);
+
     // Get the next thread to run
-    thread = _proc_scheduler_choose();
+    thread = _proc_scheduler_choose(rq);
 
+    rq->stats.nr_switches++;
     proc_thread_switch(thread);
 
-    spinlock_release_irq(&proc_scheduler.lock);
+    proc_scheduler_unlock();
+}
+
+kresult_t proc_scheduler_set_affinity(struct proc_thread_s *thread, proc_scheduler_cpumask_t mask) {
+    if (thread == NULL || (mask & (PROC_SCHEDULER_CPUMASK(MAX_NUM_CPUS) - 1)) == 0) return KRESULT_INVALID_ARGUMENT;
+
+    // Threads that aren't queued pick up the new mask the next time they're woken up
+    unsigned int cpu = thread->sched.cpu;
+    if (cpu == PROC_SCHEDULER_CPU_NONE) {
+        thread->sched.affinity = mask;
+        return KRESULT_OK;
+    }
+
+    // The thread may be pulled to another CPU until its run queue is locked
+    proc_scheduler_cpu_t *rq;
+    for (;;) {
+        rq = _proc_scheduler_rq(cpu);
+        spinlock_acquire_irq(&rq->lock);
+        if (thread->sched.cpu == cpu) break;
+        spinlock_release_irq(&rq->lock);
+        cpu = thread->sched.cpu;
+    }
+
+    thread->sched.affinity = mask;
+
+    // Queued threads are in the run queue and not running so they can be moved now. A running thread is pushed by the
+    // balance after it's switched out
+    bool move = thread->state == PROC_THREAD_STATE_RUNNABLE && rq->curr != thread &&
+        !_proc_scheduler_allowed(thread, cpu);
+    // It's not counted on any run queue until it's queued again, where it gets back its current lag
+    if (move) {
+        if (!proc_scheduler_is_rt(thread)) thread->sched.vlag = _proc_scheduler_lag(rq, thread);
+        _proc_scheduler_dequeue(rq, thread);
+        _proc_scheduler_load_sub(rq, thread);
+        thread->state = PROC_THREAD_STATE_SUSPENDED;
+    }
+
+    spinlock_release_irq(&rq->lock);
+
+    // Queue it again on a CPU it may run on
+    if (move) proc_scheduler_add(thread);
+
+    return KRESULT_OK;
+}
+
+kresult_t proc_scheduler_set_nice(struct proc_thread_s *thread, int nice) {
+    if (thread == NULL || nice < PROC_SCHEDULER_NICE_MIN || nice > PROC_SCHEDULER_NICE_MAX)
+        return KRESULT_INVALID_ARGUMENT;
+
+    unsigned long weight = proc_scheduler_nice_to_weight[nice - PROC_SCHEDULER_NICE_MIN];
+    unsigned long inv_weight = proc_scheduler_nice_to_inv_weight[nice - PROC_SCHEDULER_NICE_MIN];
+
+    // Threads that were never queued only need the new weight
+    unsigned int cpu = thread->sched.cpu;
+    if (cpu == PROC_SCHEDULER_CPU_NONE) {
+        thread->sched.nice = nice;
+        thread->sched.weight = weight;
+        thread->sched.inv_weight = inv_weight;
+        return KRESULT_OK;
+    }
+
+    // The thread may be pulled to another CPU until its run queue is locked
+    proc_scheduler_cpu_t *rq;
+    for (;;) {
+        rq = _proc_scheduler_rq(cpu);
+        spinlock_acquire_irq(&rq->lock);
+        if (thread->sched.cpu == cpu) break;
+        spinlock_release_irq(&rq->lock);
+        cpu = thread->sched.cpu;
+    }
+
+    // A queued fair thread is in the average vruntime by its weight, take it out while the weight changes
+    bool queued = thread->state == PROC_THREAD_STATE_RUNNABLE && rq->curr != thread && !proc_scheduler_is_rt(thread);
+    if (queued) _proc_scheduler_dequeue(rq, thread);
+
+    thread->sched.nice = nice;
+    thread->sched.weight = weight;
+    thread->sched.inv_weight = inv_weight;
+
+    if (queued) _proc_scheduler_enqueue(rq, thread);
+
+    // Runnable threads are counted in their run queue's load, swap in the new weight. The running thread's slice
+    // changes the next time it's picked
+    if (thread->state == PROC_THREAD_STATE_RUNNABLE || thread->state == PROC_THREAD_STATE_RUNNING) {
+        rq->load_weight = rq->load_weight - thread->sched.load + (proc_scheduler_is_rt(thread) ? 0 : weight);
+        thread->sched.load = proc_scheduler_is_rt(thread) ? 0 : weight;
+    }
+
+    spinlock_release_irq(&rq->lock);
+
+    return KRESULT_OK;
+}
+
+kresult_t proc_scheduler_set_slice(struct proc_thread_s *thread, unsigned long slice) {
+    if (thread == NULL || slice < PROC_SCHEDULER_SLICE_MIN_US || slice > PROC_SCHEDULER_SLICE_MAX_US)
+        return KRESULT_INVALID_ARGUMENT;
+
+    // Threads that were never queued make their first request when they're queued
+    unsigned int cpu = thread->sched.cpu;
+    if (cpu == PROC_SCHEDULER_CPU_NONE) {
+        thread->sched.slice = slice;
+        return KRESULT_OK;
+    }
+
+    // The thread may be pulled to another CPU until its run queue is locked
+    proc_scheduler_cpu_t *rq;
+    for (;;) {
+        rq = _proc_scheduler_rq(cpu);
+        spinlock_acquire_irq(&rq->lock);
+        if (thread->sched.cpu == cpu) break;
+        spinlock_release_irq(&rq->lock);
+        cpu = thread->sched.cpu;
+    }
+
+    thread->sched.slice = slice;
+
+    // A queued fair thread makes its request again with the new slice so its deadline in the tree moves. The running
+    // thread and sleeping threads use it from their next request
+    if (thread->state == PROC_THREAD_STATE_RUNNABLE && rq->curr != thread && !proc_scheduler_is_rt(thread)) {
+        _proc_scheduler_dequeue(rq, thread);
+        thread->sched.deadline = _proc_scheduler_deadline(thread);
+        _proc_scheduler_enqueue(rq, thread);
+    }
+
+    spinlock_release_irq(&rq->lock);
+
+    return KRESULT_OK;
+}
+
+kresult_t proc_scheduler_set_policy(struct proc_thread_s *thread, proc_scheduler_policy_t policy,
+    unsigned int priority) {
+    if (thread == NULL || policy > PROC_SCHEDULER_POLICY_RR || priority >= PROC_SCHEDULER_RT_PRIO_LEVELS ||
+        (policy == PROC_SCHEDULER_POLICY_FAIR && priority != 0))
+        return KRESULT_INVALID_ARGUMENT;
+
+    // Threads that were never queued only need the new class
+    unsigned int cpu = thread->sched.cpu;
+    if (cpu == PROC_SCHEDULER_CPU_NONE) {
+        thread->sched.policy = policy;
+        thread->sched.rt_priority = priority;
+        thread->sched.rr_left = proc_scheduler.rr_timeslice;
+        return KRESULT_OK;
+    }
+
+    // The thread may be pulled to another CPU until its run queue is locked
+    proc_scheduler_cpu_t *rq;
+    for (;;) {
+        rq = _proc_scheduler_rq(cpu);
+        spinlock_acquire_irq(&rq->lock);
+        if (thread->sched.cpu == cpu) break;
+        spinlock_release_irq(&rq->lock);
+        cpu = thread->sched.cpu;
+    }
+
+    // Idle threads only run when there is nothing else to run
+    if (thread == rq->idle) {
+        spinlock_release_irq(&rq->lock);
+        return KRESULT_INVALID_ARGUMENT;
+    }
+
+    // A queued thread moves to the queue of its new class and a runnable thread adds the load of its new class. The
+    // running thread is charged to its old class for the time it has run so far
+    bool queued = thread->state == PROC_THREAD_STATE_RUNNABLE && rq->curr != thread;
+    bool counted = thread->state == PROC_THREAD_STATE_RUNNABLE || thread->state == PROC_THREAD_STATE_RUNNING;
+    bool was_rt = proc_scheduler_is_rt(thread);
+
+    if (queued) _proc_scheduler_dequeue(rq, thread);
+    if (counted) _proc_scheduler_load_sub(rq, thread);
+
+    if (rq->curr == thread) {
+        unsigned long now = clocksource_get_usecs();
+        _proc_scheduler_update_curr(rq, thread, now);
+        rq->exec_start = now;
+    }
+
+    // Real-time threads don't keep their vruntime up to date, start with no lag. The thread isn't in the average yet
+    if (was_rt && policy == PROC_SCHEDULER_POLICY_FAIR) {
+        thread->sched.vlag = 0;
+        if (counted) _proc_scheduler_place(rq, thread, 0);
+    }
+
+    thread->sched.policy = policy;
+    thread->sched.rt_priority = priority;
+    thread->sched.rr_left = proc_scheduler.rr_timeslice;
+
+    if (counted) _proc_scheduler_load_add(rq, thread);
+    if (queued) _proc_scheduler_enqueue(rq, thread);
+
+    // Let the scheduler pick again if the running thread changed class or a queued thread now preempts it
+    if (rq->curr == thread || (queued && _proc_scheduler_preempts(rq, thread))) _proc_scheduler_resched(rq);
+
+    spinlock_release_irq(&rq->lock);
+
+    return KRESULT_OK;
+}
+
+kresult_t proc_scheduler_get_stats(unsigned int cpu, proc_scheduler_stats_t *stats) {
+    if (cpu >= MAX_NUM_CPUS || stats == NULL) return KRESULT_INVALID_ARGUMENT;
+
+    proc_scheduler_cpu_t *rq = _proc_scheduler_rq(cpu);
+
+    spinlock_acquire_irq(&rq->lock);
+    *stats = rq->stats;
+    stats->nr_running = rq->num_threads;
+    stats->load_weight = rq->load_weight;
+    spinlock_release_irq(&rq->lock);
+
+    return KRESULT_OK;
+}
+
+void proc_scheduler_switched(struct proc_thread_s *prev) {
+    // Make sure everything prev's CPU wrote to it is visible before it can run elsewhere
+    arch_barrier_dmb();
+    prev->sched.on_cpu = false;
 }
 
 void proc_scheduler_unlock(void) {
-    spinlock_release_irq(&proc_scheduler.lock);
+    // Interrupts are disabled while the run queue is locked so this CPU can't change
+    spinlock_release_irq(&this_cpu()->sched.lock);
 }
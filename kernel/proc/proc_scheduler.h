@@ -8,40 +8,216 @@
 #define _PROC_SCHEDULER_H_
 
 #include <kernel/rbtree.h>
+#include <kernel/list.h>
+#include <kernel/spinlock.h>
+#include <kernel/kresult.h>
+#include <kernel/ktimer.h>
+#include <kernel/arch/arch_cpu.h>
 #include <kernel/proc/proc_types.h>
 
+/*
+ * proc_scheduler - Earliest eligible virtual deadline first scheduler with per-CPU run queues
+ * Every CPU has its own run queue: a tree of runnable threads keyed off their virtual runtime, protected by its own
+ * lock, so CPUs schedule independently of each other. Woken threads go back to the CPU they last ran on unless
+ * another CPU they may run on is idle. A CPU's load is the summed weight of its threads. CPUs even out their load by
+ * pulling threads from the busiest CPU, periodically and whenever they run out of threads to run. A thread's affinity
+ * mask limits which CPUs it may run on.
+ *
+ * Each thread has a nice level which maps to a weight. A thread's virtual runtime advances slower the heavier it is,
+ * so it gets a share of the CPU in proportion to its weight. Its lag is how far its virtual runtime is behind the
+ * weighted average of the run queue, i.e. how much CPU time it's owed. Threads with a lag of at least 0 are eligible
+ * to run. Each thread asks for the CPU in requests of its slice, the virtual deadline of a request is the virtual
+ * time at which the thread would have received its slice. Among the eligible threads the one with the earliest
+ * virtual deadline runs, until its request is done or a woken thread has an earlier deadline. The tree keeps the
+ * earliest deadline of each subtree so this is found in O(log n). A short slice gets a thread picked sooner without
+ * giving it more CPU time than its weight entitles it to, which suits threads that run in short bursts. Threads keep
+ * their lag while they sleep so a thread can't get ahead by sleeping or fall behind because it slept.
+ *
+ * Real-time threads run ahead of all fair threads. Each CPU queues them in one FIFO list per priority with a bitmap of
+ * the non-empty lists, so the highest priority thread is found with a count leading zeros. A FIFO thread runs until
+ * it sleeps or a higher priority thread is woken up, a round-robin thread also goes to the back of its list when its
+ * time slice runs out. Real-time threads on a CPU may only use up a budget of rt_runtime per rt_period. Once they've
+ * used it up they are throttled until the next period so runaway real-time threads can't starve the fair threads.
+ * Real-time threads aren't moved by load balancing.
+ *
+ * The scheduler tick is dynamic: each time a thread is picked the CPU's tick timer is armed for the next time the
+ * scheduler needs to run, the end of the request if other threads are waiting or else the next load balance. A CPU
+ * running its idle thread stops its tick altogether and is woken up by an IPI when a thread is queued on it.
+ */
+
 struct proc_thread_s;
 
+// Bit mask of CPUs a thread may run on
+typedef unsigned long proc_scheduler_cpumask_t;
+
+#define PROC_SCHEDULER_CPUMASK_ALL  (~0UL)
+#define PROC_SCHEDULER_CPUMASK(cpu) (1UL << (cpu))
+
+// CPU of a thread that hasn't been queued on any CPU yet
+#define PROC_SCHEDULER_CPU_NONE     (MAX_NUM_CPUS)
+
+// Range of nice levels. Lower is more CPU time, each level is about 10% more or less CPU time than the one next to it
+#define PROC_SCHEDULER_NICE_MIN     (-20)
+#define PROC_SCHEDULER_NICE_MAX     (19)
+#define PROC_SCHEDULER_NICE_DEFAULT (0)
+
+// Weight of a thread at the default nice level and 2^32 divided by it
+#define PROC_SCHEDULER_NICE_0_WEIGHT     (1024)
+#define PROC_SCHEDULER_NICE_0_INV_WEIGHT (4194304)
+
+// Range of request slices in usecs. Shorter slices are picked sooner but are preempted sooner too
+#define PROC_SCHEDULER_SLICE_MIN_US      (100)
+#define PROC_SCHEDULER_SLICE_MAX_US      (100000)
+#define PROC_SCHEDULER_SLICE_DEFAULT_US  (3000)
+
+// # of real-time priorities. Higher priorities run first
+#define PROC_SCHEDULER_RT_PRIO_LEVELS    (100)
+#define PROC_SCHEDULER_RT_BITMAP_WORDS   ((PROC_SCHEDULER_RT_PRIO_LEVELS + 63) / 64)
+
+typedef enum {
+    PROC_SCHEDULER_POLICY_FAIR,         // Weighted fair share of the CPU
+    PROC_SCHEDULER_POLICY_FIFO,         // Real-time, runs until it sleeps or is preempted by a higher priority
+    PROC_SCHEDULER_POLICY_RR,           // Real-time, like FIFO but round-robin among threads of the same priority
+} proc_scheduler_policy_t;
+
 typedef struct proc_scheduler_context_s {
-    rbtree_node_t rb_node;       // Red/black tree linkage
-    unsigned long vruntime;      // Thread's CPU runtime
+    rbtree_node_t rb_node;              // Red/black tree linkage
+    unsigned long vruntime;             // Thread's CPU runtime
+    unsigned long deadline;             // Virtual deadline of the thread's current request
+    unsigned long min_deadline;         // Earliest deadline in the thread's subtree of the tree
+    long vlag;                          // Lag the thread had when it was last taken off a run queue
+    unsigned long slice;                // Length of the thread's requests in usecs
+    unsigned int cpu;                   // CPU whose run queue the thread is on or last ran on
+    volatile bool on_cpu;               // Set from when the thread is picked to run until it's switched out
+    proc_scheduler_cpumask_t affinity;  // CPUs the thread may run on
+    unsigned long nr_migrations;        // # of times the thread moved to another CPU
+    int nice;                           // Nice level
+    unsigned long weight;               // Weight of the nice level
+    unsigned long inv_weight;           // 2^32 / weight, to scale runtime without dividing
+    unsigned long load;                 // Weight the thread added to its run queue's load when it was queued
+    proc_scheduler_policy_t policy;     // Scheduling class of the thread
+    unsigned int rt_priority;           // Real-time priority, only used by real-time threads
+    list_node_t ll_rt_node;             // Real-time priority list linkage
+    unsigned long rr_left;              // Time left in a round-robin thread's time slice
 } proc_scheduler_context_t;
 
+typedef struct {
+    size_t nr_running;                  // # of threads on the run queue, including the running thread but not idle
+    unsigned long load_weight;          // Sum of the weights of the fair threads among those
+    unsigned long nr_switches;          // # of context switches
+    unsigned long nr_migrations;        // # of threads moved to this CPU from another CPU
+    unsigned long nr_idle_pulls;        // # of threads pulled from other CPUs when this CPU had nothing to run
+    unsigned long nr_balance_pulls;     // # of threads pulled from other CPUs by periodic load balancing
+    unsigned long nr_tick_stops;        // # of times the tick was stopped to run the idle thread
+    unsigned long nr_rt_throttled;      // # of times real-time threads used up their budget
+} proc_scheduler_stats_t;
+
+// Real-time threads queued on a CPU
+typedef struct {
+    unsigned long bitmap[PROC_SCHEDULER_RT_BITMAP_WORDS];  // Bit set for every priority with queued threads
+    list_t queues[PROC_SCHEDULER_RT_PRIO_LEVELS];          // Queued threads of each priority, first to run first
+    size_t nr_queued;                                      // # of threads in the lists
+    unsigned long runtime;                                 // Time real-time threads ran for in the current period
+    unsigned long period_start;                            // Start of the current period
+    bool throttled;                                        // Set once runtime goes over budget until the period ends
+} proc_scheduler_rt_rq_t;
+
+// Run queue of a CPU, kept in the CPU's per-CPU data
+typedef struct {
+    spinlock_t lock;                    // Protects the run queue. Held across context switches on this CPU
+    unsigned int cpu;                   // CPU this run queue belongs to
+    rbtree_t rb_threads;                // Runnable threads keyed off vruntime, augmented with min_deadline
+    size_t num_threads;                 // # of threads in the tree plus the running thread unless it's idle
+    unsigned long load_weight;          // Sum of the weights of the fair threads among those
+    unsigned long min_vruntime;         // Never decreasing lower bound of the vruntimes on the run queue
+    long avg_vruntime;                  // Sum of (vruntime - min_vruntime) * weight of the threads in the tree
+    unsigned long avg_load;             // Sum of the weights of the threads in the tree
+    struct proc_thread_s *idle;         // Thread to run when no other thread is runnable. It is never put in the tree
+    struct proc_thread_s *curr;         // Thread running on this CPU
+    unsigned long exec_start;           // The time when a thread was scheduled for execution on this CPU
+    unsigned long slice;                // How long the running thread may run while other threads are waiting
+    unsigned long next_balance;         // Time of the next periodic load balance
+    ktimer_t tick;                      // Armed for the next time the scheduler needs to run on this CPU
+    proc_scheduler_rt_rq_t rt;          // Real-time threads, picked ahead of the threads in the tree
+    proc_scheduler_stats_t stats;
+} proc_scheduler_cpu_t;
+
 // Initializes the scheduler data structures
 void proc_scheduler_init(void);
 
-// Add a new thread or newly awoken thread to the scheduler
+// Makes the given thread the idle thread of the calling CPU. It runs on this CPU whenever no other thread is runnable
+// and must never sleep. Its entry point should be proc_scheduler_idle. This also starts the CPU's scheduler tick
+void proc_scheduler_set_idle(struct proc_thread_s *thread);
+
+// Idle loop run by the idle threads
+void proc_scheduler_idle(void);
+
+// Add a new thread or a thread that was taken off the run queues, e.g. a resumed thread, to the scheduler. The caller
+// must not hold the thread's lock: run queue locks are taken before thread locks, and this waits for the thread to
+// finish switching out of its old CPU. The caller must have claimed the thread, e.g. by marking a sleeping thread
+// suspended under its lock, so that nothing else queues it at the same time
 void proc_scheduler_add(struct proc_thread_s *thread);
 
-// Just removes the thread from the scheduler
+// Takes a queued thread that isn't running off its run queue and marks it suspended. The caller must not hold the
+// thread's lock or any run queue lock
 void proc_scheduler_remove(struct proc_thread_s *thread);
 
 // Chooses next thread to run, may switch to another more deserving thread
 void proc_scheduler_choose(void);
 
-// Lets the scheduler prepare for a thread to be suspended or put to sleep
-// This will cause a context switch to another runnable thread
+// Restricts the thread to the CPUs in the given mask. A queued thread is moved right away if it may no longer run on
+// its CPU, a running thread is moved after it's next switched out
+kresult_t proc_scheduler_set_affinity(struct proc_thread_s *thread, proc_scheduler_cpumask_t mask);
+
+// Returns the thread's affinity mask
+#define proc_scheduler_get_affinity(thread) ((thread)->sched.affinity)
+
+// Sets the thread's nice level, between PROC_SCHEDULER_NICE_MIN and PROC_SCHEDULER_NICE_MAX
+kresult_t proc_scheduler_set_nice(struct proc_thread_s *thread, int nice);
+
+// Returns the thread's nice level
+#define proc_scheduler_get_nice(thread) ((thread)->sched.nice)
+
+// Sets the length of the thread's requests, between PROC_SCHEDULER_SLICE_MIN_US and PROC_SCHEDULER_SLICE_MAX_US. This
+// changes how soon the thread is picked, not how much CPU time it gets
+kresult_t proc_scheduler_set_slice(struct proc_thread_s *thread, unsigned long slice);
+
+// Returns the length of the thread's requests in usecs
+#define proc_scheduler_get_slice(thread) ((thread)->sched.slice)
+
+// Sets the thread's scheduling policy. priority is the real-time priority, below PROC_SCHEDULER_RT_PRIO_LEVELS, and
+// must be 0 for PROC_SCHEDULER_POLICY_FAIR
+kresult_t proc_scheduler_set_policy(struct proc_thread_s *thread, proc_scheduler_policy_t policy,
+    unsigned int priority);
+
+// Returns the thread's scheduling policy and real-time priority
+#define proc_scheduler_get_policy(thread)      ((thread)->sched.policy)
+#define proc_scheduler_get_rt_priority(thread) ((thread)->sched.rt_priority)
+
+// True if the thread is in one of the real-time classes
+#define proc_scheduler_is_rt(thread)           ((thread)->sched.policy != PROC_SCHEDULER_POLICY_FAIR)
+
+// Gets a snapshot of the given CPU's scheduling statistics
+kresult_t proc_scheduler_get_stats(unsigned int cpu, proc_scheduler_stats_t *stats);
+
+// Puts the calling thread to sleep and switches to another runnable thread. The thread must have set itself SLEEPING
+// with its lock held, before anything that may wake it up could see it. Returns right away if the thread was
+// preempted after that and has already been woken up
 void proc_scheduler_sleep(void);
 
-// Waking a thread involves marking it runnable and adding it back in the scheduler's queues
-#define proc_scheduler_wake(thread) proc_scheduler_add(thread)
+// Waking a thread involves marking it runnable and adding it back in the scheduler's queues. Does nothing if the thread
+// isn't asleep, e.g. because it was already woken up. The thread must not be locked
+void proc_scheduler_wake(struct proc_thread_s *thread);
 
 // Macro to compare vruntime of two threads to determine which is more deserving of CPU time
 // True if t1 deserves time over t2, false otherwise
 #define proc_scheduler_deserve(t1, t2) ((t1)->sched.vruntime < (t2)->sched.vruntime)
 
+// Called on a CPU once it has switched away from prev. After this prev may run on another CPU
+void proc_scheduler_switched(struct proc_thread_s *prev);
+
 // This is only used after switching to new threads since new threads do not return back to proc_scheduler_choose
-// or proc_scheduler_sleep
+// or proc_scheduler_sleep. Unlocks the run queue of the CPU the thread is running on
 void proc_scheduler_unlock(void);
 
 #endif // _PROC_SCHEDULER_H_
@@ -26,7 +26,7 @@ proc_task_list_t proc_task_list;
 
 void proc_task_init(void) {
     // Initialize the slab for allocating proc_task_t structs
-    kmem_slab_create(&proc_task_slab, sizeof(proc_task_t), PROC_TASK_SLAB_NUM);
+    kmem_slab_create(&proc_task_slab, sizeof(proc_task_t), PROC_TASK_SLAB_NUM, NULL, NULL);
 
     spinlock_init(&proc_task_list.lock);
     list_init(&proc_task_list.tasks);
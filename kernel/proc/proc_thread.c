@@ -19,7 +19,6 @@ atomic_t tid;
 #define TID_ALLOC() (arch_atomic_inc(&tid))
 
 size_t kernel_stack_size;
-proc_thread_t *current_thread;
 proc_thread_t thread_template;
 
 // proc_thread_t slab
@@ -30,6 +29,9 @@ kmem_slab_t proc_thread_slab;
 #define KERNEL_STACK_SLAB_NUM (1024)
 kmem_slab_t kernel_stack_slab;
 
+// How long to wait before trying to wake up a thread whose sleep timed out before it got to sleep
+#define PROC_THREAD_TIMEOUT_RETRY_US (100)
+
 #define NUM_BUCKETS              (1024)
 #define PROC_EVENT_HASH(event)   (hash64_fnv1a((uint64_t)event) % NUM_BUCKETS)
 
@@ -40,51 +42,122 @@ typedef struct {
 
 proc_thread_event_hash_table_t event_table;
 
+// Wakes up the thread if it's still sleeping on the event it was sleeping on when the timer was armed
+void _proc_thread_timeout(ktimer_t *timer, void *arg) {
+    proc_thread_t *thread = (proc_thread_t*)arg;
+    proc_event_t event = thread->event;
+    if (event == NULL) return;
+
+    uint64_t hash_bkt = PROC_EVENT_HASH(event);
+
+    spinlock_acquire_irq(&event_table.lock[hash_bkt]);
+    spinlock_acquire_irq(&thread->lock);
+
+    bool sleeping = thread->event == event;
+
+    // The interrupt may have come in before the thread got to switch out, it can't be woken up from its own CPU
+    // until it has
+    if (sleeping && thread == proc_thread_current()) {
+        spinlock_release_irq(&thread->lock);
+        spinlock_release_irq(&event_table.lock[hash_bkt]);
+        ktimer_arm(timer, ktimer_now() + PROC_THREAD_TIMEOUT_RETRY_US);
+        return;
+    }
+
+    if (sleeping) {
+        kassert(list_remove(&event_table.ll_threads[hash_bkt], &thread->ll_enode));
+        thread->event = NULL;
+        thread->timed_out = true;
+    }
+
+    spinlock_release_irq(&thread->lock);
+    spinlock_release_irq(&event_table.lock[hash_bkt]);
+
+    if (sleeping) proc_scheduler_wake(thread);
+}
+
+void _proc_thread_ctor(void *obj) {
+    proc_thread_t *thread = (proc_thread_t*)obj;
+
+    // The lock, list linkage and sleep timer are set up once for as long as the object stays cached. A thread is only
+    // freed once it's unlocked, off every list and its timer isn't armed so they are left like this
+    spinlock_init(&thread->lock);
+    list_node_init(&thread->ll_enode);
+    list_node_init(&thread->ll_tnode);
+    ktimer_setup(&thread->sleep_timer, _proc_thread_timeout, thread);
+}
+
+// The object may have been used by a previous thread. Resets the fields that change over a thread's lifetime
+void _proc_thread_reset(proc_thread_t *thread, proc_task_t *task, void *kernel_stack) {
+    thread->tid = TID_ALLOC();
+    thread->task = task;
+    thread->state = thread_template.state;
+    thread->suspend_cnt = thread_template.suspend_cnt;
+    thread->refcnt = thread_template.refcnt;
+    thread->event = thread_template.event;
+    thread->timed_out = thread_template.timed_out;
+    thread->kernel_stack = kernel_stack;
+    thread->sched = thread_template.sched;
+}
+
 void proc_thread_init(void) {
     // Initialize the slab for allocating proc_thread_t structs
-    kmem_slab_create(&proc_thread_slab, sizeof(proc_thread_t), PROC_THREAD_SLAB_NUM);
+    kmem_slab_create(&proc_thread_slab, sizeof(proc_thread_t), PROC_THREAD_SLAB_NUM, _proc_thread_ctor, NULL);
 
     // Initialize the slab for allocating kernel stacks. Kernel stacks are the size of one page
     kernel_stack_size = PAGESIZE;
-    kmem_slab_create(&kernel_stack_slab, kernel_stack_size, KERNEL_STACK_SLAB_NUM);
+    kmem_slab_create(&kernel_stack_slab, kernel_stack_size, KERNEL_STACK_SLAB_NUM, NULL, NULL);
 
     // Initialize the event hash table
     arch_fast_zero(event_table.lock, sizeof(spinlock_t) * NUM_BUCKETS);
     arch_fast_zero(event_table.ll_threads, sizeof(list_t) * NUM_BUCKETS);
 
-    // Setup the thread template object
-    spinlock_init(&thread_template.lock);
+    // Setup the thread template object. It holds the initial values of the fields reset for every new thread
     thread_template.tid = 0;
     thread_template.task = proc_task_kernel();
     thread_template.state = PROC_THREAD_STATE_SUSPENDED;
     thread_template.suspend_cnt = 1;
     thread_template.refcnt = 1;
     thread_template.event = 0;
-    list_node_init(&thread_template.ll_enode);
-    list_node_init(&thread_template.ll_tnode);
+    thread_template.timed_out = false;
     thread_template.kernel_stack = NULL;
     rbtree_node_init(&thread_template.sched.rb_node);
     thread_template.sched.vruntime = 0;
+    thread_template.sched.deadline = 0;
+    thread_template.sched.min_deadline = 0;
+    thread_template.sched.vlag = 0;
+    thread_template.sched.slice = PROC_SCHEDULER_SLICE_DEFAULT_US;
+    thread_template.sched.cpu = PROC_SCHEDULER_CPU_NONE;
+    thread_template.sched.on_cpu = false;
+    thread_template.sched.affinity = PROC_SCHEDULER_CPUMASK_ALL;
+    thread_template.sched.nr_migrations = 0;
+    thread_template.sched.nice = PROC_SCHEDULER_NICE_DEFAULT;
+    thread_template.sched.weight = PROC_SCHEDULER_NICE_0_WEIGHT;
+    thread_template.sched.inv_weight = PROC_SCHEDULER_NICE_0_INV_WEIGHT;
+    thread_template.sched.load = 0;
+    thread_template.sched.policy = PROC_SCHEDULER_POLICY_FAIR;
+    thread_template.sched.rt_priority = 0;
+    list_node_init(&thread_template.sched.ll_rt_node);
+    thread_template.sched.rr_left = 0;
 
     // Create a thread for the currently running kernel code
     proc_thread_t *kernel_thread = kmem_slab_alloc(&proc_thread_slab);
     kassert(kernel_thread != NULL);
 
     int stack_var;
-    *kernel_thread = thread_template;
-    kernel_thread->tid = TID_ALLOC();
+    _proc_thread_reset(kernel_thread, proc_task_kernel(), (void*)ROUND_PAGE_DOWN(&stack_var));
     kernel_thread->state = PROC_THREAD_STATE_RUNNING;
     kernel_thread->suspend_cnt = 0;
-    kernel_thread->kernel_stack = (void*)ROUND_PAGE_DOWN(&stack_var);
-    rbtree_node_init(&kernel_thread->sched.rb_node);
-    kernel_thread->sched.vruntime = 0;
+    kernel_thread->sched.cpu = arch_cpu_get_id();
+    kernel_thread->sched.on_cpu = true;
+    kernel_thread->sched.load = kernel_thread->sched.weight;
 
     spinlock_acquire_irq(&proc_task_kernel()->lock);
     kassert(list_insert_last(&proc_task_kernel()->ll_threads, &kernel_thread->ll_tnode));
     proc_task_kernel()->num_threads++;
     spinlock_release_irq(&proc_task_kernel()->lock);
 
-    proc_thread_current() = kernel_thread;
+    proc_thread_set_current(kernel_thread);
 }
 
 kresult_t proc_thread_create(proc_task_t *task, proc_thread_t **thread) {
@@ -99,10 +172,7 @@ kresult_t proc_thread_create(proc_task_t *task, proc_thread_t **thread) {
         return KRESULT_RESOURCE_SHORTAGE;
     }
 
-    *new_thread = thread_template;
-    new_thread->tid = TID_ALLOC();
-    new_thread->task = task;
-    new_thread->kernel_stack = kernel_stack;
+    _proc_thread_reset(new_thread, task, kernel_stack);
 
     // Initialize the thread context
     arch_thread_init(new_thread);
@@ -140,20 +210,19 @@ void proc_thread_unreference(proc_thread_t *thread) {
     kassert(thread != NULL);
 
     spinlock_acquire_irq(&thread->lock);
-
-    thread->refcnt--;
+    bool destroy = --thread->refcnt == 0;
+    spinlock_release_irq(&thread->lock);
 
     // FIXME need to terminate or suspend a thread
-    if (thread->refcnt == 0) {
+    if (destroy) {
         spinlock_acquire_irq(&thread->task->lock);
         kassert(list_remove(&thread->task->ll_threads, &thread->ll_tnode));
         spinlock_release_irq(&thread->task->lock);
 
-        kmem_slab_free(&kernel_stack_slab, thread->kernel_stack);
-        kmem_slab_free(&proc_thread_slab, thread);
+        // The last reference may be dropped with spinlocks held, i.e. by the scheduler, so the frees can't sleep
+        kmem_slab_free_atomic(&kernel_stack_slab, thread->kernel_stack);
+        kmem_slab_free_atomic(&proc_thread_slab, thread);
     }
-
-    spinlock_release_irq(&thread->lock);
 }
 
 kresult_t proc_thread_terminate(proc_thread_t *thread) {
@@ -165,13 +234,13 @@ kresult_t proc_thread_terminate(proc_thread_t *thread) {
 kresult_t proc_thread_resume(proc_thread_t *thread) {
     if (thread == NULL) return KRESULT_INVALID_ARGUMENT;
 
+    // The last resume claims the thread. It's queued without its lock held since run queue locks come first
     spinlock_acquire_irq(&thread->lock);
-
-    thread->suspend_cnt--;
-    if (thread->suspend_cnt == 0) proc_scheduler_add(thread);
-
+    bool resume = (--thread->suspend_cnt == 0);
     spinlock_release_irq(&thread->lock);
 
+    if (resume) proc_scheduler_add(thread);
+
     return KRESULT_OK;
 }
 
@@ -201,7 +270,8 @@ void proc_thread_switch(proc_thread_t *new_thread) {
 
     new_thread = arch_thread_switch(new_thread, proc_thread_current());
     proc_thread_t *cur_thread = proc_thread_current();
-    proc_thread_current() = new_thread;
+    proc_thread_set_current(new_thread);
+    if (cur_thread != new_thread) proc_scheduler_switched(cur_thread);
 
     if (cur_thread == new_thread) {
         spinlock_release_irq(&new_thread->lock);
@@ -215,6 +285,11 @@ void proc_thread_switch(proc_thread_t *new_thread) {
 }
 
 void proc_thread_sleep(proc_event_t event, spinlock_t *interlock, bool interruptible) {
+    proc_thread_sleep_timeout(event, interlock, interruptible, KTIMER_NONE);
+}
+
+kresult_t proc_thread_sleep_timeout(proc_event_t event, spinlock_t *interlock, bool interruptible,
+    unsigned long deadline) {
     kassert(interlock != NULL);
 
     uint64_t hash_bkt = PROC_EVENT_HASH(event);
@@ -225,9 +300,14 @@ void proc_thread_sleep(proc_event_t event, spinlock_t *interlock, bool interrupt
 
     // Add this thread to event hash table
     current->event = event;
+    current->timed_out = false;
     kassert(list_insert_last(&event_table.ll_threads[hash_bkt], &current->ll_enode));
 
-    // Now we can release the interlock
+    if (deadline != KTIMER_NONE) ktimer_arm(&current->sleep_timer, deadline);
+
+    // The thread is asleep as far as anything waking it up is concerned, even if it's preempted before it gets to the
+    // scheduler. Now we can release the interlock
+    current->state = PROC_THREAD_STATE_SLEEPING;
     spinlock_release_irq(interlock);
 
     spinlock_release_irq(&current->lock);
@@ -235,6 +315,24 @@ void proc_thread_sleep(proc_event_t event, spinlock_t *interlock, bool interrupt
 
     // Call the scheduler
     proc_scheduler_sleep();
+
+    // The event may have woken the thread up before the timer expired
+    if (deadline != KTIMER_NONE) ktimer_cancel(&current->sleep_timer);
+
+    return current->timed_out ? KRESULT_TIMED_OUT : KRESULT_OK;
+}
+
+void proc_thread_sleep_until(unsigned long deadline) {
+    proc_thread_t *current = proc_thread_current();
+    spinlock_t interlock;
+
+    spinlock_init(&interlock);
+
+    // Nothing else sleeps on the thread's own timer so only the timer wakes it up
+    while (ktimer_now() < deadline) {
+        spinlock_acquire_irq(&interlock);
+        proc_thread_sleep_timeout(&current->sleep_timer, &interlock, false, deadline);
+    }
 }
 
 void proc_thread_wake(proc_event_t event, unsigned int n) {
@@ -256,6 +354,7 @@ void proc_thread_wake(proc_event_t event, unsigned int n) {
 
         // Remove the thread from the event hash table
         kassert(list_remove(&event_table.ll_threads[hash_bkt], &thread->ll_enode));
+        thread->event = NULL;
         spinlock_release_irq(&thread->lock);
 
         proc_scheduler_wake(thread);
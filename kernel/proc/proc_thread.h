@@ -10,7 +10,11 @@
 #include <kernel/spinlock.h>
 #include <kernel/list.h>
 #include <kernel/kresult.h>
+#include <kernel/ktimer.h>
+#include <kernel/percpu.h>
 #include <kernel/arch/arch_thread.h>
+#include <kernel/arch/arch_cpu.h>
+#include <kernel/arch/arch_interrupts.h>
 #include <kernel/vm/vm_types.h>
 #include <kernel/proc/proc_types.h>
 #include <kernel/proc/proc_task.h>
@@ -33,6 +37,8 @@ typedef struct proc_thread_s {
     unsigned int refcnt;                   // Reference count
     proc_event_t event;                    // Event this thread is sleeping on
     list_node_t ll_enode;                  // Event hash table bucket list linkage
+    ktimer_t sleep_timer;                  // Wakes the thread up if its sleep times out
+    bool timed_out;                        // Set if the last sleep timed out
     list_node_t ll_tnode;                  // Thread list linkage
     void *kernel_stack;                    // Kernel stack
     arch_thread_context_t context;         // User saved context
@@ -40,7 +46,6 @@ typedef struct proc_thread_s {
 } proc_thread_t;
 
 extern size_t kernel_stack_size;
-extern proc_thread_t *current_thread;
 
 // Initializes the proc_thread module
 void proc_thread_init(void);
@@ -51,7 +56,8 @@ kresult_t proc_thread_create(proc_task_t *task, proc_thread_t **thread);
 // Increments the reference counter on the thread
 void proc_thread_reference(proc_thread_t *thread);
 
-// Decrements the reference counter on the thread. If zero, terminates the thread
+// Decrements the reference counter on the thread. If zero, terminates the thread. Doesn't sleep so it may be called
+// with spinlocks held
 void proc_thread_unreference(proc_thread_t *thread);
 
 // Terminates the thread
@@ -70,6 +76,14 @@ void proc_thread_switch(proc_thread_t *new_thread);
 // then the sleep event
 void proc_thread_sleep(proc_event_t event, spinlock_t *interlock, bool interruptible);
 
+// Same as proc_thread_sleep except the thread is woken up once the system time reaches deadline (in usecs, see
+// ktimer_now) if the event hasn't happened by then. Returns KRESULT_TIMED_OUT if the sleep timed out
+kresult_t proc_thread_sleep_timeout(proc_event_t event, spinlock_t *interlock, bool interruptible,
+    unsigned long deadline);
+
+// Puts the current thread to sleep until the system time reaches deadline (in usecs, see ktimer_now)
+void proc_thread_sleep_until(unsigned long deadline);
+
 // Wakes n threads waiting for the event
 void proc_thread_wake(proc_event_t event, unsigned int n);
 
@@ -88,7 +102,10 @@ kresult_t proc_thread_set_entry(proc_thread_t *thread, void *entry);
 // Sets the user space stack pointer for the given thread
 kresult_t proc_thread_set_stack(proc_thread_t *thread, void *user_stack);
 
-// Get the current thread
-#define proc_thread_current() (current_thread)
+// Get the current thread. This is safe to call with interrupts enabled even though the thread may move to another CPU
+#define proc_thread_current() ((proc_thread_t*)percpu_current())
+
+// Sets the current thread on this CPU. Must be called with interrupts disabled
+#define proc_thread_set_current(thread) (this_cpu()->current_thread = (thread))
 
 #endif // _PROC_THREAD_H_
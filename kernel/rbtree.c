@@ -53,6 +53,13 @@ rbtree_node_t* _rbtree_find_root(rbtree_node_t *node) {
     return root;
 }
 
+// Recomputes the augmented data of node and all of its ancestors
+void _rbtree_augment_path(rbtree_t *tree, rbtree_node_t *node) {
+    if (tree->augment == NULL) return;
+
+    for (; node != NULL; node = rbtree_parent(node)) tree->augment(node);
+}
+
 void _rbtree_rotate(rbtree_t *tree, rbtree_node_t *node, rbtree_dir_t dir) {
     // The child must not be null
     rbtree_dir_t opposite_dir = dir ^ 1;
@@ -84,6 +91,12 @@ void _rbtree_rotate(rbtree_t *tree, rbtree_node_t *node, rbtree_dir_t dir) {
     // Finally make node the new child of it's former child
     rbtree_this_child(child, dir) = node;
     rbtree_set_parent(node, child);
+
+    // Only node and child have different subtrees now. Node is below child so it goes first
+    if (tree->augment != NULL) {
+        tree->augment(node);
+        tree->augment(child);
+    }
 }
 
 rbtree_node_t* rbtree_grandparent(rbtree_node_t *node) {
@@ -209,6 +222,9 @@ bool rbtree_insert_here(rbtree_t *tree, rbtree_node_t *parent, rbtree_child_t ch
         rbtree_this_child(parent, child) = node;
     }
 
+    // The rotations below keep the augmented data up to date on their own
+    _rbtree_augment_path(tree, node);
+
     while (true) {
         if (parent == NULL) {
             rbtree_set_black(node);
@@ -316,6 +332,10 @@ bool rbtree_remove(rbtree_t *tree, rbtree_node_t *node) {
         *successor = *node;
     }
 
+    // Every subtree from where the successor was taken out up to the root lost a node. If the successor was the
+    // node's child that's where the successor is now
+    _rbtree_augment_path(tree, (parent == node) ? successor : parent);
+
     rbtree_node_init(node);
 
     if (colour == RBTREE_NODE_RED) return true;
@@ -14,6 +14,10 @@
  * A generic implementation of a red-black tree that can be added to any data structure. The rbtree_entry macro can be
  * used to retrieve the containing data structure from a rbtree node reference. The module implements all the basic
  * operations on a red-black tree and some convenience operations like successor, predecessor and in-order walk.
+ *
+ * A tree may be augmented with data about each node's subtree, e.g. the smallest value of some field in it. The
+ * tree's augment function recomputes that data for a node from the node itself and its children. It's called for
+ * every node whose subtree changes on insert, remove and rotations, so the data stays up to date in O(log n).
  */
 
 // Assuming nodes are at least 2-byte aligned. If they are, we can embed the colour information in the pointer
@@ -30,8 +34,12 @@ typedef struct rbtree_node_s {
     struct rbtree_node_s *children[2];
 } rbtree_node_t;
 
+// Recomputes the augmented data of the given node from the node and its children's augmented data
+typedef void (*rbtree_augment_func_t)(rbtree_node_t*);
+
 typedef struct {
     rbtree_node_t *root;
+    rbtree_augment_func_t augment;  // NULL if the tree isn't augmented
 } rbtree_t;
 
 // A rbtree slot is just an encoding of a parent node and one of it's children where a given node may be inserted
@@ -95,11 +103,12 @@ typedef void (*rbtree_walk_func_t)(rbtree_node_t*);
 #define rbtree_left(node)                              ((node)->children[RBTREE_CHILD_LEFT])
 #define rbtree_right(node)                             ((node)->children[RBTREE_CHILD_RIGHT])
 
-#define RBTREE_INITIALIZER                             ((rbtree_t){ .root = NULL })
+#define RBTREE_INITIALIZER                             ((rbtree_t){ .root = NULL, .augment = NULL })
 #define RBTREE_NODE_INITIALIZER                        ((rbtree_node_t){ .parent = (rbtree_node_t*)(RBTREE_NODE_RED),\
     .children = {NULL, NULL} })
 
 #define rbtree_init(tree)                              (*(tree) = RBTREE_INITIALIZER)
+#define rbtree_init_augmented(tree, func)              (*(tree) = (rbtree_t){ .root = NULL, .augment = (func) })
 #define rbtree_node_init(node)                         (*(node) = RBTREE_NODE_INITIALIZER)
 
 rbtree_node_t* rbtree_grandparent(rbtree_node_t *node);
@@ -29,14 +29,26 @@ list_compare_result_t _slab_buf_find_full(list_node_t *n1, list_node_t *n2) {
     return slab_buf_is_full(s2) ? LIST_COMPARE_EQ : LIST_COMPARE_LT;
 }
 
-list_compare_result_t _slab_buf_compare(list_node_t *n1, list_node_t *n2) {
-    slab_buf_t *s2 = list_entry(n2, slab_buf_t, ll_node);
-    size_t offset = ((uintptr_t)s2 == (uintptr_t)s2->buf) ? sizeof(slab_buf_t) : 0, block_size = *((size_t*)n1);
+bool _slab_buf_contains(slab_t *slab, slab_buf_t *slab_buf, void *block) {
+    size_t offset = ((uintptr_t)slab_buf == (uintptr_t)slab_buf->buf) ? sizeof(slab_buf_t) : 0;
+
+    uintptr_t buf_start = (uintptr_t)slab_buf->buf + offset;
+    uintptr_t buf_end = buf_start + (slab_buf->capacity * slab->block_size);
+    uintptr_t block_start = (uintptr_t)block, block_end = block_start + slab->block_size;
+
+    return block_start >= buf_start && block_end <= buf_end;
+}
+
+slab_buf_t* _slab_buf_find_owner(slab_t *slab, void *block) {
+    // Most slabs only ever have one buffer
+    slab_buf_t *slab_buf = list_entry(list_first(&slab->ll_slabs), slab_buf_t, ll_node);
+    if (list_next(&slab_buf->ll_node) == NULL) return _slab_buf_contains(slab, slab_buf, block) ? slab_buf : NULL;
 
-    uintptr_t buf_start = (uintptr_t)s2->buf + offset, buf_end = buf_start + (s2->capacity * block_size);
-    uintptr_t block_start = (uintptr_t)n1, block_end = block_start + block_size;
+    list_for_each_entry(&slab->ll_slabs, slab_buf, ll_node) {
+        if (_slab_buf_contains(slab, slab_buf, block)) return slab_buf;
+    }
 
-    return (block_start < buf_start) ? LIST_COMPARE_LT : (block_end > buf_end) ? LIST_COMPARE_GT : LIST_COMPARE_EQ;
+    return NULL;
 }
 
 slab_buf_t* _slab_buf_init(slab_buf_t *slab_buf, void *buf, size_t size, size_t block_size) {
@@ -52,13 +64,8 @@ slab_buf_t* _slab_buf_init(slab_buf_t *slab_buf, void *buf, size_t size, size_t
     slab_buf->capacity = (size - offset) / block_size;
     slab_buf->free_blocks_remaining = slab_buf->capacity;
 
-    // Create a pointer chain to link all free blocks
-    list_node_t *next_free = (list_node_t*)(buf + offset);
-    for (unsigned int i = 0; i < slab_buf->free_blocks_remaining; i++) {
-        list_node_init(next_free);
-        list_push(&slab_buf->ll_free, next_free);
-        next_free = (list_node_t*)((uintptr_t)next_free + block_size);
-    }
+    // None of the blocks have been allocated yet. They are carved off the front of the buffer as needed
+    slab_buf->unused = buf + offset;
 
     return slab_buf;
 }
@@ -84,11 +91,15 @@ void* slab_alloc(slab_t *slab) {
     if (this_slab_buf != NULL) {
         kassert(this_slab_buf->free_blocks_remaining <= this_slab_buf->capacity);
 
-        // Allocate a block from this slab and update the book-keeping
+        // Allocate a block from this slab and update the book-keeping. Reuse freed blocks before touching new ones
         list_node_t *free_node;
-        kassert(list_pop(&this_slab_buf->ll_free, free_node));
+        if (list_pop(&this_slab_buf->ll_free, free_node)) {
+            free = (void*)free_node;
+        } else {
+            free = this_slab_buf->unused;
+            this_slab_buf->unused += slab->block_size;
+        }
 
-        free = (void*)free_node;
         this_slab_buf->free_blocks_remaining--;
 
         // Update the first slab buf pointer to point to the latest slab that had free blocks and rearrange the linked
@@ -112,17 +123,22 @@ void slab_free(slab_t *slab, void *block) {
     kassert(slab != NULL && list_first(&slab->ll_slabs) != NULL);
 
     // Search for the slab buf that contains this block
-    *((size_t*)block) = slab->block_size;
-    slab_buf_t *this_slab_buf = list_entry(list_search(&slab->ll_slabs, _slab_buf_compare, (list_node_t*)block),
-        slab_buf_t, ll_node);
+    slab_buf_t *this_slab_buf = _slab_buf_find_owner(slab, block);
 
     // We must not be trying to free something that was never allocated in this slab
     kassert(this_slab_buf != NULL);
-    kassert(this_slab_buf->free_blocks_remaining <= this_slab_buf->capacity);
+
+    slab_free_buf(slab, this_slab_buf, block);
+}
+
+void slab_free_buf(slab_t *slab, slab_buf_t *this_slab_buf, void *block) {
+    kassert(slab != NULL && this_slab_buf != NULL && _slab_buf_contains(slab, this_slab_buf, block));
+    kassert(this_slab_buf->free_blocks_remaining < this_slab_buf->capacity);
 
     // Add this block back into the linked list of free blocks
     list_node_init((list_node_t*)block);
     kassert(list_push(&this_slab_buf->ll_free, (list_node_t*)block));
+    this_slab_buf->free_blocks_remaining++;
 
     // Now determine whether this slab should be placed first in the search order
     // Ideally we want the slab with the most free blocks to be searched first
@@ -18,6 +18,8 @@
  * by simply adding or removing slab buffers from the list. Although slabs are only useful for allocating data
  * structures of a fixed-size or less (which wastes memory) their major benefit is providing allocation and freeing
  * of fixed-size blocks in constant time.
+ * Blocks are handed out from the free list of returned blocks first and then from the part of the buffer that has
+ * never been allocated, so initializing a buffer is constant time and its memory is only touched as blocks are used.
  */
 
 // Slabs must at least be this size
@@ -28,7 +30,8 @@
 typedef struct {
     void *buf;                      // Pointer to the buffer this slab_buf struct is managing
     list_node_t ll_node;            // Slab buffer linked list
-    list_t ll_free;                 // Linked list of free blocks
+    list_t ll_free;                 // Linked list of blocks that have been freed
+    void *unused;                   // Start of the blocks that have never been allocated
     size_t capacity;                // Total # of elements in this slab buffer
     size_t free_blocks_remaining;   // Free blocks remaining in this slab buffer
 } slab_buf_t;
@@ -45,9 +48,12 @@ typedef struct {
 void slab_init(slab_t *slab, slab_buf_t *slab_buf, void *buf, size_t size, size_t block_size);
 
 // Allocate and free a block. slab_zalloc is used to allocate a zero'd out block
+// slab_free searches the slab's buffers for the one containing the block. slab_free_buf frees the block in constant
+// time when the caller already knows which slab buffer it came from
 void* slab_alloc(slab_t *slab);
 void* slab_zalloc(slab_t *slab);
 void slab_free(slab_t *slab, void *block);
+void slab_free_buf(slab_t *slab, slab_buf_t *slab_buf, void *block);
 
 // Routines to grow slabs by linking new slab bufs and shrink slabs by unlinking full slab bufs
 // slab_shrink returns the pointer to the slab buf that was removed
@@ -24,7 +24,7 @@ vfs_mount_t vfs_mount_template;
 
 void vfs_mount_init(void) {
     // Create slab for the vfs_mount_t structs
-    kmem_slab_create(&vfs_mount_slab, sizeof(vfs_mount_t), VFS_MOUNT_SLAB_NUM);
+    kmem_slab_create(&vfs_mount_slab, sizeof(vfs_mount_t), VFS_MOUNT_SLAB_NUM, NULL, NULL);
 
     // Init the vfs mount list
     lock_init(&vfs_mount_list.lock);
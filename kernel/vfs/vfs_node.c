@@ -36,7 +36,7 @@ list_compare_result_t _vfs_node_find(list_node_t *n1, list_node_t *n2) {
 
 void vfs_node_init(void) {
     // Setup the slab for the vfs_node_t structs
-    kmem_slab_create(&vfs_node_slab, sizeof(vfs_node_t), VFS_NODE_SLAB_NUM);
+    kmem_slab_create(&vfs_node_slab, sizeof(vfs_node_t), VFS_NODE_SLAB_NUM, NULL, NULL);
 
     // Initialize the hash table
     arch_fast_zero(vfs_node_hash_table.ll_vnodes, NUM_BUCKETS * sizeof(list_t));
@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <kernel/kassert.h>
+#include <kernel/kstdio.h>
+#include <kernel/hash.h>
+#include <kernel/clocksource.h>
+#include <kernel/lock.h>
+#include <kernel/lz4.h>
+#include <kernel/bitmap.h>
+#include <kernel/kmem_slab.h>
+#include <kernel/arch/arch_asm.h>
+#include <kernel/arch/arch_timer.h>
+#include <kernel/arch/pmap.h>
+#include <kernel/vm/vm_compressor.h>
+
+// Each segment is a contiguous set of pages from the page allocator. Every page in a segment is divided into
+// VM_COMPRESSOR_SLOTS_PER_PAGE slots tracked by one bitmap word. Compressed pages never straddle pages in the segment
+#define VM_COMPRESSOR_SEGMENT_PAGES  (16)
+#define VM_COMPRESSOR_MAX_SEGMENTS   (256)
+#define VM_COMPRESSOR_SLOTS_PER_PAGE (64)
+#define VM_COMPRESSOR_ENTRY_SLAB_NUM (8192)
+#define VM_COMPRESSOR_HASH_BUCKETS   (1024)
+
+// Pages must compress to at most this size to be worth storing
+#define VM_COMPRESSOR_MAX_SIZE       ((PAGESIZE * 3) >> 2)
+
+#define VM_COMPRESSOR_HASH(object, offset) (hash64_fnv1a_pair((uint64_t)object, offset) % VM_COMPRESSOR_HASH_BUCKETS)
+#define VM_COMPRESSOR_SLOT_MASK(n)         (((n) >= VM_COMPRESSOR_SLOTS_PER_PAGE) ? ~0ul : ((1ul << (n)) - 1))
+#define VM_COMPRESSOR_TICKS_TO_USECS(t)    (clocksource_cycles_to_ns(t) / NSECS_PER_USEC)
+
+typedef struct {
+    list_node_t ll_node;                                // Linkage in the list of segments
+    vm_page_t *pages;                                   // First page of the segment
+    vaddr_t base;                                       // Linear mapped address of the segment
+    size_t free_slots;                                  // # of free slots remaining in the segment
+    bitmap_t slots[VM_COMPRESSOR_SEGMENT_PAGES];        // Allocated slots, one word per page
+} vm_compressor_segment_t;
+
+typedef struct {
+    list_node_t ll_node;                                // Hash bucket linkage
+    vm_object_t *object;                                // Object the compressed page belongs to
+    vm_offset_t offset;                                 // Offset in the object of the compressed page
+    vm_compressor_segment_t *segment;                   // Segment holding the compressed data
+    unsigned int slot;                                  // First slot in the segment holding the compressed data
+    unsigned int size;                                  // Compressed size in bytes
+} vm_compressor_entry_t;
+
+typedef struct {
+    lock_t lock;                                        // Protects the entire pool including the scratch buffers
+    list_t ll_segments;                                 // List of all segments in the pool
+    size_t num_segments;                                // # of segments in the pool
+    list_t *ll_entries;                                 // Hash table of entries by object/offset
+    size_t slot_size;                                   // Size of a slot in bytes
+    void *buf;                                          // Scratch buffer for compression output
+    uint16_t *hash_table;                               // Scratch LZ4 hash table
+    vm_compressor_stats_t stats;                        // Statistics
+} vm_compressor_t;
+
+vm_compressor_t vm_compressor;
+
+kmem_slab_t vm_compressor_entry_slab;
+kmem_slab_t vm_compressor_segment_slab;
+
+list_compare_result_t _vm_compressor_entry_find(list_node_t *n1, list_node_t *n2) {
+    vm_compressor_entry_t *e1 = list_entry(n1, vm_compressor_entry_t, ll_node);
+    vm_compressor_entry_t *e2 = list_entry(n2, vm_compressor_entry_t, ll_node);
+    return (e1->offset == e2->offset && e1->object == e2->object) ? LIST_COMPARE_EQ : LIST_COMPARE_LT;
+}
+
+vm_compressor_entry_t* _vm_compressor_entry_find_locked(vm_object_t *object, vm_offset_t offset) {
+    vm_compressor_entry_t key = { .object = object, .offset = ROUND_PAGE_DOWN(offset) };
+    list_node_t *node = list_search(&vm_compressor.ll_entries[VM_COMPRESSOR_HASH(key.object, key.offset)],
+        _vm_compressor_entry_find, &key.ll_node);
+    return list_entry(node, vm_compressor_entry_t, ll_node);
+}
+
+// The pages for the segment are allocated by the caller without the compressor lock held since the page allocator may
+// ask the shrinkers, and in turn the compressor, for memory
+vm_compressor_segment_t* _vm_compressor_segment_create(vm_page_t *pages) {
+    if (vm_compressor.num_segments >= VM_COMPRESSOR_MAX_SEGMENTS) return NULL;
+
+    vm_compressor_segment_t *segment = (vm_compressor_segment_t*)kmem_slab_alloc(&vm_compressor_segment_slab);
+    if (segment == NULL) return NULL;
+
+    segment->pages = pages;
+    list_node_init(&segment->ll_node);
+    segment->base = PA_TO_KVA(vm_page_to_pa(segment->pages));
+    segment->free_slots = VM_COMPRESSOR_SEGMENT_PAGES * VM_COMPRESSOR_SLOTS_PER_PAGE;
+    for (unsigned int i = 0; i < VM_COMPRESSOR_SEGMENT_PAGES; i++) segment->slots[i] = 0;
+
+    kassert(list_insert_last(&vm_compressor.ll_segments, &segment->ll_node));
+    vm_compressor.num_segments++;
+    vm_compressor.stats.pool_pages += VM_COMPRESSOR_SEGMENT_PAGES;
+
+    return segment;
+}
+
+void _vm_compressor_segment_destroy(vm_compressor_segment_t *segment) {
+    kassert(list_remove(&vm_compressor.ll_segments, &segment->ll_node));
+    vm_compressor.num_segments--;
+    vm_compressor.stats.pool_pages -= VM_COMPRESSOR_SEGMENT_PAGES;
+
+    vm_page_free_contiguous(segment->pages, VM_COMPRESSOR_SEGMENT_PAGES);
+    kmem_slab_free(&vm_compressor_segment_slab, segment);
+}
+
+// Find num_slots contiguous free slots within one page of the segment. Returns the first slot or -1
+long _vm_compressor_segment_alloc(vm_compressor_segment_t *segment, unsigned int num_slots) {
+    if (segment->free_slots < num_slots) return -1;
+
+    bitmap_t mask = VM_COMPRESSOR_SLOT_MASK(num_slots);
+    for (unsigned int i = 0; i < VM_COMPRESSOR_SEGMENT_PAGES; i++) {
+        for (unsigned int pos = 0; pos + num_slots <= VM_COMPRESSOR_SLOTS_PER_PAGE; pos++) {
+            if ((segment->slots[i] & (mask << pos)) == 0) {
+                segment->slots[i] |= (mask << pos);
+                segment->free_slots -= num_slots;
+                return (i * VM_COMPRESSOR_SLOTS_PER_PAGE) + pos;
+            }
+        }
+    }
+
+    return -1;
+}
+
+void _vm_compressor_segment_free(vm_compressor_segment_t *segment, unsigned int slot, unsigned int num_slots) {
+    unsigned int i = slot / VM_COMPRESSOR_SLOTS_PER_PAGE, pos = slot % VM_COMPRESSOR_SLOTS_PER_PAGE;
+    segment->slots[i] &= ~(VM_COMPRESSOR_SLOT_MASK(num_slots) << pos);
+    segment->free_slots += num_slots;
+}
+
+void vm_compressor_init(void) {
+    // Create the slabs for the entries and segments. This is called before the vm_page module has been initialized
+    void *buf = (void*)pmap_steal_memory(VM_COMPRESSOR_ENTRY_SLAB_NUM * sizeof(vm_compressor_entry_t), NULL, NULL);
+    kmem_slab_create_no_vm(&vm_compressor_entry_slab, sizeof(vm_compressor_entry_t), VM_COMPRESSOR_ENTRY_SLAB_NUM,
+        buf);
+
+    buf = (void*)pmap_steal_memory(VM_COMPRESSOR_MAX_SEGMENTS * sizeof(vm_compressor_segment_t), NULL, NULL);
+    kmem_slab_create_no_vm(&vm_compressor_segment_slab, sizeof(vm_compressor_segment_t), VM_COMPRESSOR_MAX_SEGMENTS,
+        buf);
+
+    // Allocate the hash table and the scratch buffers
+    size_t size = VM_COMPRESSOR_HASH_BUCKETS * sizeof(list_t);
+    vm_compressor.ll_entries = (list_t*)pmap_steal_memory(size, NULL, NULL);
+    arch_fast_zero(vm_compressor.ll_entries, size);
+
+    vm_compressor.buf = (void*)pmap_steal_memory(PAGESIZE, NULL, NULL);
+    vm_compressor.hash_table = (uint16_t*)pmap_steal_memory(LZ4_HASH_TABLE_SIZE, NULL, NULL);
+
+    lock_init(&vm_compressor.lock);
+    list_init(&vm_compressor.ll_segments);
+    vm_compressor.num_segments = 0;
+    vm_compressor.slot_size = PAGESIZE / VM_COMPRESSOR_SLOTS_PER_PAGE;
+    vm_compressor.stats = (vm_compressor_stats_t){0};
+}
+
+kresult_t vm_compressor_page_out(vm_page_t *page) {
+    kassert(page != NULL && page->object != NULL);
+    kassert(page->object != &kernel_object && page->object != &kernel_lva_object && page->object->pager == NULL);
+
+    if (page->status.wired_count > 0 || page->status.is_busy) return KRESULT_INVALID_ARGUMENT;
+
+    vm_compressor_entry_t *entry = (vm_compressor_entry_t*)kmem_slab_alloc(&vm_compressor_entry_slab);
+    if (entry == NULL) return KRESULT_NO_SPACE;
+
+    // Make sure no one can modify the page while it is being compressed. Writes fault and wait on the object lock held
+    // by the caller. The page stays mapped for reads until it has been stored
+    paddr_t pa = vm_page_to_pa(page);
+    pmap_page_protect(pa, VM_PROT_ALL & ~VM_PROT_WRITE);
+
+    vm_page_t *pages = NULL;
+    vm_compressor_segment_t *segment = NULL;
+    long slot = -1;
+    size_t size;
+
+    for (;;) {
+        lock_acquire_exclusive(&vm_compressor.lock);
+
+        unsigned long start = arch_timer_get_ticks();
+        size = lz4_compress((void*)PA_TO_KVA(pa), PAGESIZE, vm_compressor.buf, VM_COMPRESSOR_MAX_SIZE,
+            vm_compressor.hash_table);
+        vm_compressor.stats.compress_ticks += arch_timer_get_ticks() - start;
+
+        if (size == 0) {
+            vm_compressor.stats.rejections++;
+            break;
+        }
+
+        // Find room in the pool for the compressed data, growing the pool if necessary
+        unsigned int num_slots = (size + vm_compressor.slot_size - 1) / vm_compressor.slot_size;
+
+        list_for_each_entry(&vm_compressor.ll_segments, segment, ll_node) {
+            if ((slot = _vm_compressor_segment_alloc(segment, num_slots)) >= 0) break;
+        }
+
+        if (slot < 0 && pages != NULL && (segment = _vm_compressor_segment_create(pages)) != NULL) {
+            pages = NULL;
+            slot = _vm_compressor_segment_alloc(segment, num_slots);
+        }
+
+        if (slot >= 0 || pages != NULL) break;
+
+        // Allocate the pages for a new segment with the lock dropped. The scratch buffer may be reused in the meantime
+        // so the page is compressed again
+        lock_release_exclusive(&vm_compressor.lock);
+
+        pages = vm_page_alloc_contiguous(VM_COMPRESSOR_SEGMENT_PAGES, NULL, 0);
+        if (pages == NULL) {
+            lock_acquire_exclusive(&vm_compressor.lock);
+            break;
+        }
+    }
+
+    if (slot >= 0) {
+        arch_fast_move((void*)(segment->base + (slot * vm_compressor.slot_size)), vm_compressor.buf, size);
+
+        list_node_init(&entry->ll_node);
+        entry->object = page->object;
+        entry->offset = page->offset;
+        entry->segment = segment;
+        entry->slot = slot;
+        entry->size = size;
+        kassert(list_insert_last(&vm_compressor.ll_entries[VM_COMPRESSOR_HASH(entry->object, entry->offset)],
+            &entry->ll_node));
+
+        vm_compressor.stats.compressions++;
+        vm_compressor.stats.stored_pages++;
+        vm_compressor.stats.stored_bytes += size;
+        vm_compressor.stats.bytes_in += PAGESIZE;
+        vm_compressor.stats.bytes_out += size;
+    }
+
+    lock_release_exclusive(&vm_compressor.lock);
+
+    // Another thread may have grown the pool while the lock was dropped
+    if (pages != NULL) vm_page_free_contiguous(pages, VM_COMPRESSOR_SEGMENT_PAGES);
+
+    if (slot < 0) {
+        kmem_slab_free(&vm_compressor_entry_slab, entry);
+        return KRESULT_NO_SPACE;
+    }
+
+    // The data is safely stored; only now remove the mappings and give the page back
+    pmap_page_protect(pa, VM_PROT_NONE);
+    vm_page_free_locked(page);
+
+    return KRESULT_OK;
+}
+
+kresult_t vm_compressor_page_in(vm_page_t *page) {
+    kassert(page != NULL && page->object != NULL);
+
+    lock_acquire_exclusive(&vm_compressor.lock);
+
+    vm_compressor_entry_t *entry = _vm_compressor_entry_find_locked(page->object, page->offset);
+    if (entry == NULL) {
+        lock_release_exclusive(&vm_compressor.lock);
+        return KRESULT_NOT_FOUND;
+    }
+
+    vm_compressor_segment_t *segment = entry->segment;
+    void *src = (void*)(segment->base + (entry->slot * vm_compressor.slot_size));
+
+    unsigned long start = arch_timer_get_ticks();
+    size_t size = lz4_decompress(src, entry->size, (void*)PA_TO_KVA(vm_page_to_pa(page)), PAGESIZE);
+    vm_compressor.stats.decompress_ticks += arch_timer_get_ticks() - start;
+    kassert(size == PAGESIZE);
+
+    // Release the compressed data and return the segment to the page allocator if it is now empty
+    unsigned int num_slots = (entry->size + vm_compressor.slot_size - 1) / vm_compressor.slot_size;
+    _vm_compressor_segment_free(segment, entry->slot, num_slots);
+    if (segment->free_slots == VM_COMPRESSOR_SEGMENT_PAGES * VM_COMPRESSOR_SLOTS_PER_PAGE) {
+        _vm_compressor_segment_destroy(segment);
+    }
+
+    kassert(list_remove(&vm_compressor.ll_entries[VM_COMPRESSOR_HASH(entry->object, entry->offset)],
+        &entry->ll_node));
+
+    vm_compressor.stats.decompressions++;
+    vm_compressor.stats.stored_pages--;
+    vm_compressor.stats.stored_bytes -= entry->size;
+
+    lock_release_exclusive(&vm_compressor.lock);
+
+    kmem_slab_free(&vm_compressor_entry_slab, entry);
+
+    return KRESULT_OK;
+}
+
+bool vm_compressor_lookup(vm_object_t *object, vm_offset_t offset) {
+    lock_acquire_shared(&vm_compressor.lock);
+    bool found = _vm_compressor_entry_find_locked(object, offset) != NULL;
+    lock_release_shared(&vm_compressor.lock);
+    return found;
+}
+
+void vm_compressor_stats(vm_compressor_stats_t *stats) {
+    kassert(stats != NULL);
+
+    lock_acquire_shared(&vm_compressor.lock);
+    *stats = vm_compressor.stats;
+    lock_release_shared(&vm_compressor.lock);
+}
+
+void vm_compressor_dump_stats(void) {
+    vm_compressor_stats_t stats;
+    vm_compressor_stats(&stats);
+
+    unsigned long ratio = (stats.bytes_out != 0) ? (stats.bytes_in * 100) / stats.bytes_out : 0;
+    unsigned long compress_usecs = (stats.compressions + stats.rejections != 0)
+        ? VM_COMPRESSOR_TICKS_TO_USECS(stats.compress_ticks) / (stats.compressions + stats.rejections) : 0;
+    unsigned long decompress_usecs = (stats.decompressions != 0)
+        ? VM_COMPRESSOR_TICKS_TO_USECS(stats.decompress_ticks) / stats.decompressions : 0;
+
+    kprintf("compressor: %lu pages stored in %lu bytes, pool %lu pages\n", stats.stored_pages, stats.stored_bytes,
+        stats.pool_pages);
+    kprintf("compressor: %lu compressed, %lu decompressed, %lu rejected\n", stats.compressions, stats.decompressions,
+        stats.rejections);
+    kprintf("compressor: ratio %lu.%02lux, compress %lu us/page, decompress %lu us/page\n", ratio / 100, ratio % 100,
+        compress_usecs, decompress_usecs);
+}
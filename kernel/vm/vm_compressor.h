@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _VM_COMPRESSOR_H_
+#define _VM_COMPRESSOR_H_
+
+#include <sys/types.h>
+#include <kernel/kresult.h>
+#include <kernel/vm/vm_types.h>
+#include <kernel/vm/vm_object.h>
+#include <kernel/vm/vm_page.h>
+
+/*
+ * vm_compressor - Compressed in-memory backing store for anonymous memory
+ * Cold pages belonging to anonymous objects are LZ4 compressed into a pool of segments allocated from the page
+ * allocator and the page is freed. The page is decompressed into a newly allocated page when it is faulted on again.
+ * Pages that don't compress to at most 3/4 of a page are left resident.
+ */
+
+typedef struct {
+    size_t stored_pages;             // # of pages currently held compressed in the pool
+    size_t stored_bytes;             // # of compressed bytes currently held in the pool
+    size_t pool_pages;               // # of pages allocated to the pool
+    size_t compressions;             // Total # of pages compressed
+    size_t decompressions;           // Total # of pages decompressed
+    size_t rejections;               // Total # of pages that did not compress well enough to be stored
+    size_t bytes_in;                 // Total uncompressed bytes of all stored pages
+    size_t bytes_out;                // Total compressed bytes of all stored pages
+    unsigned long compress_ticks;    // Total counter ticks spent compressing
+    unsigned long decompress_ticks;  // Total counter ticks spent decompressing
+} vm_compressor_stats_t;
+
+// Initializes the compressor pool
+void vm_compressor_init(void);
+
+// Compresses the page into the pool, removes all mappings to it and frees it. The page's object lock must be held
+// exclusively. Returns KRESULT_NO_SPACE if the page doesn't compress well enough or the pool is full, in which case the
+// page is left resident and mapped; it may have been write-protected in which case the next write faults it back in
+kresult_t vm_compressor_page_out(vm_page_t *page);
+
+// Decompresses the data for the page's object and offset into the page and releases it from the pool
+// Returns KRESULT_NOT_FOUND if the pool does not hold the data for that object/offset
+kresult_t vm_compressor_page_in(vm_page_t *page);
+
+// Returns true if the pool holds compressed data for the given object and offset
+bool vm_compressor_lookup(vm_object_t *object, vm_offset_t offset);
+
+// Get a snapshot of the compressor statistics or print them out
+void vm_compressor_stats(vm_compressor_stats_t *stats);
+void vm_compressor_dump_stats(void);
+
+#endif // _VM_COMPRESSOR_H_
@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <kernel/kassert.h>
+#include <kernel/arch/pmap.h>
+#include <kernel/vm/vm_page.h>
+#include <kernel/vm/vm_pager.h>
+#include <kernel/vm/vm_compressor.h>
+#include <kernel/vm/vm_fault.h>
+
+// # of pages in the naturally aligned window around the faulting address that are mapped in if already resident
+#define VM_FAULT_AROUND_PAGES     (16)
+
+// # of pages ahead of the faulting address that are paged in for mappings with sequential access
+#define VM_FAULT_READAHEAD_PAGES  (32)
+
+// # of pages in a block mapping, i.e. the number of pages a last level translation table maps. Mappings advised to
+// use huge pages are populated in block sized chunks
+#define VM_FAULT_HUGEPAGE_PAGES   (PAGESIZE >> 3)
+
+void _vm_fault_enter(vm_map_t *vmap, vaddr_t vaddr, vm_page_t *page, vm_prot_t prot, pmap_flags_t flags) {
+    // Drop any existing translation for this address, e.g. the zero page being replaced on the first write
+    paddr_t pa;
+    if (pmap_extract(vmap->pmap, vaddr, &pa)) pmap_remove(vmap->pmap, vaddr, vaddr + PAGESIZE);
+
+    pmap_enter(vmap->pmap, vaddr, vm_page_to_pa(page), prot, flags | PMAP_FLAGS_WRITE_BACK);
+}
+
+void _vm_fault_page_abort(vm_object_t *object, vm_page_t *page) {
+    // Throw away a busy page that couldn't be paged in. Threads waiting on it look it up again and find it gone
+    lock_acquire_exclusive(&object->lock);
+    vm_page_clear_busy(page);
+    vm_page_free_locked(page);
+    lock_release_exclusive(&object->lock);
+}
+
+kresult_t _vm_fault_page_in(vm_object_t *object, vm_page_t *page, vm_prot_t access) {
+    kresult_t res;
+
+    // Pagers complete the request later with vm_pager_data_supply which clears the busy state. Compressed anonymous
+    // memory is brought back in right away
+    if (object->pager != NULL) {
+        res = vm_pager_data_request(page, access);
+    } else {
+        res = vm_compressor_page_in(page);
+        if (res == KRESULT_OK) vm_page_clear_busy(page);
+    }
+
+    if (res != KRESULT_OK) _vm_fault_page_abort(object, page);
+
+    return res;
+}
+
+void _vm_fault_around(vm_map_t *vmap, vm_mapping_t *entry, vaddr_t vaddr, vaddr_t start, vaddr_t end) {
+    // Only map pages that are already resident and ready. This never pages anything in. The object lock keeps pages
+    // from being inserted, i.e. before they are zero-filled, or freed while they are being mapped
+    lock_acquire_shared(&entry->object->lock);
+
+    for (vaddr_t va = start; va < end; va += PAGESIZE) {
+        paddr_t pa;
+        if (va == vaddr || pmap_extract(vmap->pmap, va, &pa)) continue;
+
+        vm_page_t *page = vm_page_lookup(entry->object, entry->offset + (va - entry->vstart));
+        if (page == NULL || page->status.is_busy || page->status.is_error) continue;
+        if (page->status.lock_prot & VM_PROT_READ) continue;
+
+        _vm_fault_enter(vmap, va, page, entry->prot & ~page->status.lock_prot, PMAP_FLAGS_READ);
+    }
+
+    lock_release_shared(&entry->object->lock);
+}
+
+void _vm_fault_populate(vm_map_t *vmap, vm_mapping_t *entry, vaddr_t vaddr, vaddr_t start, vaddr_t end,
+    vm_prot_t fault_type) {
+    for (vaddr_t va = start; va < end; va += PAGESIZE) {
+        paddr_t pa;
+        if (va == vaddr || pmap_extract(vmap->pmap, va, &pa)) continue;
+
+        // Give the object its own page rather than the shared zero page so the whole block ends up populated
+        vm_offset_t offset = entry->offset + (va - entry->vstart);
+        vm_page_t *page = NULL;
+        kresult_t res = vm_fault_page_zero_fill(entry->object, offset, fault_type, &page);
+        if (res == KRESULT_RESOURCE_SHORTAGE) return;
+        if (res != KRESULT_OK) continue;
+
+        _vm_fault_enter(vmap, va, page, entry->prot & ~page->status.lock_prot, PMAP_FLAGS_READ);
+    }
+}
+
+void _vm_fault_drop_behind(vm_object_t *object, vm_offset_t offset, size_t size) {
+    // Clear the referenced bit of pages that a sequential access has already moved past so they are the first pages
+    // picked when memory is reclaimed
+    lock_acquire_exclusive(&object->lock);
+
+    for (vm_offset_t off = offset; off < offset + size; off += PAGESIZE) {
+        vm_page_t *page = vm_page_lookup(object, off);
+        if (page != NULL && !page->status.is_busy) pmap_clear_reference(page);
+    }
+
+    lock_release_exclusive(&object->lock);
+}
+
+kresult_t vm_fault_page(vm_object_t *object, vm_offset_t offset, vm_prot_t fault_type, vm_page_t **pagep) {
+    kassert(object != NULL && pagep != NULL);
+
+    offset = ROUND_PAGE_DOWN(offset);
+
+    // The object lock is held from the lookup until a new page has been inserted and marked busy so only one thread
+    // pages it in. It is only dropped to wait on a busy page or to call into the pager or compressor
+    lock_acquire_exclusive(&object->lock);
+
+    for (;;) {
+        vm_page_t *page = vm_page_lookup(object, offset);
+
+        if (page != NULL) {
+            // Another thread is paging this page in; wait for it to complete and look it up again
+            if (page->status.is_busy) {
+                lock_release_exclusive(&object->lock);
+                vm_page_wait_busy(page);
+                lock_acquire_exclusive(&object->lock);
+                continue;
+            }
+
+            // The pager failed to supply the page, possibly for a request nobody waited on (i.e. read ahead). Only the
+            // first thread to find it under the object lock frees it; the others won't find it anymore
+            if (page->status.is_error) {
+                vm_page_free_locked(page);
+                lock_release_exclusive(&object->lock);
+                return KRESULT_NOT_FOUND;
+            }
+
+            // Ask the pager to permit an access it has prohibited and wait for it
+            if ((page->status.lock_prot & fault_type) && object->pager != NULL) {
+                vm_page_set_busy(page);
+                lock_release_exclusive(&object->lock);
+
+                kresult_t res = vm_pager_data_unlock(page, fault_type);
+                if (res != KRESULT_OK) {
+                    vm_page_clear_busy(page);
+                    return res;
+                }
+
+                vm_page_wait_busy(page);
+                lock_acquire_exclusive(&object->lock);
+                continue;
+            }
+
+            lock_release_exclusive(&object->lock);
+
+            *pagep = page;
+            return KRESULT_OK;
+        }
+
+        // Nothing to bring in; anonymous memory that has never been written to
+        if (object->pager == NULL && !vm_compressor_lookup(object, offset)) {
+            lock_release_exclusive(&object->lock);
+
+            *pagep = NULL;
+            return KRESULT_OK;
+        }
+
+        // The page is visible in the object and busy until it has been paged in so other threads faulting on it will
+        // sleep rather than issue another page-in
+        page = vm_page_alloc_locked(object, offset);
+        if (page == NULL) {
+            lock_release_exclusive(&object->lock);
+            return KRESULT_RESOURCE_SHORTAGE;
+        }
+
+        vm_page_set_busy(page);
+        lock_release_exclusive(&object->lock);
+
+        kresult_t res = _vm_fault_page_in(object, page, fault_type);
+        if (res != KRESULT_OK) return res;
+
+        vm_page_wait_busy(page);
+        lock_acquire_exclusive(&object->lock);
+    }
+}
+
+kresult_t vm_fault_page_zero_fill(vm_object_t *object, vm_offset_t offset, vm_prot_t fault_type, vm_page_t **pagep) {
+    offset = ROUND_PAGE_DOWN(offset);
+
+    for (;;) {
+        kresult_t res = vm_fault_page(object, offset, fault_type, pagep);
+        if (res != KRESULT_OK || *pagep != NULL) return res;
+
+        // Another thread may have brought the page in since it was looked up; fault it in again if so
+        lock_acquire_exclusive(&object->lock);
+
+        if (vm_page_lookup(object, offset) == NULL && !vm_compressor_lookup(object, offset)) {
+            *pagep = vm_page_alloc_locked(object, offset);
+            if (*pagep != NULL) pmap_zero_page(vm_page_to_pa(*pagep));
+
+            lock_release_exclusive(&object->lock);
+            return (*pagep != NULL) ? KRESULT_OK : KRESULT_RESOURCE_SHORTAGE;
+        }
+
+        lock_release_exclusive(&object->lock);
+    }
+}
+
+void vm_fault_prefetch(vm_object_t *object, vm_offset_t offset, size_t size) {
+    kassert(object != NULL);
+
+    for (vm_offset_t off = ROUND_PAGE_DOWN(offset); off < offset + size; off += PAGESIZE) {
+        lock_acquire_exclusive(&object->lock);
+
+        if (vm_page_lookup(object, off) != NULL || (object->pager == NULL && !vm_compressor_lookup(object, off))) {
+            lock_release_exclusive(&object->lock);
+            continue;
+        }
+
+        vm_page_t *page = vm_page_alloc_locked(object, off);
+        if (page != NULL) vm_page_set_busy(page);
+
+        lock_release_exclusive(&object->lock);
+
+        if (page == NULL) return;
+
+        // Don't wait for the page-in. A fault on the page will sleep until it has been brought in
+        _vm_fault_page_in(object, page, VM_PROT_READ);
+    }
+}
+
+kresult_t vm_fault(vm_map_t *vmap, vaddr_t vaddr, vm_prot_t fault_type) {
+    kassert(vmap != NULL);
+
+    vm_mapping_t entry;
+
+    vaddr = ROUND_PAGE_DOWN(vaddr);
+
+    kresult_t res = vm_map_lookup(vmap, vaddr, fault_type, &entry);
+    if (res != KRESULT_OK) return res;
+
+    vm_object_t *object = entry.object;
+    vm_offset_t offset = entry.offset + (vaddr - entry.vstart);
+
+    // The first write to a page of the object gives the object its own zero-filled copy
+    vm_page_t *page = NULL;
+    if ((fault_type & VM_PROT_WRITE) || entry.advice == VM_ADVICE_HUGEPAGE) {
+        res = vm_fault_page_zero_fill(object, offset, fault_type, &page);
+    } else {
+        res = vm_fault_page(object, offset, fault_type, &page);
+    }
+
+    if (res != KRESULT_OK) return res;
+
+    vm_prot_t enter_prot = entry.prot;
+
+    // Nothing has been written to this page of the object yet. Map the shared zero page read-only rather than
+    // allocating and zeroing a new page; a write will fault again and get a private page
+    if (page == NULL) {
+        page = vm_page_zero;
+        enter_prot &= ~VM_PROT_WRITE;
+    }
+
+    // Don't grant accesses the pager has prohibited
+    enter_prot &= ~page->status.lock_prot;
+
+    _vm_fault_enter(vmap, vaddr, page, enter_prot, (fault_type & VM_PROT_WRITE) ? PMAP_FLAGS_WRITE : PMAP_FLAGS_READ);
+
+    // Use the mapping's advice to decide what else to bring in with this fault. Windows are clipped to the mapping
+    size_t window;
+    vaddr_t start, end;
+
+    switch (entry.advice) {
+        case VM_ADVICE_RANDOM:
+            break;
+        case VM_ADVICE_SEQUENTIAL:
+            window = VM_FAULT_READAHEAD_PAGES * PAGESIZE;
+            end = (entry.vend - vaddr > window) ? vaddr + window : entry.vend;
+            vm_fault_prefetch(object, offset + PAGESIZE, end - vaddr - PAGESIZE);
+            _vm_fault_around(vmap, &entry, vaddr, vaddr + PAGESIZE, end);
+
+            // Age the pages a full window behind the fault
+            if (vaddr - entry.vstart > window) {
+                start = (vaddr - entry.vstart > 2 * window) ? vaddr - 2 * window : entry.vstart;
+                _vm_fault_drop_behind(object, entry.offset + (start - entry.vstart), vaddr - window - start);
+            }
+            break;
+        case VM_ADVICE_HUGEPAGE:
+            window = VM_FAULT_HUGEPAGE_PAGES * PAGESIZE;
+            start = vaddr & ~(window - 1);
+            start = (start > entry.vstart) ? start : entry.vstart;
+            end = ((vaddr & ~(window - 1)) + window < entry.vend) ? (vaddr & ~(window - 1)) + window : entry.vend;
+            _vm_fault_populate(vmap, &entry, vaddr, start, end, fault_type);
+            break;
+        default:
+            window = VM_FAULT_AROUND_PAGES * PAGESIZE;
+            start = vaddr & ~(window - 1);
+            start = (start > entry.vstart) ? start : entry.vstart;
+            end = ((vaddr & ~(window - 1)) + window < entry.vend) ? (vaddr & ~(window - 1)) + window : entry.vend;
+            _vm_fault_around(vmap, &entry, vaddr, start, end);
+            break;
+    }
+
+    return KRESULT_OK;
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _VM_FAULT_H_
+#define _VM_FAULT_H_
+
+#include <sys/types.h>
+#include <kernel/kresult.h>
+#include <kernel/vm/vm_types.h>
+#include <kernel/vm/vm_object.h>
+#include <kernel/vm/vm_page.h>
+#include <kernel/vm/vm_map.h>
+
+/*
+ * vm_fault - Page fault handling
+ * Resolves a fault on a virtual address by finding the page backing it in the mapped object (paging it in from the
+ * object's pager or creating one) and entering it into the map's pmap. Read faults on anonymous memory that hasn't
+ * been touched yet are satisfied with the shared zero page mapped read-only; a private page is only allocated on the
+ * first write (copy-on-write).
+ * Depending on the mapping's advice, resident pages around the fault are mapped in as well, pages ahead of the fault
+ * are read ahead or the whole surrounding block is populated.
+ */
+
+// Find the page holding the data for the object and offset, paging it in from the object's pager or the compressor
+// if it isn't resident. Sleeps while the page is busy. Returns NULL in pagep if anonymous memory has no data for the
+// offset yet
+kresult_t vm_fault_page(vm_object_t *object, vm_offset_t offset, vm_prot_t fault_type, vm_page_t **pagep);
+
+// Same as vm_fault_page but gives the object its own zero-filled page if anonymous memory has no data for the offset
+// yet. The lookup and insert of the new page are done with the object locked so threads racing on the same offset end
+// up with the same page
+kresult_t vm_fault_page_zero_fill(vm_object_t *object, vm_offset_t offset, vm_prot_t fault_type, vm_page_t **pagep);
+
+// Starts paging in the pages of the object in the given range that aren't resident. Requests to the object's pager
+// are asynchronous; this doesn't wait for them to complete
+void vm_fault_prefetch(vm_object_t *object, vm_offset_t offset, size_t size);
+
+// Handle a fault at the given virtual address in the map. fault_type is the access type that caused the fault
+// Returns KRESULT_OK if the fault was resolved
+kresult_t vm_fault(vm_map_t *vmap, vaddr_t vaddr, vm_prot_t fault_type);
+
+#endif // _VM_FAULT_H_
@@ -4,9 +4,11 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <kernel/kmem_slab.h>
 #include <kernel/arch/pmap.h>
 #include <kernel/vm/vm_map.h>
 #include <kernel/vm/vm_km.h>
+#include <kernel/vm/vm_compressor.h>
 #include <kernel/vm/vm_init.h>
 
 void vm_init(void) {
@@ -15,6 +17,8 @@ void vm_init(void) {
     pmap_init();
     vm_map_init();
     vm_object_init();
+    vm_compressor_init();
+    kmem_slab_init();
     vm_page_init();
     vm_km_init();
 }
@@ -5,6 +5,7 @@
  */
 
 #include <kernel/kassert.h>
+#include <kernel/vmem.h>
 #include <kernel/arch/arch_asm.h>
 #include <kernel/arch/pmap.h>
 #include <kernel/vm/vm_types.h>
@@ -14,6 +15,15 @@
 extern paddr_t kernel_physical_start;
 extern paddr_t kernel_physical_end;
 
+// Arena handing out the kernel heap's address space. The heap is entered as a single mapping in the kernel map so
+// vm_km_alloc doesn't have to touch the map's trees or take its lock. The mapping has no access rights; vm_km_alloc
+// enters the translations for the pages it allocates itself so a fault on a heap address is always a stray access to
+// address space that isn't allocated
+vmem_t vm_km_arena;
+vaddr_t vm_km_arena_start, vm_km_arena_end;
+
+#define IS_VM_KM_ARENA_VA(va) ((va) >= vm_km_arena_start && (va) < vm_km_arena_end)
+
 void vm_km_init(void) {
     vaddr_t kernel_virtual_start, kernel_virtual_end;
     pmap_virtual_space(&kernel_virtual_start, &kernel_virtual_end);
@@ -36,46 +46,70 @@ void vm_km_init(void) {
     res = vm_map_enter_at(vm_map_kernel(), kernel_virtual_start + size, MEMSIZE - size, &kernel_lva_object, 0,
         VM_PROT_DEFAULT);
     kassert(res == KRESULT_OK);
+
+    // Set aside half of the remaining address space for the kernel heap. The kernel object's offsets follow the
+    // virtual addresses so pages for heap addresses can be found the same way as for any other kernel mapping
+    vm_km_arena_start = kernel_virtual_start + MEMSIZE;
+    vm_km_arena_end = vm_km_arena_start + ROUND_PAGE_DOWN((kernel_vmap.end - vm_km_arena_start) >> 1);
+
+    size = vm_km_arena_end - vm_km_arena_start;
+    res = vm_map_enter_at(vm_map_kernel(), vm_km_arena_start, size, &kernel_object,
+        vm_km_arena_start - kernel_vmap.start, VM_PROT_NONE);
+    kassert(res == KRESULT_OK);
+
+    res = vmem_create(&vm_km_arena, vm_km_arena_start, size, PAGESIZE, VMEM_QCACHE_MAX * PAGESIZE);
+    kassert(res == KRESULT_OK);
 }
 
 vaddr_t vm_km_alloc(size_t size, vm_km_flags_t flags) {
     vaddr_t vstart;
     vm_prot_t prot = (flags & VM_KM_FLAGS_EXEC) ? VM_PROT_ALL : VM_PROT_DEFAULT;
-    vm_offset_t offset = kernel_object.size;
 
     size = ROUND_PAGE_UP(size);
 
-    // Enter a mapping for this virtual address range
-    kresult_t res = vm_map_enter(vm_map_kernel(), &vstart, size, &kernel_object, kernel_object.size, prot);
+    // Executable memory and VA only ranges, which are populated by faults, need their own mapping with the right
+    // access rights. Otherwise the address space comes from the heap arena. Either way the kernel object's offsets
+    // follow the virtual addresses so offsets are reused when freed address space is handed out again
+    kresult_t res;
+    if (flags & (VM_KM_FLAGS_EXEC | VM_KM_FLAGS_VAONLY)) {
+        res = vm_map_enter(vm_map_kernel(), &vstart, size, &kernel_object, VM_MAP_OFFSET_VADDR, prot);
+    } else {
+        res = vmem_alloc(&vm_km_arena, size, &vstart);
+    }
 
     if (res != KRESULT_OK) {
         if (flags & VM_KM_FLAGS_CANFAIL) {
             return 0;
         } else {
-            panic("vm_km_alloc - vm_map_enter fail");
+            panic("vm_km_alloc - out of address space");
         }
     }
 
     // We're done here if we only wanted a VA mapping and no actualy physical pages backing it
     if (flags & VM_KM_FLAGS_VAONLY) return vstart;
 
+    pmap_flags_t pmap_flags = PMAP_FLAGS_WRITE_BACK;
+    if (flags & VM_KM_FLAGS_WIRED) {
+        pmap_flags |= PMAP_FLAGS_WIRED;
+    }
+
+    if (flags & VM_KM_FLAGS_CANFAIL) {
+        pmap_flags |= PMAP_FLAGS_CANFAIL;
+    }
+
     // If all goes well, allocate pages into the kernel object for this mapping and enter it into the pmap
+    vm_offset_t offset = vstart - vm_map_kernel()->start;
     for (vaddr_t vaddr = vstart, vend = vstart + size; vaddr < vend; vaddr += PAGESIZE, offset += PAGESIZE) {
         vm_page_t *page = vm_page_alloc(&kernel_object, offset);
 
-        pmap_flags_t flags = PMAP_FLAGS_WRITE_BACK;
-        if (flags & VM_KM_FLAGS_WIRED) {
-            flags |= PMAP_FLAGS_WIRED;
-        }
-
-        if (flags & VM_KM_FLAGS_CANFAIL) {
-            flags |= PMAP_FLAGS_CANFAIL;
-        }
-
-        res = pmap_enter(pmap_kernel(), vaddr, vm_page_to_pa(page), prot, flags);
+        res = (page != NULL) ? pmap_enter(pmap_kernel(), vaddr, vm_page_to_pa(page), prot, pmap_flags) : -1;
 
         if (res != 0) {
+            if (page != NULL) vm_page_free(page);
+
             if (flags & VM_KM_FLAGS_CANFAIL) {
+                // Give back the pages allocated so far and the address space
+                vm_km_free(vstart, size, flags);
                 return 0;
             } else {
                 panic("vm_km_alloc - pmap_enter fail");
@@ -90,4 +124,34 @@ vaddr_t vm_km_alloc(size_t size, vm_km_flags_t flags) {
 }
 
 void vm_km_free(vaddr_t va, size_t size, vm_km_flags_t flags) {
+    kassert(IS_PAGE_ALIGNED(va));
+
+    size = ROUND_PAGE_UP(size);
+    if (size == 0) return;
+
+    bool in_arena = IS_VM_KM_ARENA_VA(va);
+    vm_offset_t offset = va - vm_map_kernel()->start;
+
+    if (!in_arena) {
+        vm_mapping_t entry;
+        kresult_t res = vm_map_lookup(vm_map_kernel(), va, VM_PROT_NONE, &entry);
+        kassert(res == KRESULT_OK && entry.object == &kernel_object);
+        offset = entry.offset + (va - entry.vstart);
+    }
+
+    // Tear down the translations for the whole range in one go before releasing the pages. Even VA only ranges may
+    // have had pages faulted in
+    pmap_remove(pmap_kernel(), va, va + size);
+
+    for (vm_offset_t off = offset; off < offset + size; off += PAGESIZE) {
+        vm_page_t *page = vm_page_lookup(&kernel_object, off);
+        if (page != NULL) vm_page_free(page);
+    }
+
+    // Return the address space to the heap arena or the kernel map's holes
+    if (in_arena) {
+        vmem_free(&vm_km_arena, va, size);
+    } else {
+        kassert(vm_map_remove(vm_map_kernel(), va, va + size) == KRESULT_OK);
+    }
 }
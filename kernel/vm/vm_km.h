@@ -12,7 +12,9 @@
 
 /*
  * Kernel virtual address space allocator.
- * This module allows allocating/freeing virtual address space in the kernel's virtual memory map
+ * This module allows allocating/freeing virtual address space in the kernel's virtual memory map. Most of it comes
+ * from a kernel heap region that is entered in the map once and carved up by a vmem arena; only executable memory
+ * and VA only ranges get their own mapping in the map. Faults on heap addresses are never resolved
  */
 
 typedef unsigned long vm_km_flags_t;
@@ -31,7 +33,8 @@ void vm_km_init(void);
 vaddr_t vm_km_alloc(size_t size, vm_km_flags_t flags);
 
 // Frees the virtual address range allocated by vm_km_alloc. va must be the same as that returned by vm_km_alloc.
-// size and flags must be the same as the ones used in vm_km_alloc
+// size and flags must be the same as the ones used in vm_km_alloc. The range is unmapped, its pages are returned to
+// the page allocator and the address space is returned to the kernel map
 void vm_km_free(vaddr_t va, size_t size, vm_km_flags_t flags);
 
 #endif // _VM_KM_H_
@@ -8,6 +8,8 @@
 #include <kernel/kmem_slab.h>
 #include <kernel/arch/arch_asm.h>
 #include <kernel/vm/vm_page.h>
+#include <kernel/vm/vm_pager.h>
+#include <kernel/vm/vm_fault.h>
 #include <kernel/vm/vm_map.h>
 
 // Kernel vmap
@@ -122,7 +124,9 @@ void _vm_mapping_enter(vm_map_t *vmap, vm_mapping_t *predecessor, vm_mapping_t *
 
     // Check if we can merge the predecessor mapping with this new mapping
     if (predecessor != NULL && predecessor->vend == mapping->vstart && predecessor->object == mapping->object
-        && predecessor->prot == mapping->prot && predecessor->wired == mapping->wired) {
+        && predecessor->offset + (predecessor->vend - predecessor->vstart) == mapping->offset
+        && predecessor->prot == mapping->prot && predecessor->wired == mapping->wired
+        && predecessor->advice == mapping->advice) {
         // Increase the size of the object
         size_t new_size = predecessor->offset + (predecessor->vend - predecessor->vstart) + size;
         vm_object_set_size(predecessor->object, new_size);
@@ -178,6 +182,24 @@ vm_mapping_t* _vm_mapping_split(vm_map_t *vmap, vm_mapping_t *mapping, vaddr_t s
     return split;
 }
 
+void _vm_mapping_dontneed(vm_map_t *vmap, vm_mapping_t *mapping, vaddr_t start, vaddr_t end) {
+    // Wired pages must stay resident and the kernel's objects are never paged out
+    if (mapping->wired || mapping->object == &kernel_object || mapping->object == &kernel_lva_object) return;
+
+    pmap_remove(vmap->pmap, start, end);
+
+    // Push the resident pages out to the pager or compressor. Pages that can't be paged out right now are left alone;
+    // they have been unmapped so they will be the first candidates when memory is reclaimed
+    lock_acquire_exclusive(&mapping->object->lock);
+
+    for (vaddr_t va = start; va < end; va += PAGESIZE) {
+        vm_page_t *page = vm_page_lookup(mapping->object, mapping->offset + (va - mapping->vstart));
+        if (page != NULL && page->status.wired_count == 0 && !page->status.is_busy) vm_pager_page_out(page);
+    }
+
+    lock_release_exclusive(&mapping->object->lock);
+}
+
 void vm_map_init(void) {
     // Create the slab for the vm_mapping_t structs
     void *buf = (void*)pmap_steal_memory(VM_MAPPING_SLAB_NUM * sizeof(vm_mapping_t), NULL, NULL);
@@ -206,6 +228,7 @@ void vm_map_init(void) {
     vm_mapping_template.object = NULL;
     vm_mapping_template.offset = 0;
     vm_mapping_template.wired = 0;
+    vm_mapping_template.advice = VM_ADVICE_NORMAL;
 }
 
 vm_map_t* vm_map_create(pmap_t *pmap, vaddr_t vmin, vaddr_t vmax) {
@@ -312,11 +335,15 @@ kresult_t vm_map_enter(vm_map_t *vmap, vaddr_t *vaddr, size_t size, vm_object_t
 
     tmp.vstart = predecessor->vend;
     tmp.vend = tmp.vstart + size;
+    if (offset == VM_MAP_OFFSET_VADDR) tmp.offset = tmp.vstart - vmap->start;
 
     kassert(tmp.vstart >= vmap->start);
 
     // Make sure it is within the total virtual address space
-    if (tmp.vend > vmap->end) return KRESULT_NO_SPACE;
+    if (tmp.vend > vmap->end) {
+        lock_release_exclusive(&vmap->lock);
+        return KRESULT_NO_SPACE;
+    }
 
     // Find the slot where this mapping will go in the mapping tree (also, it shouldn't exist in the tree)
     kassert(!rbtree_search_slot(&vmap->rb_mappings, _vm_mapping_compare, &tmp.rb_snode, &slot));
@@ -481,8 +508,8 @@ kresult_t vm_map_wire(vm_map_t *vmap, vaddr_t start, vaddr_t end) {
                 vm_page_t *page = vm_page_lookup(mapping->object, offset);
 
                 if (page == NULL) {
-                    page = vm_page_alloc(mapping->object, offset);
-                    kassert(page != NULL);
+                    kassert(vm_fault_page_zero_fill(mapping->object, offset, mapping->prot, &page) == KRESULT_OK);
+
                     pmap_enter(vmap->pmap, moffset + mapping->vstart, vm_page_to_pa(page), mapping->prot,
                         PMAP_FLAGS_WIRED);
                 }
@@ -542,7 +569,99 @@ kresult_t vm_map_unwire(vm_map_t *vmap, vaddr_t start, vaddr_t end) {
     return KRESULT_OK;
 }
 
-kresult_t vm_map_lookup(vm_map_t *vmap, vaddr_t vaddr, vm_prot_t fault_type, vm_object_t *object, vm_offset_t *offset,
-    vm_prot_t *prot) {
-    return KRESULT_UNIMPLEMENTED;
+kresult_t vm_map_advise(vm_map_t *vmap, vaddr_t start, vaddr_t end, vm_advice_t advice) {
+    kassert(vmap != NULL);
+
+    rbtree_node_t *nearest_node = NULL;
+    vm_mapping_t tmp = { .vstart = start, .vend = end };
+
+    // Make sure it is within the total virtual address space
+    if (tmp.vstart < vmap->start && tmp.vend > vmap->end) {
+        return KRESULT_INVALID_ARGUMENT;
+    }
+
+    lock_acquire_exclusive(&vmap->lock);
+
+    // Search for the first mapping entry to contain the starting virtual address of the region specified
+    rbtree_search_predecessor(&vmap->rb_mappings, _vm_mapping_compare, &tmp.rb_snode, &nearest_node, NULL);
+    vm_mapping_t *nearest = rbtree_entry(nearest_node, vm_mapping_t, rb_snode);
+
+    // If we can't find the previous mapping to the starting virtual address to be removed, then try finding the next
+    // mapping
+    if (nearest == NULL) {
+        rbtree_search_successor(&vmap->rb_mappings, _vm_mapping_compare, &tmp.rb_snode, &nearest_node, NULL);
+        nearest = rbtree_entry(nearest_node, vm_mapping_t, rb_snode);
+    }
+
+    // There's no mappings to advise
+    if (nearest == NULL) {
+        lock_release_exclusive(&vmap->lock);
+        return KRESULT_INVALID_ARGUMENT;
+    }
+
+    if (advice == VM_ADVICE_WILLNEED || advice == VM_ADVICE_DONTNEED) {
+        // These act on the pages in the range right away and aren't remembered so there is no need to split mappings
+        for (vm_mapping_t *mapping = nearest; !list_end(mapping) && mapping->vstart < end; ) {
+            vm_mapping_t *next = list_entry(list_next(&mapping->ll_node), vm_mapping_t, ll_node);
+
+            vaddr_t vstart = (start > mapping->vstart) ? ROUND_PAGE_DOWN(start) : mapping->vstart;
+            vaddr_t vend = (end < mapping->vend) ? ROUND_PAGE_UP(end) : mapping->vend;
+
+            if (vstart < vend) {
+                if (advice == VM_ADVICE_WILLNEED) {
+                    vm_fault_prefetch(mapping->object, mapping->offset + (vstart - mapping->vstart), vend - vstart);
+                } else {
+                    _vm_mapping_dontneed(vmap, mapping, vstart, vend);
+                }
+            }
+
+            mapping = next;
+        }
+
+        lock_release_exclusive(&vmap->lock);
+        return KRESULT_OK;
+    }
+
+    // Iterate through mappings and update the advice. Make sure to split if start or end intersects a mapping
+    nearest = (nearest->advice != advice) ? _vm_mapping_split(vmap, nearest, start) : nearest;
+    for (vm_mapping_t *mapping = nearest; !list_end(mapping) && mapping->vstart < end; ) {
+        if (mapping->advice != advice) _vm_mapping_split(vmap, mapping, end);
+
+        vm_mapping_t *next = list_entry(list_next(&mapping->ll_node), vm_mapping_t, ll_node);
+
+        if (mapping->vend > start) mapping->advice = advice;
+
+        mapping = next;
+    }
+
+    lock_release_exclusive(&vmap->lock);
+    return KRESULT_OK;
+}
+
+kresult_t vm_map_lookup(vm_map_t *vmap, vaddr_t vaddr, vm_prot_t fault_type, vm_mapping_t *entry) {
+    kassert(vmap != NULL && entry != NULL);
+
+    vm_mapping_t tmp = { .vstart = vaddr, .vend = vaddr + 1 };
+
+    lock_acquire_shared(&vmap->lock);
+
+    // Find the mapping containing the virtual address
+    rbtree_node_t *node = rbtree_search(&vmap->rb_mappings, _vm_mapping_overlap, &tmp.rb_snode);
+    vm_mapping_t *mapping = rbtree_entry(node, vm_mapping_t, rb_snode);
+
+    if (mapping == NULL) {
+        lock_release_shared(&vmap->lock);
+        return KRESULT_NOT_FOUND;
+    }
+
+    // Make sure the access is allowed by the mapping
+    if ((fault_type & mapping->prot) != fault_type) {
+        lock_release_shared(&vmap->lock);
+        return KRESULT_INVALID_ARGUMENT;
+    }
+
+    *entry = *mapping;
+
+    lock_release_shared(&vmap->lock);
+    return KRESULT_OK;
 }
@@ -16,6 +16,17 @@
 #include <kernel/vm/vm_types.h>
 #include <kernel/vm/vm_object.h>
 
+// Access pattern advice for a range of virtual memory. NORMAL, SEQUENTIAL, RANDOM and HUGEPAGE are remembered by the
+// mappings in the range and change how faults are handled; WILLNEED and DONTNEED act on the range immediately
+typedef enum {
+    VM_ADVICE_NORMAL,      // No special treatment; map in resident pages around the fault
+    VM_ADVICE_SEQUENTIAL,  // Read ahead of the fault aggressively and age pages behind it so they are reclaimed early
+    VM_ADVICE_RANDOM,      // Don't map around the fault or read ahead
+    VM_ADVICE_WILLNEED,    // Start paging in the range now
+    VM_ADVICE_DONTNEED,    // Unmap and page out the range now
+    VM_ADVICE_HUGEPAGE,    // Populate the range in block sized chunks on a fault
+} vm_advice_t;
+
 // A virtual memory mapping represents a contiguous range of virtual address space with the same
 // protections and attributes. Mappings are part of a single map and organized in a red/black tree
 // Mappings are linked to a virtual memory object which provides the data for the mapped virtual address range.
@@ -32,6 +43,7 @@ typedef struct {
     vm_object_t *object;     // The VM object that this vregion is mapping
     vm_offset_t offset;      // The offset into the object that the mapping starts from
     bool wired;              // Is this a wired mapping?
+    vm_advice_t advice;      // Expected access pattern for this mapping
 } vm_mapping_t;
 
 // A virtual memory map represents the entire virtual address space of a process. The map contains
@@ -50,6 +62,10 @@ typedef struct {
     unsigned long refcnt;    // Reference count
 } vm_map_t;
 
+// Pass as the offset to vm_map_enter to use the mapping's distance from the start of the map as the object offset. The
+// kernel object uses this so its offsets track kernel virtual addresses and are reused along with freed address space
+#define VM_MAP_OFFSET_VADDR ((vm_offset_t)-1)
+
 // Declare the kernel's vmap
 extern vm_map_t kernel_vmap;
 
@@ -89,10 +105,13 @@ kresult_t vm_map_wire(vm_map_t *vmap, vaddr_t start, vaddr_t end);
 // Unwires a range of virtual memory. This will not free pages already mapped
 kresult_t vm_map_unwire(vm_map_t *vmap, vaddr_t start, vaddr_t end);
 
-// Given the map, virtual address and fault (i.e. access) type, returns the object, offset and protection of the
-// virtual address
-kresult_t vm_map_lookup(vm_map_t *vmap, vaddr_t vaddr, vm_prot_t fault_type, vm_object_t *object, vm_offset_t *offset,
-    vm_prot_t *prot);
+// Gives advice on how the given virtual address range is expected to be accessed. See vm_advice_t
+kresult_t vm_map_advise(vm_map_t *vmap, vaddr_t start, vaddr_t end, vm_advice_t advice);
+
+// Given the map, virtual address and fault (i.e. access) type, returns a copy of the mapping containing the virtual
+// address. Returns KRESULT_NOT_FOUND if the address isn't mapped and KRESULT_INVALID_ARGUMENT if the fault type isn't
+// permitted by the mapping's protection
+kresult_t vm_map_lookup(vm_map_t *vmap, vaddr_t vaddr, vm_prot_t fault_type, vm_mapping_t *entry);
 
 // Returns a reference to the kernel's vm_map
 #define vm_map_kernel() (&(kernel_vmap))
@@ -5,23 +5,100 @@
  */
 
 #include <kernel/kassert.h>
+#include <kernel/kmem_slab.h>
+#include <kernel/kmem_shrinker.h>
+#include <kernel/arch/pmap.h>
 #include <kernel/vm/vm_page.h>
+#include <kernel/vm/vm_pager.h>
 #include <kernel/vm/vm_object.h>
 
 vm_object_t kernel_object;
 vm_object_t kernel_lva_object;
+vm_object_t vm_object_template;
+
+// vm_object_t slab
+#define VM_OBJECT_SLAB_NUM (256)
+kmem_slab_t vm_object_slab;
+
+// Objects created with vm_object_create. The kernel's objects are never on this list
+lock_t vm_object_list_lock;
+list_t vm_object_list;
+
+size_t _vm_object_shrinker_count(void) {
+    size_t count = 0;
+
+    if (!lock_try_acquire(&vm_object_list_lock)) return 0;
+
+    vm_object_t *object;
+    list_for_each_entry(&vm_object_list, object, ll_node) {
+        if (!lock_try_acquire_shared(&object->lock)) continue;
+        count += list_count(&object->ll_resident);
+        lock_release_shared(&object->lock);
+    }
+
+    lock_release(&vm_object_list_lock);
+
+    return count;
+}
+
+size_t _vm_object_shrinker_scan(size_t num_pages) {
+    size_t freed = 0;
+
+    if (!lock_try_acquire(&vm_object_list_lock)) return 0;
+
+    vm_object_t *object;
+    list_for_each_entry(&vm_object_list, object, ll_node) {
+        if (freed >= num_pages) break;
+
+        // Skip objects that are busy, including the one whose fault may have led here
+        if (!lock_try_acquire_exclusive(&object->lock)) continue;
+        freed += vm_pager_reclaim(object, num_pages - freed);
+        lock_release_exclusive(&object->lock);
+    }
+
+    lock_release(&vm_object_list_lock);
+
+    return freed;
+}
 
 void vm_object_init(void) {
-    lock_init(&kernel_object.lock);
-    list_init(&kernel_object.ll_resident);
+    // Create the slab for the vm_object_t structs
+    void *buf = (void*)pmap_steal_memory(VM_OBJECT_SLAB_NUM * sizeof(vm_object_t), NULL, NULL);
+    kmem_slab_create_no_vm(&vm_object_slab, sizeof(vm_object_t), VM_OBJECT_SLAB_NUM, buf);
+
+    lock_init(&vm_object_template.lock);
+    list_node_init(&vm_object_template.ll_node);
+    list_init(&vm_object_template.ll_resident);
+    vm_object_template.refcnt = 0;
+    vm_object_template.size = 0;
+    vm_object_template.pager = NULL;
+
+    kernel_object = vm_object_template;
     vm_object_reference(&kernel_object);
-    kernel_object.size = 0;
 
-    lock_init(&kernel_lva_object.lock);
-    list_init(&kernel_lva_object.ll_resident);
+    kernel_lva_object = vm_object_template;
     vm_object_reference(&kernel_lva_object);
-    kernel_lva_object.size = 0;
 
+    lock_init(&vm_object_list_lock);
+    list_init(&vm_object_list);
+    kassert(kmem_shrinker_register(_vm_object_shrinker_count, _vm_object_shrinker_scan) == KRESULT_OK);
+}
+
+vm_object_t* vm_object_create(size_t size, struct vm_pager_s *pager) {
+    vm_object_t *object = (vm_object_t*)kmem_slab_alloc(&vm_object_slab);
+    if (object == NULL) return NULL;
+
+    *object = vm_object_template;
+    object->size = size;
+    object->pager = pager;
+
+    vm_object_reference(object);
+
+    lock_acquire(&vm_object_list_lock);
+    kassert(list_insert_last(&vm_object_list, &object->ll_node));
+    lock_release(&vm_object_list_lock);
+
+    return object;
 }
 
 void vm_object_destroy(vm_object_t *object) {
@@ -12,14 +12,18 @@
 #include <kernel/list.h>
 #include <kernel/vm/vm_types.h>
 
+struct vm_pager_s;
+
 // A virtual memory object represents any thing that can be allocated and referenced in a virtual address space
 // An object can be mapped in multiple virtual address maps (i.e. shared) and may not be completely resident in
 // memory. Objects can be backed by actual files or swap space if they are "anonymous" (i.e. not backed by anything)
 typedef struct {
-    lock_t lock;          // RW lock
-    list_t ll_resident;   // List of resident pages for this object
-    unsigned long refcnt; // How many VM regions are referencing this object
-    size_t size;          // Size of the object
+    lock_t lock;              // RW lock
+    list_node_t ll_node;      // Linkage in the list of objects whose pages can be reclaimed
+    list_t ll_resident;       // List of resident pages for this object
+    unsigned long refcnt;     // How many VM regions are referencing this object
+    size_t size;              // Size of the object
+    struct vm_pager_s *pager; // The pager providing the data for this object. NULL for anonymous objects
 } vm_object_t;
 
 // All wired kernel memory belongs to this object
@@ -28,9 +32,14 @@ extern vm_object_t kernel_object;
 // The linear mapped KVA space (not including the kernel code/data area) belongs to this object
 extern vm_object_t kernel_lva_object;
 
-// Initializes the vm_object module
+// Initializes the vm_object module. Registers a shrinker that pages out cold pages of the objects created with
+// vm_object_create when memory is low
 void vm_object_init(void);
 
+// Creates a new object of the given size backed by the given pager. Anonymous objects have no pager
+// The reference count on the object will be set to 1
+vm_object_t* vm_object_create(size_t size, struct vm_pager_s *pager);
+
 // Decrements the reference count; if it's zero frees the object and all it's pages
 void vm_object_destroy(vm_object_t *object);
 
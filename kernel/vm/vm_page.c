@@ -8,6 +8,9 @@
 #include <kernel/hash.h>
 #include <kernel/arch/arch_asm.h>
 #include <kernel/arch/pmap.h>
+#include <kernel/proc/proc_thread.h>
+#include <kernel/kmem_shrinker.h>
+#include <kernel/kmem_atomic.h>
 #include <kernel/vm/vm_page.h>
 
 #define NUM_BINS                 (20)
@@ -22,6 +25,14 @@
 #define GET_BIN_INDEX(num_pages)                     (arch_ctz(num_pages))
 #define WHICH_BUDDY(vm_page_index, bin)              (vm_page_index) & ~((1l << (bin)) - 1)
 
+// Allocations that can't sleep are served from a reserve of free blocks for each of the smallest orders (1, 2, 4 and 8
+// pages). The refill worker keeps each reserve at its target and is kicked when a reserve drops to half of it
+#define VM_PAGE_ATOMIC_ORDERS                        (4)
+#define VM_PAGE_ATOMIC_RESERVE                       (8)
+
+// The kernel's caches are asked to give memory back when the # of free pages drops below this
+#define VM_PAGE_LOW_WATERMARK                        (vm_page_array.num_pages >> 6)
+
 #define VM_PAGE_HASH(object, offset)                 (hash64_fnv1a_pair((uint64_t)object, offset) %\
     vm_page_hash_table.num_buckets)
 
@@ -49,6 +60,8 @@ typedef struct {
     vm_page_t *pages;                // Contiguous array of all pages
     list_t ll_page_bins[NUM_BINS];   // Buddy allocation bins
     size_t num_pages;                // Total # of pages
+    spinlock_t free_lock;            // Protects num_free
+    size_t num_free;                 // # of pages in the buddy bins
 } vm_page_array_t;
 
 vm_page_array_t vm_page_array;
@@ -65,6 +78,20 @@ vm_page_hash_table_t vm_page_hash_table;
 
 vm_page_t vm_page_template;
 
+vm_page_t *vm_page_zero;
+
+// Interlock for sleeping on busy pages
+spinlock_t vm_page_busy_lock;
+
+// Emergency reserves for allocations that can't sleep. Blocks are linked through the first page's ll_rnode
+typedef struct {
+    spinlock_t lock;
+    list_t ll_pages[VM_PAGE_ATOMIC_ORDERS];
+    size_t count[VM_PAGE_ATOMIC_ORDERS];
+} vm_page_atomic_t;
+
+vm_page_atomic_t vm_page_atomic;
+
 list_compare_result_t _vm_page_compare(list_node_t *n1, list_node_t *n2) {
     unsigned long p1 = (uintptr_t)n1, p2 = (uintptr_t)n2;
     return (p1 < p2) ? LIST_COMPARE_LT : (p1 > p2) ? LIST_COMPARE_GT : LIST_COMPARE_EQ;
@@ -149,6 +176,12 @@ void _vm_page_bin_push(vm_page_t *pages, size_t num_pages) {
     }
 }
 
+void _vm_page_free_count_update(long delta) {
+    spinlock_acquire(&vm_page_array.free_lock);
+    vm_page_array.num_free += delta;
+    spinlock_release(&vm_page_array.free_lock);
+}
+
 void _vm_page_insert(vm_page_t *pages, size_t num_pages, vm_object_t *object, vm_offset_t starting_offset) {
     // Add each page in the list to the object and update the pages object and offset fields
     // Also add the page to the hash table
@@ -189,6 +222,45 @@ void _vm_page_remove(vm_page_t *pages, size_t num_pages) {
     }
 }
 
+vm_page_t* _vm_page_alloc_contiguous(size_t num_pages) {
+    kassert(num_pages <= vm_page_array.num_pages && num_pages <= MAX_NUM_CONTIGUOUS_PAGES);
+
+    // Make sure num_pages is a power of 2
+    num_pages = ROUND_UP_POW2(num_pages);
+    vm_page_t *first_page = _vm_page_bin_pop(num_pages);
+
+    // Ask the kernel's caches to give memory back if the allocation can't be satisfied and try again
+    if (first_page == NULL && kmem_shrink(num_pages + VM_PAGE_LOW_WATERMARK) > 0) {
+        first_page = _vm_page_bin_pop(num_pages);
+    }
+
+    if (first_page != NULL) _vm_page_free_count_update(-(long)num_pages);
+
+    // Start reclaiming before the allocator runs out
+    size_t num_free = vm_page_free_count();
+    if (num_free < VM_PAGE_LOW_WATERMARK) kmem_shrink(VM_PAGE_LOW_WATERMARK - num_free);
+
+    // If we found a valid block of pages, mark them as active
+    if (first_page != NULL) {
+        for (unsigned long i = 0; i < num_pages; i++) {
+            first_page[i].status.is_active = 1;
+            first_page[i].slab_buf = NULL;
+        }
+    }
+
+    return first_page;
+}
+
+void _vm_page_free_contiguous(vm_page_t *pages, size_t num_pages) {
+    _vm_page_bin_push(pages, num_pages);
+    _vm_page_free_count_update(num_pages);
+
+    // Clear the active bit
+    for (unsigned long i = 0; i < num_pages; i++) {
+        pages[i].status.is_active = 0;
+    }
+}
+
 void vm_page_init(void) {
     // Allocate space for the vm_page_array
     size_t vm_page_array_size = ROUND_PAGE_UP((MEMSIZE >> PAGESHIFT) * sizeof(vm_page_t));
@@ -196,6 +268,8 @@ void vm_page_init(void) {
 
     vm_page_array.pages = (vm_page_t*)vm_page_array_addr;
     vm_page_array.num_pages = MEMSIZE >> PAGESHIFT;
+    spinlock_init(&vm_page_array.free_lock);
+    vm_page_array.num_free = vm_page_array.num_pages;
 
     for (unsigned long i = 0; i < NUM_BINS; i++) {
         lock_init(&vm_page_array.lock[i]);
@@ -242,6 +316,21 @@ void vm_page_init(void) {
     list_node_init(&vm_page_template.ll_rnode);
     vm_page_template.object = NULL;
     vm_page_template.offset = 0;
+
+    spinlock_init(&vm_page_busy_lock);
+
+    spinlock_init(&vm_page_atomic.lock);
+    for (unsigned int i = 0; i < VM_PAGE_ATOMIC_ORDERS; i++) {
+        list_init(&vm_page_atomic.ll_pages[i]);
+        vm_page_atomic.count[i] = 0;
+    }
+    vm_page_atomic_refill();
+
+    // Allocate and wire the shared zero page in the kernel object
+    vm_page_zero = vm_page_alloc(&kernel_object, kernel_object.size);
+    kassert(vm_page_zero != NULL);
+    vm_page_zero->status.wired_count++;
+    arch_fast_zero((void*)PA_TO_KVA(vm_page_to_pa(vm_page_zero)), PAGESIZE);
 }
 
 #if DEBUG
@@ -286,18 +375,8 @@ vm_page_t* vm_page_lookup(vm_object_t *object, vm_offset_t offset) {
 }
 
 vm_page_t* vm_page_alloc_contiguous(size_t num_pages, vm_object_t *object, vm_offset_t offset) {
-    kassert(num_pages <= vm_page_array.num_pages && num_pages <= MAX_NUM_CONTIGUOUS_PAGES);
-
-    // Make sure num_pages is a power of 2
+    vm_page_t *first_page = _vm_page_alloc_contiguous(num_pages);
     num_pages = ROUND_UP_POW2(num_pages);
-    vm_page_t *first_page = _vm_page_bin_pop(num_pages);
-
-    // If we found a valid block of pages, mark them as active
-    if (first_page != NULL) {
-        for (unsigned long i = 0; i < num_pages; i++) {
-            first_page[i].status.is_active = 1;
-        }
-    }
 
     // If an object is specified, add the page(s) to that object
     if (first_page != NULL && object != NULL) {
@@ -325,11 +404,83 @@ void vm_page_free_contiguous(vm_page_t *pages, size_t num_pages) {
         lock_release_exclusive(&object->lock);
     }
 
-    _vm_page_bin_push(pages, num_pages);
+    _vm_page_free_contiguous(pages, num_pages);
+}
 
-    // Clear the active bit
-    for (unsigned long i = 0; i < num_pages; i++) {
-        pages[i].status.is_active = 0;
+size_t vm_page_free_count(void) {
+    return vm_page_array.num_free;
+}
+
+vm_page_t* vm_page_alloc_atomic(size_t num_pages) {
+    unsigned long order = GET_BIN_INDEX(ROUND_UP_POW2(num_pages));
+    if (order >= VM_PAGE_ATOMIC_ORDERS) return NULL;
+
+    list_node_t *node = NULL;
+
+    spinlock_acquire_irq(&vm_page_atomic.lock);
+    if (list_pop(&vm_page_atomic.ll_pages[order], node)) vm_page_atomic.count[order]--;
+    bool low = vm_page_atomic.count[order] <= (VM_PAGE_ATOMIC_RESERVE >> 1);
+    spinlock_release_irq(&vm_page_atomic.lock);
+
+    if (low) kmem_atomic_kick();
+
+    vm_page_t *pages = list_entry(node, vm_page_t, ll_rnode);
+    if (pages != NULL) list_node_init(&pages->ll_rnode);
+
+    return pages;
+}
+
+void vm_page_free_atomic(vm_page_t *pages, size_t num_pages) {
+    unsigned long order = GET_BIN_INDEX(ROUND_UP_POW2(num_pages));
+    kassert(pages != NULL && pages->object == NULL && order < VM_PAGE_ATOMIC_ORDERS);
+
+    // The pages go back in the reserve; the refill worker gives any excess back to the buddy allocator
+    spinlock_acquire_irq(&vm_page_atomic.lock);
+    kassert(list_push(&vm_page_atomic.ll_pages[order], &pages->ll_rnode));
+    bool high = ++vm_page_atomic.count[order] > (VM_PAGE_ATOMIC_RESERVE << 1);
+    spinlock_release_irq(&vm_page_atomic.lock);
+
+    if (high) kmem_atomic_kick();
+}
+
+void vm_page_atomic_refill(void) {
+    for (unsigned long order = 0; order < VM_PAGE_ATOMIC_ORDERS; order++) {
+        size_t num_pages = 1ul << order;
+
+        // The page allocator may sleep so the reserve lock is only held to update the reserve
+        for (;;) {
+            spinlock_acquire_irq(&vm_page_atomic.lock);
+            size_t count = vm_page_atomic.count[order];
+            spinlock_release_irq(&vm_page_atomic.lock);
+
+            if (count >= VM_PAGE_ATOMIC_RESERVE) break;
+
+            vm_page_t *pages = vm_page_alloc_contiguous(num_pages, NULL, 0);
+            if (pages == NULL) break;
+
+            spinlock_acquire_irq(&vm_page_atomic.lock);
+            kassert(list_push(&vm_page_atomic.ll_pages[order], &pages->ll_rnode));
+            vm_page_atomic.count[order]++;
+            spinlock_release_irq(&vm_page_atomic.lock);
+        }
+
+        // Trim the reserve if frees have overfilled it
+        for (;;) {
+            list_node_t *node = NULL;
+
+            spinlock_acquire_irq(&vm_page_atomic.lock);
+            if (vm_page_atomic.count[order] > VM_PAGE_ATOMIC_RESERVE
+                && list_pop(&vm_page_atomic.ll_pages[order], node)) {
+                vm_page_atomic.count[order]--;
+            }
+            spinlock_release_irq(&vm_page_atomic.lock);
+
+            if (node == NULL) break;
+
+            vm_page_t *pages = list_entry(node, vm_page_t, ll_rnode);
+            list_node_init(&pages->ll_rnode);
+            vm_page_free_contiguous(pages, num_pages);
+        }
     }
 }
 
@@ -341,6 +492,22 @@ void vm_page_free(vm_page_t *page) {
     vm_page_free_contiguous(page, 1);
 }
 
+vm_page_t* vm_page_alloc_locked(vm_object_t *object, vm_offset_t offset) {
+    kassert(object != NULL);
+
+    vm_page_t *page = _vm_page_alloc_contiguous(1);
+    if (page != NULL) _vm_page_insert(page, 1, object, offset);
+
+    return page;
+}
+
+void vm_page_free_locked(vm_page_t *page) {
+    kassert(page != NULL && page->object != NULL);
+
+    _vm_page_remove(page, 1);
+    _vm_page_free_contiguous(page, 1);
+}
+
 void vm_page_wire(vm_page_t *page) {
     if (page->object != NULL) lock_acquire_exclusive(&page->object->lock);
     page->status.wired_count++;
@@ -353,6 +520,32 @@ void vm_page_unwire(vm_page_t *page) {
     if (page->object != NULL) lock_release_exclusive(&page->object->lock);
 }
 
+void vm_page_set_busy(vm_page_t *page) {
+    spinlock_acquire_irq(&vm_page_busy_lock);
+    kassert(!page->status.is_busy);
+    page->status.is_busy = 1;
+    spinlock_release_irq(&vm_page_busy_lock);
+}
+
+void vm_page_clear_busy(vm_page_t *page) {
+    spinlock_acquire_irq(&vm_page_busy_lock);
+    page->status.is_busy = 0;
+    spinlock_release_irq(&vm_page_busy_lock);
+
+    proc_thread_wake(page, -1);
+}
+
+void vm_page_wait_busy(vm_page_t *page) {
+    spinlock_acquire_irq(&vm_page_busy_lock);
+
+    while (page->status.is_busy) {
+        proc_thread_sleep(page, &vm_page_busy_lock, false);
+        spinlock_acquire_irq(&vm_page_busy_lock);
+    }
+
+    spinlock_release_irq(&vm_page_busy_lock);
+}
+
 paddr_t vm_page_to_pa(vm_page_t *page) {
     kassert(page != NULL);
     return (GET_PAGE_INDEX(page) << PAGESHIFT) + MEMBASEADDR;
@@ -382,6 +575,7 @@ vm_page_t* vm_page_reserve_pa(paddr_t pa) {
             page->status.wired_count++;
 
             kassert(list_remove(&vm_page_array.ll_page_bins[bin], &buddy->ll_rnode));
+            _vm_page_free_count_update(-(1l << bin));
 
             // Loop through the lower bins splitting the buddy in two, keeping the buddy that has the page we want to
             // reserve and freeing the other buddy
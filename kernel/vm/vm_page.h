@@ -18,14 +18,24 @@ typedef struct {
         unsigned int is_referenced:1;   // Has this page been referenced recently
         unsigned int is_dirty:1;        // Has this page been modified
         unsigned int is_active:1;       // Is this page being used i.e. mapped in some virtual map
-        unsigned int is_busy:1;         // This page is busy for I/O
+        // The bits above share a word and are written under the object lock. These are written under other locks, or
+        // by the pager without the object lock, so each is a separate byte that can be stored without touching the
+        // others
+        uint8_t is_busy;                // This page is busy for I/O, written under vm_page_busy_lock
+        uint8_t is_error;               // The pager failed to supply the data for this page
+        uint8_t lock_prot;              // Accesses to this page that the pager has prohibited
     } status;
     list_node_t ll_onode;               // Object/offset hash table bucket linkage
     list_node_t ll_rnode;               // Linked list of resident pages in an object or part of the buddy free list
     vm_object_t *object;                // VM object this page belongs to if any
     vm_offset_t offset;                 // Offset in that VM object that this page refers to
+    void *slab_buf;                     // The slab buffer this page holds blocks for, if any
 } vm_page_t;
 
+// The shared zero page. This page is owned by the kernel_object, is always wired and always zero-filled. It is mapped
+// read-only in place of anonymous memory that has not been written to yet
+extern vm_page_t *vm_page_zero;
+
 // Initialization of vm_page module after pmap has been initialized and kernel is running in virtual memory mode
 void vm_page_init(void);
 
@@ -36,14 +46,38 @@ vm_page_t* vm_page_lookup(vm_object_t *object, vm_offset_t offset);
 vm_page_t* vm_page_alloc_contiguous(size_t num_pages, vm_object_t *object, vm_offset_t offset);
 void vm_page_free_contiguous(vm_page_t *pages, size_t num_pages);
 
+// Allocate or free a contiguous range of up to 8 pages without sleeping. These use a reserve of free blocks protected
+// by a spinlock so they can be called from interrupt handlers or with spinlocks held. The pages don't belong to any
+// object. Returns NULL if the reserve for that size is empty
+vm_page_t* vm_page_alloc_atomic(size_t num_pages);
+void vm_page_free_atomic(vm_page_t *pages, size_t num_pages);
+
+// Brings the reserves used by vm_page_alloc_atomic back to their target size. May sleep
+void vm_page_atomic_refill(void);
+
+// Returns the # of free pages
+size_t vm_page_free_count(void);
+
 // Allocate or free one page
 vm_page_t* vm_page_alloc(vm_object_t *object, vm_offset_t offset);
 void vm_page_free(vm_page_t *page);
 
+// Same as vm_page_alloc and vm_page_free for callers that already hold the object's lock exclusively, i.e. to look up
+// and insert a page without another thread inserting one at the same offset in between
+vm_page_t* vm_page_alloc_locked(vm_object_t *object, vm_offset_t offset);
+void vm_page_free_locked(vm_page_t *page);
+
 // Increase/decrease the wire count on the page
 void vm_page_wire(vm_page_t *page);
 void vm_page_unwire(vm_page_t *page);
 
+// Mark the page busy or clear the busy state waking any threads waiting for the page
+void vm_page_set_busy(vm_page_t *page);
+void vm_page_clear_busy(vm_page_t *page);
+
+// Sleep until the page is no longer busy
+void vm_page_wait_busy(vm_page_t *page);
+
 // Convert a page to a physical address and vice versa
 paddr_t vm_page_to_pa(vm_page_t *page);
 vm_page_t* vm_page_from_pa(paddr_t pa);
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <kernel/kassert.h>
+#include <kernel/arch/pmap.h>
+#include <kernel/vm/vm_compressor.h>
+#include <kernel/vm/vm_pager.h>
+
+void _vm_pager_lock_update(vm_page_t *page, vm_prot_t lock_prot) {
+    // Take away any access that is now prohibited from existing mappings of the page
+    if (lock_prot & ~page->status.lock_prot) pmap_page_protect(vm_page_to_pa(page), VM_PROT_ALL & ~lock_prot);
+    page->status.lock_prot = lock_prot & VM_PROT_ALL;
+}
+
+kresult_t vm_pager_data_request(vm_page_t *page, vm_prot_t access) {
+    kassert(page != NULL && page->object != NULL && page->object->pager != NULL);
+
+    kassert(page->status.is_busy);
+
+    vm_pager_t *pager = page->object->pager;
+
+    page->status.is_error = 0;
+
+    return pager->ops->data_request(pager, page, access);
+}
+
+kresult_t vm_pager_data_unlock(vm_page_t *page, vm_prot_t access) {
+    kassert(page != NULL && page->object != NULL && page->object->pager != NULL);
+
+    kassert(page->status.is_busy);
+
+    vm_pager_t *pager = page->object->pager;
+    if (pager->ops->data_unlock == NULL) return KRESULT_OPERATION_NOT_SUPPORTED;
+
+    return pager->ops->data_unlock(pager, page, access);
+}
+
+void vm_pager_data_supply(vm_page_t *page, kresult_t result, vm_prot_t lock_prot) {
+    kassert(page != NULL && page->status.is_busy);
+
+    page->status.is_error = (result != KRESULT_OK);
+    page->status.lock_prot = lock_prot & VM_PROT_ALL;
+
+    vm_page_clear_busy(page);
+}
+
+void vm_pager_data_lock(vm_page_t *page, vm_prot_t lock_prot) {
+    kassert(page != NULL);
+
+    _vm_pager_lock_update(page, lock_prot);
+
+    if (page->status.is_busy) vm_page_clear_busy(page);
+}
+
+kresult_t vm_pager_page_out(vm_page_t *page) {
+    kassert(page != NULL && page->object != NULL);
+
+    vm_object_t *object = page->object;
+
+    // Anonymous memory is paged out to the compressor
+    if (object->pager == NULL) return vm_compressor_page_out(page);
+
+    if (page->status.wired_count > 0 || page->status.is_busy) return KRESULT_INVALID_ARGUMENT;
+
+    // Remove all mappings so the page can't be modified while it is written back
+    pmap_page_protect(vm_page_to_pa(page), VM_PROT_NONE);
+
+    if (pmap_clear_modify(page)) {
+        vm_page_set_busy(page);
+        kresult_t res = object->pager->ops->data_return(object->pager, page);
+        vm_page_clear_busy(page);
+
+        if (res != KRESULT_OK) return res;
+    }
+
+    vm_page_free_locked(page);
+
+    return KRESULT_OK;
+}
+
+size_t vm_pager_reclaim(vm_object_t *object, size_t num_pages) {
+    kassert(object != NULL);
+
+    // The kernel's objects are never paged out
+    if (object == &kernel_object || object == &kernel_lva_object) return 0;
+
+    size_t freed = 0;
+    vm_page_t *next = NULL;
+
+    for (vm_page_t *page = list_entry(list_first(&object->ll_resident), vm_page_t, ll_rnode);
+        page != NULL && freed < num_pages; page = next) {
+        next = list_entry(list_next(&page->ll_rnode), vm_page_t, ll_rnode);
+
+        if (page->status.wired_count > 0 || page->status.is_busy) continue;
+
+        // Give recently referenced pages a second chance
+        if (pmap_clear_reference(page)) continue;
+
+        if (vm_pager_page_out(page) == KRESULT_OK) freed++;
+    }
+
+    return freed;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _VM_PAGER_H_
+#define _VM_PAGER_H_
+
+#include <sys/types.h>
+#include <kernel/kresult.h>
+#include <kernel/vm/vm_types.h>
+#include <kernel/vm/vm_object.h>
+#include <kernel/vm/vm_page.h>
+
+/*
+ * vm_pager - External pager interface
+ * A pager provides the data for a vm_object and accepts modified data back from it. Objects without a pager are
+ * anonymous and are paged to the compressor. Page-ins are asynchronous: the page is inserted into the object and marked
+ * busy before data_request is issued and the pager completes the request at some later point with
+ * vm_pager_data_supply. Threads faulting on a busy page sleep on it, so any number of page-ins may be outstanding at
+ * once. A pager may also prohibit certain accesses to a page; faults on those accesses issue data_unlock and the pager
+ * responds with vm_pager_data_lock.
+ */
+
+struct vm_pager_s;
+
+typedef struct {
+    // Request data for the page's object and offset with the given access. The page is busy and mapped in the kernel's
+    // linear map. The request may complete asynchronously but must always complete with vm_pager_data_supply unless
+    // an error is returned here
+    kresult_t (*data_request)(struct vm_pager_s *pager, vm_page_t *page, vm_prot_t access);
+
+    // Write back the modified page to the backing store. The page is busy for the duration of the call
+    kresult_t (*data_return)(struct vm_pager_s *pager, vm_page_t *page);
+
+    // Request that the given access be permitted on a page the pager has locked. Must always complete with
+    // vm_pager_data_lock unless an error is returned here
+    kresult_t (*data_unlock)(struct vm_pager_s *pager, vm_page_t *page, vm_prot_t access);
+} vm_pager_ops_t;
+
+typedef struct vm_pager_s {
+    vm_pager_ops_t *ops;  // Pager operations
+    void *data;           // Pager private data
+} vm_pager_t;
+
+// Issue a data_request to the object's pager for the given page. The caller marks the page busy with the object lock
+// held so that other threads faulting on it sleep rather than issue another request; wait for the request to complete
+// with vm_page_wait_busy. Returns an error if the request could not be issued in which case the page is left busy for
+// the caller to clean up
+kresult_t vm_pager_data_request(vm_page_t *page, vm_prot_t access);
+
+// Issue a data_unlock to the object's pager for the given page. Same semantics as vm_pager_data_request
+kresult_t vm_pager_data_unlock(vm_page_t *page, vm_prot_t access);
+
+// Called by the pager to complete a data_request. lock_prot is the set of accesses the pager prohibits on the page
+void vm_pager_data_supply(vm_page_t *page, kresult_t result, vm_prot_t lock_prot);
+
+// Called by the pager to complete a data_unlock or to change the accesses prohibited on a page
+void vm_pager_data_lock(vm_page_t *page, vm_prot_t lock_prot);
+
+// Page out the page to its object's pager, or to the compressor for anonymous objects, and free it. The page's object
+// lock must be held exclusively
+kresult_t vm_pager_page_out(vm_page_t *page);
+
+// Page out up to num_pages cold pages from the object. Recently referenced pages are given a second chance.
+// The object's lock must be held exclusively. Returns the number of pages freed
+size_t vm_pager_reclaim(vm_object_t *object, size_t num_pages);
+
+#endif // _VM_PAGER_H_
@@ -21,6 +21,11 @@ extern unsigned long PAGESHIFT;
 #define KVA_TO_PA(kva)              (((kva) - kernel_virtual_start) + kernel_physical_start)
 #define PA_TO_KVA(pa)               (((pa) - kernel_physical_start) + kernel_virtual_start)
 
+// The linear map covers physical memory starting at the kernel's physical start address
+#define IS_LINEAR_MAPPED(pa, size)  ((pa) >= kernel_physical_start &&\
+    ((pa) + (size)) <= (kernel_physical_start + MEMSIZE))
+#define IS_LINEAR_KVA(va)           ((va) >= kernel_virtual_start && (va) < (kernel_virtual_start + MEMSIZE))
+
 // Virtual address
 typedef uintptr_t vaddr_t;
 extern vaddr_t max_kernel_virtual_end;
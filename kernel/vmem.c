@@ -0,0 +1,448 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <kernel/kassert.h>
+#include <kernel/hash.h>
+#include <kernel/arch/arch_asm.h>
+#include <kernel/vm/vm_types.h>
+#include <kernel/vm/vm_page.h>
+#include <kernel/vmem.h>
+
+#define VMEM_HASH(vmem, addr)    (hash64_fnv1a(addr) & ((vmem)->hash_size - 1))
+#define VMEM_ROUND(size, q)      (((size) + ((q) - 1)) & ~((q) - 1))
+
+typedef enum {
+    VMEM_SEG_SPAN,
+    VMEM_SEG_FREE,
+    VMEM_SEG_ALLOC,
+} vmem_seg_type_t;
+
+// Boundary tag describing a span or a segment in a span
+typedef struct {
+    list_node_t ll_snode;      // Linkage in the arena's segment list
+    list_node_t ll_fnode;      // Linkage in a freelist when free, a hash bucket when allocated or the tag pool
+    vmem_addr_t start;
+    size_t size;
+    vmem_seg_type_t type;
+} vmem_seg_t;
+
+// Pool of unused boundary tags shared by all arenas
+typedef struct {
+    spinlock_t lock;
+    list_t ll_free;
+} vmem_tag_pool_t;
+
+vmem_tag_pool_t vmem_tag_pool;
+
+vmem_seg_t* _vmem_seg_alloc(void) {
+    list_node_t *node;
+
+    for (;;) {
+        spinlock_acquire(&vmem_tag_pool.lock);
+        list_pop(&vmem_tag_pool.ll_free, node);
+        spinlock_release(&vmem_tag_pool.lock);
+
+        if (node != NULL) return list_entry(node, vmem_seg_t, ll_fnode);
+
+        // Carve up a page for new tags. Tags are never given back, the pool only grows as big as the arenas need.
+        // The page is used through the linear map so vmem can be used to manage the kernel's own address space
+        vm_page_t *page = vm_page_alloc_contiguous(1, NULL, 0);
+        if (page == NULL) return NULL;
+
+        paddr_t pa = vm_page_to_pa(page);
+        if (!IS_LINEAR_MAPPED(pa, PAGESIZE)) {
+            vm_page_free_contiguous(page, 1);
+            return NULL;
+        }
+
+        vmem_seg_t *segs = (vmem_seg_t*)PA_TO_KVA(pa);
+
+        spinlock_acquire(&vmem_tag_pool.lock);
+        for (size_t i = 0; i < PAGESIZE / sizeof(vmem_seg_t); i++) {
+            list_node_init(&segs[i].ll_snode);
+            list_node_init(&segs[i].ll_fnode);
+            list_push(&vmem_tag_pool.ll_free, &segs[i].ll_fnode);
+        }
+        spinlock_release(&vmem_tag_pool.lock);
+    }
+}
+
+void _vmem_seg_free(vmem_seg_t *seg) {
+    if (seg == NULL) return;
+
+    spinlock_acquire(&vmem_tag_pool.lock);
+    list_push(&vmem_tag_pool.ll_free, &seg->ll_fnode);
+    spinlock_release(&vmem_tag_pool.lock);
+}
+
+// Returns the freelist a segment of the given size belongs on, i.e. the highest bit set in the size
+unsigned int _vmem_freelist_index(size_t size) {
+    return 63 - arch_clz(size);
+}
+
+void _vmem_freelist_insert(vmem_t *vmem, vmem_seg_t *seg) {
+    unsigned int idx = _vmem_freelist_index(seg->size);
+
+    seg->type = VMEM_SEG_FREE;
+    list_push(&vmem->freelists[idx], &seg->ll_fnode);
+    vmem->freemap |= (1ul << idx);
+}
+
+void _vmem_freelist_remove(vmem_t *vmem, vmem_seg_t *seg) {
+    unsigned int idx = _vmem_freelist_index(seg->size);
+
+    kassert(list_remove(&vmem->freelists[idx], &seg->ll_fnode));
+    if (list_is_empty(&vmem->freelists[idx])) vmem->freemap &= ~(1ul << idx);
+}
+
+// Size of the pages backing a hash table of the given # of buckets
+size_t _vmem_hash_pages(size_t buckets) {
+    return VMEM_ROUND(buckets * sizeof(list_t), PAGESIZE) >> PAGESHIFT;
+}
+
+// Moves the allocated segments to a table of at least the given # of buckets. Must be called without the lock held
+// since the new table comes from the page allocator
+void _vmem_hash_grow(vmem_t *vmem, size_t buckets) {
+    size_t num_pages = _vmem_hash_pages(buckets);
+
+    // If the table can't be grown keep using the current one, lookups just get slower
+    vm_page_t *pages = vm_page_alloc_contiguous(num_pages, NULL, 0);
+    if (pages == NULL) return;
+
+    paddr_t pa = vm_page_to_pa(pages);
+    if (!IS_LINEAR_MAPPED(pa, num_pages * PAGESIZE)) {
+        vm_page_free_contiguous(pages, num_pages);
+        return;
+    }
+
+    // Use all of the pages, the # of buckets stays a power of 2 since the table size is
+    buckets = (num_pages * PAGESIZE) / sizeof(list_t);
+    list_t *hash = (list_t*)PA_TO_KVA(pa);
+
+    for (size_t i = 0; i < buckets; i++) {
+        list_init(&hash[i]);
+    }
+
+    lock_acquire(&vmem->lock);
+
+    // Someone else may have grown the table while the lock wasn't held
+    if (vmem->hash_size >= buckets) {
+        lock_release(&vmem->lock);
+        vm_page_free_contiguous(pages, num_pages);
+        return;
+    }
+
+    list_t *old_hash = vmem->hash;
+    size_t old_size = vmem->hash_size;
+
+    vmem->hash = hash;
+    vmem->hash_size = buckets;
+
+    for (size_t i = 0; i < old_size; i++) {
+        list_node_t *node;
+        while (!list_is_empty(&old_hash[i])) {
+            list_pop(&old_hash[i], node);
+            vmem_seg_t *seg = list_entry(node, vmem_seg_t, ll_fnode);
+            list_push(&vmem->hash[VMEM_HASH(vmem, seg->start)], &seg->ll_fnode);
+        }
+    }
+
+    lock_release(&vmem->lock);
+
+    if (old_hash != vmem->hash0) {
+        vm_page_free_contiguous(vm_page_from_pa(KVA_TO_PA((vaddr_t)old_hash)), _vmem_hash_pages(old_size));
+    }
+}
+
+void _vmem_xfree(vmem_t *vmem, vmem_addr_t addr, size_t size) {
+    vmem_seg_t *seg = NULL, *prev = NULL, *next = NULL;
+
+    lock_acquire(&vmem->lock);
+
+    list_t *bucket = &vmem->hash[VMEM_HASH(vmem, addr)];
+    list_for_each_entry(bucket, seg, ll_fnode) {
+        if (seg->start == addr) break;
+    }
+
+    kassert(seg != NULL && seg->size == size);
+    kassert(list_remove(bucket, &seg->ll_fnode));
+    vmem->hash_count--;
+    vmem->inuse_size -= size;
+
+    // Coalesce with free neighbours. Spans start with a span tag so segments are never merged across spans
+    prev = list_entry(list_prev(&seg->ll_snode), vmem_seg_t, ll_snode);
+    if (prev != NULL && prev->type == VMEM_SEG_FREE) {
+        _vmem_freelist_remove(vmem, prev);
+        kassert(list_remove(&vmem->ll_segs, &prev->ll_snode));
+        seg->start = prev->start;
+        seg->size += prev->size;
+    } else {
+        prev = NULL;
+    }
+
+    next = list_entry(list_next(&seg->ll_snode), vmem_seg_t, ll_snode);
+    if (next != NULL && next->type == VMEM_SEG_FREE) {
+        _vmem_freelist_remove(vmem, next);
+        kassert(list_remove(&vmem->ll_segs, &next->ll_snode));
+        seg->size += next->size;
+    } else {
+        next = NULL;
+    }
+
+    _vmem_freelist_insert(vmem, seg);
+
+    lock_release(&vmem->lock);
+
+    _vmem_seg_free(prev);
+    _vmem_seg_free(next);
+}
+
+// Gives all the segments held in the quantum caches back to the arena so they can be coalesced
+void _vmem_qcache_flush(vmem_t *vmem) {
+    for (unsigned int i = 0; i < VMEM_QCACHE_MAX; i++) {
+        vmem_qcache_t *qc = &vmem->qcache[i];
+
+        for (;;) {
+            vmem_addr_t addr;
+
+            spinlock_acquire(&qc->lock);
+            if (qc->count == 0) {
+                spinlock_release(&qc->lock);
+                break;
+            }
+            addr = qc->addrs[--qc->count];
+            spinlock_release(&qc->lock);
+
+            _vmem_xfree(vmem, addr, (i + 1) * vmem->quantum);
+        }
+    }
+}
+
+// Finds a free segment that can hold size. Must be called with the lock held
+vmem_seg_t* _vmem_seg_find(vmem_t *vmem, size_t size) {
+    // Instant-fit: every segment on freelist i is at least 2^i in size so the first segment on the first non-empty
+    // freelist at or above the request rounded up to a power of 2 is guaranteed to fit
+    unsigned int idx = _vmem_freelist_index(size) + (((size & (size - 1)) != 0) ? 1 : 0);
+    unsigned long map = (idx < VMEM_FREELISTS) ? vmem->freemap & ~((1ul << idx) - 1) : 0;
+    vmem_seg_t *seg = NULL;
+
+    if (map != 0) {
+        seg = list_entry(list_first(&vmem->freelists[arch_ctz(map)]), vmem_seg_t, ll_fnode);
+    } else {
+        // Nothing is guaranteed to fit, the request's own freelist may still have a segment that is big enough
+        list_for_each_entry(&vmem->freelists[_vmem_freelist_index(size)], seg, ll_fnode) {
+            if (seg->size >= size) break;
+        }
+    }
+
+    return seg;
+}
+
+kresult_t _vmem_xalloc(vmem_t *vmem, size_t size, vmem_addr_t *addr) {
+    // Get the tag for the leftover part of the segment up front so the page allocator isn't called with the lock held
+    vmem_seg_t *split = _vmem_seg_alloc();
+    if (split == NULL) return KRESULT_RESOURCE_SHORTAGE;
+
+    lock_acquire(&vmem->lock);
+    vmem_seg_t *seg = _vmem_seg_find(vmem, size);
+
+    // The free segments needed may be sitting in the quantum caches. Give them back to the arena and look again
+    if (seg == NULL && vmem->qcache_max > 0) {
+        lock_release(&vmem->lock);
+        _vmem_qcache_flush(vmem);
+        lock_acquire(&vmem->lock);
+        seg = _vmem_seg_find(vmem, size);
+    }
+
+    if (seg == NULL) {
+        lock_release(&vmem->lock);
+        _vmem_seg_free(split);
+        return KRESULT_NO_SPACE;
+    }
+
+    _vmem_freelist_remove(vmem, seg);
+
+    // Give the rest of the segment back to the freelists
+    if (seg->size > size) {
+        split->start = seg->start + size;
+        split->size = seg->size - size;
+        kassert(list_insert_after(&vmem->ll_segs, &seg->ll_snode, &split->ll_snode));
+        _vmem_freelist_insert(vmem, split);
+
+        seg->size = size;
+        split = NULL;
+    }
+
+    seg->type = VMEM_SEG_ALLOC;
+    list_push(&vmem->hash[VMEM_HASH(vmem, seg->start)], &seg->ll_fnode);
+    vmem->inuse_size += size;
+    *addr = seg->start;
+
+    // Keep the load factor at or below 1
+    size_t grow = (++vmem->hash_count > vmem->hash_size) ? vmem->hash_size << 1 : 0;
+
+    lock_release(&vmem->lock);
+
+    _vmem_seg_free(split);
+    if (grow != 0) _vmem_hash_grow(vmem, grow);
+
+    return KRESULT_OK;
+}
+
+kresult_t vmem_create(vmem_t *vmem, vmem_addr_t base, size_t size, size_t quantum, size_t qcache_max) {
+    kassert(vmem != NULL);
+
+    if (quantum == 0 || (quantum & (quantum - 1)) != 0) return KRESULT_INVALID_ARGUMENT;
+
+    lock_init(&vmem->lock);
+    vmem->quantum = quantum;
+    list_init(&vmem->ll_segs);
+    vmem->freemap = 0;
+    vmem->total_size = 0;
+    vmem->inuse_size = 0;
+
+    qcache_max = VMEM_ROUND(qcache_max, quantum);
+    vmem->qcache_max = (qcache_max > (VMEM_QCACHE_MAX * quantum)) ? VMEM_QCACHE_MAX * quantum : qcache_max;
+
+    for (unsigned int i = 0; i < VMEM_FREELISTS; i++) {
+        list_init(&vmem->freelists[i]);
+    }
+
+    vmem->hash = vmem->hash0;
+    vmem->hash_size = VMEM_HASH_BUCKETS;
+    vmem->hash_count = 0;
+
+    for (unsigned int i = 0; i < VMEM_HASH_BUCKETS; i++) {
+        list_init(&vmem->hash[i]);
+    }
+
+    for (unsigned int i = 0; i < VMEM_QCACHE_MAX; i++) {
+        spinlock_init(&vmem->qcache[i].lock);
+        vmem->qcache[i].count = 0;
+    }
+
+    return (size > 0) ? vmem_add(vmem, base, size) : KRESULT_OK;
+}
+
+void vmem_destroy(vmem_t *vmem) {
+    kassert(vmem != NULL);
+
+    // Give the cached segments back to the arena first
+    _vmem_qcache_flush(vmem);
+
+    lock_acquire(&vmem->lock);
+    kassert(vmem->inuse_size == 0);
+
+    list_node_t *node;
+    while (!list_is_empty(&vmem->ll_segs)) {
+        list_pop(&vmem->ll_segs, node);
+
+        vmem_seg_t *seg = list_entry(node, vmem_seg_t, ll_snode);
+        if (seg->type == VMEM_SEG_FREE) _vmem_freelist_remove(vmem, seg);
+        _vmem_seg_free(seg);
+    }
+
+    vmem->total_size = 0;
+
+    list_t *hash = vmem->hash;
+    size_t hash_size = vmem->hash_size;
+    vmem->hash = vmem->hash0;
+    vmem->hash_size = VMEM_HASH_BUCKETS;
+
+    lock_release(&vmem->lock);
+
+    if (hash != vmem->hash0) {
+        vm_page_free_contiguous(vm_page_from_pa(KVA_TO_PA((vaddr_t)hash)), _vmem_hash_pages(hash_size));
+    }
+}
+
+kresult_t vmem_add(vmem_t *vmem, vmem_addr_t base, size_t size) {
+    kassert(vmem != NULL);
+
+    if (size == 0 || (base & (vmem->quantum - 1)) != 0 || (size & (vmem->quantum - 1)) != 0 || base + size < base) {
+        return KRESULT_INVALID_ARGUMENT;
+    }
+
+    vmem_seg_t *span = _vmem_seg_alloc();
+    vmem_seg_t *seg = _vmem_seg_alloc();
+
+    if (span == NULL || seg == NULL) {
+        _vmem_seg_free(span);
+        _vmem_seg_free(seg);
+        return KRESULT_RESOURCE_SHORTAGE;
+    }
+
+    span->start = seg->start = base;
+    span->size = seg->size = size;
+    span->type = VMEM_SEG_SPAN;
+
+    lock_acquire(&vmem->lock);
+
+    // Spans are kept in address order. Find the first span after this one making sure they don't overlap
+    vmem_seg_t *next;
+    list_for_each_entry(&vmem->ll_segs, next, ll_snode) {
+        if (next->type != VMEM_SEG_SPAN) continue;
+
+        if (next->start < base + size && base < next->start + next->size) {
+            lock_release(&vmem->lock);
+            _vmem_seg_free(span);
+            _vmem_seg_free(seg);
+            return KRESULT_INVALID_ARGUMENT;
+        }
+
+        if (next->start > base) break;
+    }
+
+    kassert(list_insert_before(&vmem->ll_segs, (next != NULL) ? &next->ll_snode : NULL, &span->ll_snode));
+    kassert(list_insert_after(&vmem->ll_segs, &span->ll_snode, &seg->ll_snode));
+    _vmem_freelist_insert(vmem, seg);
+    vmem->total_size += size;
+
+    lock_release(&vmem->lock);
+
+    return KRESULT_OK;
+}
+
+kresult_t vmem_alloc(vmem_t *vmem, size_t size, vmem_addr_t *addr) {
+    kassert(vmem != NULL && addr != NULL);
+
+    if (size == 0 || VMEM_ROUND(size, vmem->quantum) < size) return KRESULT_INVALID_ARGUMENT;
+    size = VMEM_ROUND(size, vmem->quantum);
+
+    if (size <= vmem->qcache_max) {
+        vmem_qcache_t *qc = &vmem->qcache[(size >> arch_ctz(vmem->quantum)) - 1];
+
+        spinlock_acquire(&qc->lock);
+        if (qc->count > 0) {
+            *addr = qc->addrs[--qc->count];
+            spinlock_release(&qc->lock);
+            return KRESULT_OK;
+        }
+        spinlock_release(&qc->lock);
+    }
+
+    return _vmem_xalloc(vmem, size, addr);
+}
+
+void vmem_free(vmem_t *vmem, vmem_addr_t addr, size_t size) {
+    kassert(vmem != NULL && size > 0);
+
+    size = VMEM_ROUND(size, vmem->quantum);
+
+    if (size <= vmem->qcache_max) {
+        vmem_qcache_t *qc = &vmem->qcache[(size >> arch_ctz(vmem->quantum)) - 1];
+
+        spinlock_acquire(&qc->lock);
+        if (qc->count < VMEM_QCACHE_SIZE) {
+            qc->addrs[qc->count++] = addr;
+            spinlock_release(&qc->lock);
+            return;
+        }
+        spinlock_release(&qc->lock);
+    }
+
+    _vmem_xfree(vmem, addr, size);
+}
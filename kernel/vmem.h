@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2020 Sekhar Bhattacharya
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _VMEM_H_
+#define _VMEM_H_
+
+#include <sys/types.h>
+#include <kernel/lock.h>
+#include <kernel/spinlock.h>
+#include <kernel/list.h>
+#include <kernel/kresult.h>
+
+/*
+ * vmem - General purpose resource allocator
+ * vmem manages arenas of integer resources: ranges of kernel virtual addresses, but just as well ASIDs, IRQ vectors or
+ * port names. It is based on Bonwick's "Magazines and Vmem" paper. An arena is made up of spans of resources which are
+ * broken up into segments, each described by a boundary tag. Free segments are kept in power of 2 freelists and
+ * allocations use instant-fit: the first segment on the smallest freelist guaranteed to hold the request is taken, so
+ * an allocation or free is constant time regardless of how fragmented the arena is. Allocated segments are found by
+ * address in a hash table and are coalesced with their free neighbours when freed. The hash table starts out small and
+ * is doubled whenever there are more allocated segments than buckets so lookups stay constant time.
+ *
+ * Small allocations (up to a few quanta) are also cached in per-size quantum caches. These are stacks of free
+ * segments of exactly that size which satisfy most allocations and frees without taking the arena lock or splitting
+ * and coalescing segments.
+ *
+ * Resources don't have to be memory, vmem never touches them. The boundary tags come from a pool of pages taken from
+ * the page allocator through the linear map.
+ */
+
+typedef unsigned long vmem_addr_t;
+
+// # of power of 2 freelists, one for each possible bit of a segment's size
+#define VMEM_FREELISTS     (64)
+
+// Initial # of buckets in the allocated segment hash table. It grows as the arena fills up
+#define VMEM_HASH_BUCKETS  (64)
+
+// Maximum # of quantum caches, i.e. allocations up to this many quanta can be cached
+#define VMEM_QCACHE_MAX    (8)
+
+// # of free segments each quantum cache can hold
+#define VMEM_QCACHE_SIZE   (32)
+
+typedef struct {
+    spinlock_t lock;
+    size_t count;                              // # of free segments in the cache
+    vmem_addr_t addrs[VMEM_QCACHE_SIZE];       // Start of each free segment
+} vmem_qcache_t;
+
+typedef struct {
+    lock_t lock;                               // Protects everything except the quantum caches
+    size_t quantum;                            // Unit of allocation, a power of 2. All sizes are rounded up to it
+    size_t qcache_max;                         // Allocations up to this size go through the quantum caches
+    list_t ll_segs;                            // All segments, spans first, in address order
+    list_t freelists[VMEM_FREELISTS];          // Free segments by the highest bit set in their size
+    unsigned long freemap;                     // Bit set for every freelist that isn't empty
+    list_t *hash;                              // Allocated segments by start address
+    size_t hash_size;                          // # of buckets in the hash table, a power of 2
+    size_t hash_count;                         // # of allocated segments in the hash table
+    list_t hash0[VMEM_HASH_BUCKETS];           // Initial hash table, used until the arena outgrows it
+    size_t total_size;                         // Total size of all spans
+    size_t inuse_size;                         // Size of all allocated segments, including those in the caches
+    vmem_qcache_t qcache[VMEM_QCACHE_MAX];
+} vmem_t;
+
+// Initializes an arena with an optional initial span [base, base + size). size may be 0 for an empty arena.
+// quantum must be a power of 2. Allocations up to qcache_max bytes (at most VMEM_QCACHE_MAX quanta, 0 to disable) are
+// cached in quantum caches
+kresult_t vmem_create(vmem_t *vmem, vmem_addr_t base, size_t size, size_t quantum, size_t qcache_max);
+
+// Releases all resources held by the arena. Nothing may be allocated from it
+void vmem_destroy(vmem_t *vmem);
+
+// Adds the span [base, base + size) to the arena. It must not overlap any span already in the arena
+kresult_t vmem_add(vmem_t *vmem, vmem_addr_t base, size_t size);
+
+// Allocates size resources (rounded up to the quantum) from the arena. The start of the allocated segment is returned
+// in addr. Segments held in the quantum caches are given back to the arena before failing. Returns KRESULT_NO_SPACE if
+// no free segment can hold the request. May sleep
+kresult_t vmem_alloc(vmem_t *vmem, size_t size, vmem_addr_t *addr);
+
+// Frees a segment previously allocated with vmem_alloc. size must be the same as that given to vmem_alloc
+void vmem_free(vmem_t *vmem, vmem_addr_t addr, size_t size);
+
+#endif // _VMEM_H_
@@ -110,6 +110,8 @@ bool _qemu_virt_platform_init_irq(fdt_header_t *fdth, platform_fdt_info_t *fdt_i
         irq_controller.data = (void*)&arm_gicv3;
         irq_controller.ops = &arm_gicv3_ops;
         irq_controller.spurious_id = ARM_GICV3_SPURIOUS_IRQ_ID;
+        // SGI 0 is used for IPIs
+        irq_controller.ipi_id = 0;
     } else if (strcmp("arm,cortex-a15-gic", compatible) == 0) {
         // Get the GICD base address and size
         prop = fdt_get_prop(fdth, node, "reg");
@@ -137,6 +139,8 @@ bool _qemu_virt_platform_init_irq(fdt_header_t *fdth, platform_fdt_info_t *fdt_i
         irq_controller.data = (void*)&arm_gicv2;
         irq_controller.ops = &arm_gicv2_ops;
         irq_controller.spurious_id = ARM_GICV2_SPURIOUS_IRQ_ID;
+        // SGI 0 is used for IPIs
+        irq_controller.ipi_id = 0;
     } else {
         return false;
     }
@@ -168,8 +172,8 @@ bool _qemu_virt_platform_init_irq(fdt_header_t *fdth, platform_fdt_info_t *fdt_i
 
     // Enable the timer interrupt
     irq_controller.timer_id = ((int_type == 1) ? 16 : 32) + int_id;
-    irq_type_t irq_type = (int_trigger_type & 0xf) < 2 ? IRQ_TYPE_LEVEL_SENSITIVE : IRQ_TYPE_EDGE_TRIGGERED;
-    irq_controller.ops->enable(irq_controller.data, irq_controller.timer_id, 0, irq_type);
+    irq_controller.timer_type = (int_trigger_type & 0xf) < 2 ? IRQ_TYPE_LEVEL_SENSITIVE : IRQ_TYPE_EDGE_TRIGGERED;
+    irq_controller.ops->enable(irq_controller.data, irq_controller.timer_id, 0, irq_controller.timer_type);
 
     return true;
 }
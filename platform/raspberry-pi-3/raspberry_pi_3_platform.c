@@ -150,6 +150,8 @@ bool _raspberry_pi_3_platform_init_irq(fdt_header_t *fdth, platform_fdt_info_t *
     irq_controller.data = (void*)&bcm2836_l1_intc;
     irq_controller.ops = &bcm2836_l1_intc_ops;
     irq_controller.spurious_id = BCM2836_L1_INTC_SPURIOUS_IRQ_ID;
+    // Mailbox 0 of each core is used for IPIs
+    irq_controller.ipi_id = BCM2836_L1_INTC_IPI_IRQ_ID;
 
     // Setup the system timer interrupt
     node = fdt_get_node(fdth, "/timer");
@@ -176,8 +178,8 @@ bool _raspberry_pi_3_platform_init_irq(fdt_header_t *fdth, platform_fdt_info_t *
 
     // Enable the timer interrupt
     irq_controller.timer_id = int_id;
-    irq_type_t irq_type = int_trigger_type == 4 ? IRQ_TYPE_LEVEL_SENSITIVE : IRQ_TYPE_EDGE_TRIGGERED;
-    irq_controller.ops->enable(irq_controller.data, irq_controller.timer_id, 0, irq_type);
+    irq_controller.timer_type = int_trigger_type == 4 ? IRQ_TYPE_LEVEL_SENSITIVE : IRQ_TYPE_EDGE_TRIGGERED;
+    irq_controller.ops->enable(irq_controller.data, irq_controller.timer_id, 0, irq_controller.timer_type);
 
     return true;
 }
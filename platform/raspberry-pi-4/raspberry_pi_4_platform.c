@@ -173,6 +173,8 @@ bool _raspberry_pi_4_platform_init_irq(fdt_header_t *fdth, platform_fdt_info_t *
     irq_controller.data = (void*)&arm_gicv2;
     irq_controller.ops = &arm_gicv2_ops;
     irq_controller.spurious_id = ARM_GICV2_SPURIOUS_IRQ_ID;
+    // SGI 0 is used for IPIs
+    irq_controller.ipi_id = 0;
 
     // Setup the system timer interrupt
     node = fdt_get_node(fdth, "/timer");
@@ -202,8 +204,8 @@ bool _raspberry_pi_4_platform_init_irq(fdt_header_t *fdth, platform_fdt_info_t *
 
     // Enable the timer interrupt
     irq_controller.timer_id = ((int_type == 1) ? 16 : 32) + int_id;
-    irq_type_t irq_type = (int_trigger_type & 0xf) > 2 ? IRQ_TYPE_LEVEL_SENSITIVE : IRQ_TYPE_EDGE_TRIGGERED;
-    irq_controller.ops->enable(irq_controller.data, irq_controller.timer_id, 0, irq_type);
+    irq_controller.timer_type = (int_trigger_type & 0xf) > 2 ? IRQ_TYPE_LEVEL_SENSITIVE : IRQ_TYPE_EDGE_TRIGGERED;
+    irq_controller.ops->enable(irq_controller.data, irq_controller.timer_id, 0, irq_controller.timer_type);
 
     return true;
 }